@@ -0,0 +1,400 @@
+/* bench-e2e.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*
+ * End-to-end benchmark driver: generates a reproducible (per seed) corpus of
+ * synthetic gzip compressed input files, runs rd-multi-strm over them once
+ * per mode (a set of command line options) and per file count, and writes a
+ * JSON report of wall time, CPU time, peak RSS, system call counts and
+ * throughput for each run.
+ *
+ * System calls are taken from the -stats-json report of rd-multi-strm - its
+ * read() and poll() counts being the bulk of the system calls it makes.
+ *
+ * usage: bench-e2e [options]
+ *   -exe <path>              rd-multi-strm executable (default ./rd-multi-strm)
+ *   -dir <path>              corpus directory (default bench-corpus)
+ *   -seed <n>                corpus seed (default 1)
+ *   -files <n>[,<n>...]      file counts to run (default 1,10,100)
+ *   -size-dist <dist>        uncompressed file size in KiB: fixed:<n> | uniform:<min>:<max> | pareto:<min>:<alpha>
+ *                            (default uniform:64:1024)
+ *   -line-dist <dist>        line length: fixed:<n> | uniform:<min>:<max> (default uniform:20:200)
+ *   -compressibility <f>     0 (random text) .. 1 (text from a small vocabulary) (default 0.7)
+ *   -stderr-noise <f>        fraction of files given trailing garbage, which gzip warns of on stderr (default 0)
+ *   -mode <name>=<options>   a named set of rd-multi-strm options; may be repeated
+ *                            (default bufsize-64=-bufsize 64, bufsize-4k=-bufsize 4096, bufsize-64k=-bufsize 65535)
+ *   -report <path>           report file (default is stdout)
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "metrics.h"
+
+struct distribution {
+  std::string kind{"fixed"};
+  double a{0}, b{0};
+
+  static bool parse(std::string_view text, distribution &dist) {
+    auto const colon = text.find(':');
+    if (colon == std::string_view::npos) return false;
+    dist.kind = text.substr(0, colon);
+    auto const params = std::string{text.substr(colon + 1)};
+    char *end = nullptr;
+    dist.a = strtod(params.c_str(), &end);
+    dist.b = dist.a;
+    if (*end == ':') dist.b = strtod(end + 1, &end);
+    return *end == '\0' && (dist.kind == "fixed" || dist.kind == "uniform" || dist.kind == "pareto");
+  }
+
+  double sample(std::mt19937_64 &rng) const {
+    if (kind == "uniform") return std::uniform_real_distribution<double>{a, std::max(a, b)}(rng);
+    if (kind == "pareto") {
+      auto const u = std::uniform_real_distribution<double>{0.0, 1.0}(rng);
+      return a / std::pow(1.0 - u, 1.0 / std::max(b, 0.01));
+    }
+    return a;
+  }
+
+  std::string str() const {
+    std::string s{kind};
+    s += ':';
+    s += std::to_string(a);
+    if (kind != "fixed") {
+      s += ':';
+      s += std::to_string(b);
+    }
+    return s;
+  }
+};
+
+struct corpus_params {
+  std::string dir{"bench-corpus"};
+  unsigned long seed{1};
+  distribution size_kib{"uniform", 64, 1024};
+  distribution line_len{"uniform", 20, 200};
+  double compressibility{0.7};
+  double stderr_noise{0.0};
+
+  std::string manifest(size_t file_count) const {
+    std::ostringstream os;
+    os << "seed=" << seed << " files=" << file_count << " size-dist=" << size_kib.str()
+       << " line-dist=" << line_len.str() << " compressibility=" << compressibility
+       << " stderr-noise=" << stderr_noise << "\n";
+    return os.str();
+  }
+};
+
+struct bench_mode {
+  std::string name;
+  std::vector<std::string> args;
+};
+
+static const char * const vocabulary[] = {
+  "INFO", "WARN", "ERROR", "request", "response", "completed", "user", "session", "GET", "POST", "/api/v1/items",
+  "latency_ms=", "status=200", "status=404", "cache", "miss", "hit", "db", "query", "took", "connection", "pool",
+};
+
+static std::string file_path(const corpus_params &params, size_t const idx) {
+  char name[32];
+  snprintf(name, sizeof(name), "f%06zu.log.gz", idx);
+  return params.dir + "/" + name;
+}
+
+// writes one synthetic file through a gzip child process; returns its uncompressed size
+static size_t generate_file(const corpus_params &params, size_t const idx) {
+  std::mt19937_64 rng{params.seed * 1000003 + idx};
+  std::uniform_real_distribution<double> coin{0.0, 1.0};
+  auto const target = static_cast<size_t>(std::max(1.0, params.size_kib.sample(rng)) * 1024.0);
+  auto const path = file_path(params, idx);
+  const std::string cmd = "gzip -c > '" + path + "'";
+  auto const out = popen(cmd.c_str(), "w");
+  if (out == nullptr) {
+    fprintf(stderr, "ERROR: popen(\"%s\"): %s\n", cmd.c_str(), strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  std::string line{};
+  size_t written = 0;
+  unsigned long ts = 1700000000000UL + idx;
+  while (written < target) {
+    line.clear();
+    line += std::to_string(ts);
+    ts += 1 + rng() % 1000;
+    auto const len = static_cast<size_t>(std::max(1.0, params.line_len.sample(rng)));
+    while (line.size() < len) {
+      line.push_back(' ');
+      if (coin(rng) < params.compressibility) {
+        line += vocabulary[rng() % std::size(vocabulary)];
+      } else {
+        for(int i = 0; i < 8; i++) line.push_back(static_cast<char>('!' + rng() % 94));
+      }
+    }
+    line.push_back('\n');
+    fwrite(line.data(), 1, line.size(), out);
+    written += line.size();
+  }
+  if (pclose(out) != 0) {
+    fprintf(stderr, "ERROR: gzip failed writing \"%s\"\n", path.c_str());
+    exit(EXIT_FAILURE);
+  }
+  if (coin(rng) < params.stderr_noise) {
+    auto const fp = fopen(path.c_str(), "a");
+    if (fp != nullptr) {
+      fputs("trailing garbage", fp);  // gzip decompresses the file but warns on stderr
+      fclose(fp);
+    }
+  }
+  return written;
+}
+
+// (re)generates the corpus unless the manifest shows it was already generated with the same parameters
+static size_t prepare_corpus(const corpus_params &params, size_t const file_count) {
+  mkdir(params.dir.c_str(), 0755);
+  auto const manifest_path = params.dir + "/manifest.txt";
+  auto const manifest = params.manifest(file_count);
+  std::string existing{};
+  {
+    std::ifstream in{manifest_path};
+    std::getline(in, existing);
+    existing += "\n";
+  }
+  size_t total = 0;
+  if (existing == manifest) {
+    std::ifstream in{params.dir + "/sizes.txt"};
+    size_t n;
+    while (in >> n) total += n;
+    fprintf(stderr, "INFO: reusing corpus of %zu files in \"%s\"\n", file_count, params.dir.c_str());
+    return total;
+  }
+  fprintf(stderr, "INFO: generating corpus of %zu files in \"%s\"\n", file_count, params.dir.c_str());
+  std::ofstream sizes{params.dir + "/sizes.txt"};
+  for(size_t i = 0; i < file_count; i++) {
+    auto const n = generate_file(params, i);
+    sizes << n << "\n";
+    total += n;
+  }
+  std::ofstream{manifest_path} << manifest;
+  return total;
+}
+
+// the uncompressed size of the first file_count files of the corpus
+static size_t corpus_bytes(const corpus_params &params, size_t const file_count) {
+  std::ifstream in{params.dir + "/sizes.txt"};
+  size_t n, total = 0;
+  for(size_t i = 0; i < file_count && in >> n; i++) total += n;
+  return total;
+}
+
+static void remove_outputs(const corpus_params &params, size_t const file_count) {
+  for(size_t i = 0; i < file_count; i++) {
+    auto path = file_path(params, i);
+    path.resize(path.size() - 3); // the output file drops the .gz suffix
+    unlink(path.c_str());
+    unlink((path + ".err").c_str());
+  }
+}
+
+// finds the first "key": <number> in a JSON text - the totals of a stats report precede the per stream entries
+static double json_number(std::string_view json, std::string_view key) {
+  std::string quoted{};
+  quoted.reserve(key.size() + 3);
+  quoted += '"';
+  quoted.append(key);
+  quoted += "\":";
+  auto const pos = json.find(quoted);
+  if (pos == std::string_view::npos) return -1;
+  return strtod(json.data() + pos + quoted.size(), nullptr);
+}
+
+struct run_result {
+  int exit_status{-1};
+  double wall_secs{0}, user_secs{0}, sys_secs{0};
+  long max_rss_kib{0};
+  std::string stats_json{};
+};
+
+static run_result run_once(const std::string &exe, const bench_mode &mode, const corpus_params &params,
+                           size_t const file_count)
+{
+  const std::string stats_path = params.dir + "/stats.json";
+  unlink(stats_path.c_str());
+  std::vector<std::string> args{exe};
+  args.insert(args.end(), mode.args.begin(), mode.args.end());
+  args.insert(args.end(), {"-log-level", "warn", "-stats-json", stats_path});
+  for(size_t i = 0; i < file_count; i++) args.push_back(file_path(params, i));
+  std::vector<char*> argv{};
+  for(auto &arg : args) argv.push_back(arg.data());
+  argv.push_back(nullptr);
+
+  run_result res{};
+  auto const start = metrics::now_ns();
+  auto const pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "ERROR: fork(): %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    execv(argv[0], argv.data());
+    fprintf(stderr, "ERROR: execv(\"%s\"): %s\n", argv[0], strerror(errno));
+    _exit(127);
+  }
+  int status = 0;
+  struct rusage ru{};
+  while (wait4(pid, &status, 0, &ru) == -1 && errno == EINTR) {}
+  res.wall_secs = static_cast<double>(metrics::now_ns() - start) / 1e9;
+  res.exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  res.user_secs = static_cast<double>(ru.ru_utime.tv_sec) + static_cast<double>(ru.ru_utime.tv_usec) / 1e6;
+  res.sys_secs = static_cast<double>(ru.ru_stime.tv_sec) + static_cast<double>(ru.ru_stime.tv_usec) / 1e6;
+  res.max_rss_kib = ru.ru_maxrss;
+  std::ifstream in{stats_path};
+  std::stringstream ss;
+  ss << in.rdbuf();
+  res.stats_json = ss.str();
+  return res;
+}
+
+static bool parse_mode(std::string_view text, bench_mode &mode) {
+  auto const eq = text.find('=');
+  if (eq == std::string_view::npos || eq == 0) return false;
+  mode.name = text.substr(0, eq);
+  std::istringstream is{std::string{text.substr(eq + 1)}};
+  std::string arg;
+  while (is >> arg) mode.args.push_back(arg);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  corpus_params params{};
+  std::string exe{"./rd-multi-strm"};
+  std::vector<size_t> file_counts{};
+  std::vector<bench_mode> modes{};
+  std::string report_path{};
+
+  for(int i = 1; i < argc; i++) {
+    std::string_view arg{argv[i]};
+    if (i + 1 >= argc) {
+      fprintf(stderr, "ERROR: option '%s' expects a value (see the usage in bench-e2e.cpp)\n", arg.data());
+      return EXIT_FAILURE;
+    }
+    std::string_view val{argv[++i]};
+    bool ok = true;
+    if (arg == "-exe") {
+      exe = val;
+    } else if (arg == "-dir") {
+      params.dir = val;
+    } else if (arg == "-seed") {
+      params.seed = strtoul(val.data(), nullptr, 10);
+    } else if (arg == "-files") {
+      std::istringstream is{std::string{val}};
+      std::string count;
+      while (std::getline(is, count, ',')) {
+        auto const n = strtoul(count.c_str(), nullptr, 10);
+        if (n > 0) file_counts.push_back(n);
+      }
+      ok = !file_counts.empty();
+    } else if (arg == "-size-dist") {
+      ok = distribution::parse(val, params.size_kib);
+    } else if (arg == "-line-dist") {
+      ok = distribution::parse(val, params.line_len);
+    } else if (arg == "-compressibility") {
+      params.compressibility = strtod(val.data(), nullptr);
+    } else if (arg == "-stderr-noise") {
+      params.stderr_noise = strtod(val.data(), nullptr);
+    } else if (arg == "-mode") {
+      modes.emplace_back();
+      ok = parse_mode(val, modes.back());
+    } else if (arg == "-report") {
+      report_path = val;
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      fprintf(stderr, "ERROR: invalid option '%s %s' (see the usage in bench-e2e.cpp)\n", arg.data(), val.data());
+      return EXIT_FAILURE;
+    }
+  }
+  if (file_counts.empty()) file_counts = {1, 10, 100};
+  if (modes.empty()) {
+    modes = {{"bufsize-64", {"-bufsize", "64"}}, {"bufsize-4k", {"-bufsize", "4096"}},
+             {"bufsize-64k", {"-bufsize", "65535"}}};
+  }
+
+  // raise the soft limit on open files for the sake of large file counts (inherited by rd-multi-strm)
+  struct rlimit rl{};
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  prepare_corpus(params, *std::max_element(file_counts.begin(), file_counts.end()));
+
+  FILE *const out = report_path.empty() ? stdout : fopen(report_path.c_str(), "w");
+  if (out == nullptr) {
+    fprintf(stderr, "ERROR: fopen(\"%s\"): %s\n", report_path.c_str(), strerror(errno));
+    return EXIT_FAILURE;
+  }
+  auto manifest = params.manifest(*std::max_element(file_counts.begin(), file_counts.end()));
+  manifest.pop_back();
+  fprintf(out, "{\n  \"corpus\": \"%s\",\n  \"runs\": [", manifest.c_str());
+  const char *sep = "\n";
+  for(auto const file_count : file_counts) {
+    auto const input_bytes = corpus_bytes(params, file_count);
+    for(auto const &mode : modes) {
+      auto const res = run_once(exe, mode, params, file_count);
+      remove_outputs(params, file_count);
+      auto const read_calls = json_number(res.stats_json, "read_calls");
+      auto const poll_calls = json_number(res.stats_json, "poll_calls");
+      auto const lines = json_number(res.stats_json, "lines");
+      // throughput is only meaningful for a run that processed all of its input
+      auto const mib_per_sec = res.exit_status == 0 ? static_cast<double>(input_bytes) / (1024.0 * 1024.0) / res.wall_secs
+                                                    : 0.0;
+      fprintf(stderr, "INFO: %-12s %6zu files: %8.3f s wall, %8.3f s cpu, %7ld KiB rss, %8.2f MiB/s, exit %d\n",
+              mode.name.c_str(), file_count, res.wall_secs, res.user_secs + res.sys_secs, res.max_rss_kib,
+              mib_per_sec, res.exit_status);
+      std::string args{};
+      for(auto const &a : mode.args) args += (args.empty() ? "" : " ") + a;
+      fprintf(out, "%s    {\"mode\": \"%s\", \"args\": \"%s\", \"files\": %zu, \"input_bytes\": %zu, "
+                   "\"exit_status\": %d, \"wall_secs\": %.3f, \"user_secs\": %.3f, \"sys_secs\": %.3f, "
+                   "\"max_rss_kib\": %ld, \"read_calls\": %.0f, \"poll_calls\": %.0f, \"lines\": %.0f, "
+                   "\"mib_per_sec\": %.3f, \"lines_per_sec\": %.0f}",
+              sep, mode.name.c_str(), args.c_str(), file_count, input_bytes, res.exit_status, res.wall_secs,
+              res.user_secs, res.sys_secs, res.max_rss_kib, read_calls, poll_calls, lines, mib_per_sec,
+              res.exit_status == 0 && lines > 0 ? lines / res.wall_secs : 0.0);
+      fflush(out);
+      sep = ",\n";
+    }
+  }
+  fputs("\n  ]\n}\n", out);
+  if (out != stdout) fclose(out);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,252 @@
+/* bench-line-framing.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*
+ * Microbenchmarks of the line framing hot path of read_buf_ctx:
+ *
+ *   find_next_eol   - framing of input already in memory (no system calls)
+ *   read_line_core  - read() from a memfd plus framing
+ *   read_line       - a non-blocking pipe fed by a writer thread, as in the program proper
+ *
+ * Each is run over synthetic corpora of differing line length distributions
+ * and CRLF mixes, for several read buffer sizes, and is reported in GB/s and
+ * millions of lines/s (best of several runs).
+ *
+ * usage: bench [-size <MiB>] [-runs <n>] [-filter <substring>]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include "logging.h"
+#include "metrics.h"
+#include "read-buf-ctx.h"
+
+// befriended by read_buf_ctx so as to drive its private framing methods directly
+struct read_buf_ctx_bench {
+  static size_t frame_in_memory(read_buf_ctx &rbc, std::string_view corpus, std::string &line) {
+    size_t lines = 0, offset = 0;
+    while (offset < corpus.size()) {
+      // mimics read_line_core(), with a memcpy() standing in for the read() call
+      char *const rd_buf_base = rbc.read_buffer + rbc.pos;
+      auto const n = std::min<size_t>(rbc.read_buf_limit - rbc.pos, corpus.size() - offset);
+      memcpy(rd_buf_base, corpus.data() + offset, n);
+      offset += n;
+      char *const end = rd_buf_base + n;
+      *end = '\0';
+      if (rbc.find_next_eol(rbc.read_buffer, end, line)) {
+        lines++;
+        line.clear();
+        while (rbc.consume_buffered_lines(line)) {
+          lines++;
+          line.clear();
+        }
+      }
+    }
+    return lines;
+  }
+
+  static size_t read_line_core_until_eof(read_buf_ctx &rbc, std::string &line) {
+    size_t lines = 0;
+    for(;;) {
+      int rc = EXIT_SUCCESS;
+      if (rbc.eof_flag) {
+        rc = rbc.handle_eof_slop(line);
+      } else {
+        rbc.read_line_core(line, rc);
+      }
+      if (rc == EXIT_SUCCESS) {
+        lines++;
+        line.clear();
+      } else if (rc == EOF) {
+        if (!line.empty()) lines++;
+        return lines;
+      } else if (rc != EAGAIN) {
+        return lines;
+      }
+    }
+  }
+};
+
+struct corpus_spec {
+  const char *name;
+  // returns the length of the next line (not counting its line ending)
+  size_t (*next_len)(std::mt19937_64 &rng);
+};
+
+static const corpus_spec corpus_specs[] = {
+  {"short-16",  [](std::mt19937_64 &) -> size_t { return 16; }},
+  {"medium-80", [](std::mt19937_64 &) -> size_t { return 80; }},
+  {"long-1k",   [](std::mt19937_64 &) -> size_t { return 1024; }},
+  {"mixed-1-400", [](std::mt19937_64 &rng) -> size_t { return 1 + rng() % 400; }},
+  {"log-tail",  [](std::mt19937_64 &rng) -> size_t { // mostly log-line sized with an occasional stack trace sized line
+    return rng() % 100 == 0 ? 2048 + rng() % 8192 : 40 + rng() % 120;
+  }},
+};
+
+static std::string make_corpus(const corpus_spec &spec, double const crlf_fraction, size_t const size) {
+  std::mt19937_64 rng{42};
+  std::uniform_real_distribution<double> coin{0.0, 1.0};
+  std::string corpus{};
+  corpus.reserve(size + 16 * 1024);
+  while (corpus.size() < size) {
+    auto const len = spec.next_len(rng);
+    for(size_t i = 0; i < len; i++) {
+      corpus.push_back(static_cast<char>(' ' + 1 + rng() % 94)); // printable, non-space ASCII
+    }
+    if (coin(rng) < crlf_fraction) corpus.push_back('\r');
+    corpus.push_back('\n');
+  }
+  return corpus;
+}
+
+struct result_t {
+  double secs;
+  size_t lines;
+};
+
+static result_t bench_find_next_eol(std::string_view corpus, u_int const buf_size) {
+  read_buf_ctx rbc{-1, buf_size};
+  std::string line{};
+  auto const start = metrics::now_ns();
+  auto const lines = read_buf_ctx_bench::frame_in_memory(rbc, corpus, line);
+  return {static_cast<double>(metrics::now_ns() - start) / 1e9, lines + (line.empty() ? 0 : 1)};
+}
+
+static result_t bench_read_line_core(int const memfd, u_int const buf_size) {
+  lseek(memfd, 0, SEEK_SET);
+  read_buf_ctx rbc{memfd, buf_size};
+  std::string line{};
+  auto const start = metrics::now_ns();
+  auto const lines = read_buf_ctx_bench::read_line_core_until_eof(rbc, line);
+  return {static_cast<double>(metrics::now_ns() - start) / 1e9, lines};
+}
+
+static result_t bench_read_line(std::string_view corpus, u_int const buf_size) {
+  int pipes[2]{-1, -1};
+  if (pipe(pipes) == -1) {
+    LOG_ERROR("%d: %s() -> pipe(): %s\n", __LINE__, __FUNCTION__, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  std::thread writer{[corpus, wr_fd = pipes[1]] {
+    size_t offset = 0;
+    while (offset < corpus.size()) {
+      auto const n = write(wr_fd, corpus.data() + offset, corpus.size() - offset);
+      if (n == -1) {
+        if (errno == EINTR) continue;
+        break;
+      }
+      offset += static_cast<size_t>(n);
+    }
+    close(wr_fd);
+  }};
+
+  std::string line{};
+  size_t lines = 0;
+  auto const start = metrics::now_ns();
+  {
+    read_buf_ctx rbc{pipes[0], buf_size};
+    for(;;) {
+      auto const rc = rbc.read_line(line);
+      if (rc == EXIT_SUCCESS) {
+        lines++;
+        line.clear();
+      } else if (rc == EAGAIN) {
+        struct pollfd pfd{pipes[0], POLLIN, 0};
+        poll(&pfd, 1, -1); // wait on the writer, as the program proper would in poll()
+      } else {
+        if (rc == EOF && !line.empty()) lines++;
+        break;
+      }
+    }
+  }
+  auto const secs = static_cast<double>(metrics::now_ns() - start) / 1e9;
+  writer.join();
+  close(pipes[0]);
+  return {secs, lines};
+}
+
+int main(int argc, char **argv) {
+  size_t corpus_mib = 16;
+  int runs = 3;
+  std::string_view filter{};
+  for(int i = 1; i < argc; i++) {
+    std::string_view arg{argv[i]};
+    if (i + 1 < argc && arg == "-size") {
+      corpus_mib = std::max(1UL, strtoul(argv[++i], nullptr, 10));
+    } else if (i + 1 < argc && arg == "-runs") {
+      runs = std::max(1, atoi(argv[++i]));
+    } else if (i + 1 < argc && arg == "-filter") {
+      filter = argv[++i];
+    } else {
+      fprintf(stderr, "usage: %s [-size <MiB>] [-runs <n>] [-filter <substring>]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  static const u_int buf_sizes[] = { 64, 4096, UINT16_MAX };
+  static const double crlf_fractions[] = { 0.0, 0.5 };
+  static const char * const bench_names[] = { "find_next_eol", "read_line_core", "read_line" };
+
+  printf("%-15s %-12s %5s %7s %10s %12s\n", "benchmark", "corpus", "crlf", "bufsize", "GB/s", "Mlines/s");
+  for(auto const &spec : corpus_specs) {
+    for(auto const crlf : crlf_fractions) {
+      auto const corpus = make_corpus(spec, crlf, corpus_mib * 1024 * 1024);
+
+      auto const memfd = memfd_create("bench-corpus", 0);
+      if (memfd == -1 || write(memfd, corpus.data(), corpus.size()) != static_cast<ssize_t>(corpus.size())) {
+        LOG_ERROR("%d: %s() -> memfd: %s\n", __LINE__, __FUNCTION__, strerror(errno));
+        return EXIT_FAILURE;
+      }
+
+      for(int b = 0; b < 3; b++) {
+        auto const bench_name = bench_names[b];
+        for(auto const buf_size : buf_sizes) {
+          const std::string label = std::string{bench_name} + " " + spec.name;
+          if (!filter.empty() && label.find(filter) == std::string::npos) continue;
+          result_t best{1e300, 0};
+          for(int r = 0; r < runs; r++) {
+            auto const res = b == 0 ? bench_find_next_eol(corpus, buf_size)
+                                    : b == 1 ? bench_read_line_core(memfd, buf_size)
+                                             : bench_read_line(corpus, buf_size);
+            if (res.secs < best.secs) best = res;
+          }
+          printf("%-15s %-12s %5.2f %7u %10.3f %12.3f\n", bench_name, spec.name, crlf, buf_size,
+                 static_cast<double>(corpus.size()) / best.secs / 1e9,
+                 static_cast<double>(best.lines) / best.secs / 1e6);
+          fflush(stdout);
+        }
+      }
+      close(memfd);
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -21,33 +21,90 @@ limitations under the License.
 #include <mutex>
 #include <atomic>
 #include <unordered_map>
+#include <unordered_set>
 #include <wait.h>
 #include <cstring>
 #include <unistd.h>
 #include <future>
+#include <vector>
+#include <csignal>
 #include "signal-handling.h"
+#include "logging.h"
+#include "tracing.h"
 #include "child-process-tracking.h"
 
 using signal_handling::quit_flag;
 
 static std::timed_mutex qm;
 static std::atomic_int child_process_count = {0};
-static std::unordered_map<pid_t, std::tuple<int, int>> child_processes;
+static std::unordered_set<pid_t> child_processes;
+static std::unordered_map<int, pid_t> child_process_by_rd_fd;
+static std::unordered_set<pid_t> untracked_exits; // children reaped before the parent got to register them
 
 static void track_child_process_completion();
 
-void start_tracking_child_process(int const child_pid, int const stdout_wr_fd, int const stderr_wr_fd) {
+void start_tracking_child_process(int const child_pid, int const stdout_rd_fd) {
   int curr_child_process_count = 0;
+  bool already_exited;
   {
     std::lock_guard<std::timed_mutex> lk(qm);
     curr_child_process_count = child_process_count.fetch_add(1);
-    child_processes.emplace(std::make_pair(child_pid, std::make_tuple(stdout_wr_fd, stderr_wr_fd)));
+    // a short-lived child can be reaped by the waitid thread before the parent registers it here
+    already_exited = untracked_exits.erase(child_pid) > 0;
+    if (!already_exited) {
+      child_processes.insert(child_pid);
+      child_process_by_rd_fd[stdout_rd_fd] = child_pid;
+    }
+  }
+  if (already_exited) {
+    LOG_DEBUG("child process pid(%d) exited before being tracked -> stdout rd fd: %d\n", child_pid, stdout_rd_fd);
+    return;
   }
   if (curr_child_process_count <= 0) {
     track_child_process_completion();
   }
 }
 
+/**
+ * Sends SIGTERM to the child process whose stdout is read via the specified
+ * pipe file descriptor - used to stop decompressing an input early once its
+ * output is no longer wanted. The child is reaped and its write pipe ends
+ * are closed in the usual manner by the child process completion routine.
+ *
+ * @param stdout_rd_fd read end of the pipe redirected from the child's stdout
+ * @return true if a child process was signaled
+ */
+bool terminate_child_process(int const stdout_rd_fd) {
+  pid_t child_pid;
+  {
+    std::lock_guard<std::timed_mutex> lk(qm);
+    auto const search = child_process_by_rd_fd.find(stdout_rd_fd);
+    if (search == child_process_by_rd_fd.end()) return false;
+    child_pid = search->second;
+    child_process_by_rd_fd.erase(search);
+  }
+  if (kill(child_pid, SIGTERM) == -1) {
+    LOG_WARN("%d: %s() -> kill(pid: %d): %s\n", __LINE__, __FUNCTION__, child_pid, strerror(errno));
+    return false;
+  }
+  LOG_DEBUG("terminating child process pid(%d) early -> stdout rd fd: %d\n", child_pid, stdout_rd_fd);
+  return true;
+}
+
+void terminate_all_child_processes() {
+  std::vector<int> rd_fds{};
+  {
+    std::lock_guard<std::timed_mutex> lk(qm);
+    rd_fds.reserve(child_process_by_rd_fd.size());
+    for(auto const &kv : child_process_by_rd_fd) {
+      rd_fds.push_back(kv.first);
+    }
+  }
+  for(auto const fd : rd_fds) {
+    terminate_child_process(fd);
+  }
+}
+
 static void track_child_process_completion() {
   using child_process_completion_proc_t = std::function<bool(int)>;
 
@@ -57,6 +114,9 @@ static void track_child_process_completion() {
     do {
       if (waitid(P_ALL, 0, &info, WEXITED|WSTOPPED) == 0) {
         child_process_count--;
+        tracing::async_end("child process", "child", static_cast<uint64_t>(info.si_pid),
+                           {{"status", info.si_status}, {"code", info.si_code}});
+        tracing::instant("child exit", "child", {{"pid", info.si_pid}, {"status", info.si_status}});
         done = child_process_completion_proc(info.si_pid);
       } else {
         const auto rc = errno;
@@ -65,14 +125,14 @@ static void track_child_process_completion() {
             break;
           case ECHILD:
             if (quit_flag != 0 || done) return; // flag when non-zero indicates was signaled to terminate
-            fprintf(stderr, "TRACE: waitid(): %s\n", strerror(rc));
+            LOG_TRACE("waitid(): %s\n", strerror(rc));
             done = true;
             break;
           case EINTR: // waidid() was interrupted by a signal so
-            fprintf(stderr, "INFO: waitid(): %s\n", strerror(rc));
+            LOG_INFO("waitid(): %s\n", strerror(rc));
             return;   // exit the lambda and the thread context it's executing in
           default:
-            fprintf(stderr, "ERROR: waitid() returned on error: %s\n", strerror(rc));
+            LOG_ERROR("waitid() returned on error: %s\n", strerror(rc));
         }
       }
     } while (!done);
@@ -80,26 +140,33 @@ static void track_child_process_completion() {
 
   // lambda is a completion routine invoked when a forked child process terminates
   static auto const child_process_completion = [](int const child_pid) -> bool {
-    int stdout_wr_fd = -1, stderr_wr_fd = -1;
-
     std::unique_lock<std::timed_mutex> lk(qm, std::defer_lock);
     std::chrono::milliseconds wait_time{250};
-    bool done;
+    bool done, tracked = false;
     do {
       if ((done = lk.try_lock_for(wait_time))) {
-        auto const fd_pair = child_processes[child_pid];
-        stdout_wr_fd = std::get<0>(fd_pair);
-        stderr_wr_fd = std::get<1>(fd_pair);
-        child_processes.erase(child_pid);
+        auto const search = child_processes.find(child_pid);
+        if (search == child_processes.end()) {
+          // not registered yet - it is dropped when it is
+          untracked_exits.insert(child_pid);
+          lk.unlock();
+          break;
+        }
+        tracked = true;
+        child_processes.erase(search);
+        for(auto it = child_process_by_rd_fd.begin(); it != child_process_by_rd_fd.end(); it++) {
+          if (it->second == child_pid) {
+            child_process_by_rd_fd.erase(it);
+            break;
+          }
+        }
         lk.unlock();
       }
     } while(!done);
 
-    close(stdout_wr_fd);
-    close(stderr_wr_fd);
-
-    fprintf(stderr, "DEBUG: terminating child process pid(%d) -> stdout wr fd close(%d); stderr wr fd close(%d)\n",
-            child_pid, stdout_wr_fd, stderr_wr_fd);
+    if (tracked) {
+      LOG_DEBUG("child process pid(%d) terminated\n", child_pid);
+    }
 
     return quit_flag != 0;
   };
@@ -110,6 +177,7 @@ static void track_child_process_completion() {
   std::thread waitid_on_forked_children_thrd{
       std::function<void()>([sf] {
         sf.wait(); // Waits for calling thread to send notification to proceed
+        tracing::set_thread_name("waitid on children");
         waitid_on_forked_children(child_process_completion);
       })};
 
@@ -20,6 +20,8 @@ limitations under the License.
 #ifndef CHILD_PROCESS_TRACKING_H
 #define CHILD_PROCESS_TRACKING_H
 
-void start_tracking_child_process(int child_pid, int stdout_wr_fd, int stderr_wr_fd);
+void start_tracking_child_process(int child_pid, int stdout_rd_fd);
+bool terminate_child_process(int stdout_rd_fd);
+void terminate_all_child_processes();
 
 #endif //CHILD_PROCESS_TRACKING_H
@@ -0,0 +1,183 @@
+/* cpu-affinity.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <algorithm>
+#include "cpu-affinity.h"
+#include "logging.h"
+
+namespace cpu_affinity {
+
+  bool parse_list(std::string_view list, std::vector<int> &ids) {
+    ids.clear();
+    while (!list.empty()) {
+      auto const comma = list.find(',');
+      std::string const item{list.substr(0, comma)};
+      list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+      if (item.empty()) continue;
+      char *end = nullptr;
+      auto const first = strtol(item.c_str(), &end, 10);
+      auto last = first;
+      if (*end == '-') {
+        const char *const second = end + 1;
+        last = strtol(second, &end, 10);
+        if (end == second) return false;
+      }
+      if (end == item.c_str() || *end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) return false;
+      for(auto id = first; id <= last; id++) {
+        ids.push_back(static_cast<int>(id));
+      }
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return !ids.empty();
+  }
+
+  std::vector<int> allowed_cpus() {
+    std::vector<int> cpus{};
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+      LOG_WARN("%d: %s() -> sched_getaffinity(): %s\n", __LINE__, __FUNCTION__, strerror(errno));
+      return cpus;
+    }
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        cpus.push_back(cpu);
+      }
+    }
+    return cpus;
+  }
+
+  // reads a sysfs list file (e.g. "0-3,8-11"); false if it is missing, or empty (as for a node without CPUs)
+  static bool read_list(const std::string &path, std::vector<int> &ids) {
+    ids.clear();
+    auto const fp = fopen(path.c_str(), "r");
+    if (fp == nullptr) return false;
+    char buf[4096];
+    auto const len = fgets(buf, sizeof(buf), fp) != nullptr ? strcspn(buf, "\n") : 0;
+    fclose(fp);
+    if (!parse_list(std::string_view{buf, len}, ids)) {
+      ids.clear();
+      return false;
+    }
+    return true;
+  }
+
+  std::vector<int> cpus_of_node(int const node) {
+    std::vector<int> cpus{};
+    if (!read_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", cpus) && node == 0 &&
+        access("/sys/devices/system/node/node0", F_OK) == -1) {
+      return allowed_cpus(); // no NUMA topology - a single node
+    }
+    return cpus;
+  }
+
+  int node_of_cpu(int const cpu) {
+    // the node numbers may be sparse, and a node may have no CPUs (memory only) - so the online nodes are all looked at
+    std::vector<int> nodes{};
+    if (!read_list("/sys/devices/system/node/online", nodes)) return 0;
+    for(auto const node : nodes) {
+      auto const cpus = cpus_of_node(node);
+      if (std::binary_search(cpus.begin(), cpus.end(), cpu)) return node;
+    }
+    return 0;
+  }
+
+  bool set_thread_cpus(const std::vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(auto const cpu : cpus) {
+      CPU_SET(cpu, &set);
+    }
+    auto const rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+      LOG_WARN("%d: %s() -> pthread_setaffinity_np(): %s\n", __LINE__, __FUNCTION__, strerror(rc));
+      return false;
+    }
+    return true;
+  }
+
+  std::vector<placement> plan(unsigned const count, const std::vector<int> &cpus, const std::vector<int> &nodes) {
+    std::vector<int> order{};
+    if (!cpus.empty()) {
+      order = cpus;
+    } else if (!nodes.empty()) {
+      // interleave the nodes' CPUs, so that the placements are spread evenly across the nodes
+      std::vector<std::vector<int>> per_node{};
+      for(auto const node : nodes) {
+        per_node.push_back(cpus_of_node(node));
+        if (per_node.back().empty()) {
+          LOG_WARN("NUMA node %d has no CPUs - not used\n", node);
+        }
+      }
+      for(size_t i = 0; ; i++) {
+        bool is_any = false;
+        for(const auto &node_cpus : per_node) {
+          if (i < node_cpus.size()) {
+            order.push_back(node_cpus[i]);
+            is_any = true;
+          }
+        }
+        if (!is_any) break;
+      }
+    }
+    if (order.empty()) {
+      order = allowed_cpus();
+    }
+
+    std::vector<placement> placements{};
+    if (order.empty()) return placements;
+    auto const allowed = allowed_cpus();
+    for(unsigned i = 0; i < count; i++) {
+      placement p{};
+      p.cpu = order[i % order.size()];
+      p.node = node_of_cpu(p.cpu);
+      for(auto const cpu : cpus_of_node(p.node)) {
+        if (std::binary_search(allowed.begin(), allowed.end(), cpu)) {
+          p.node_cpus.push_back(cpu);
+        }
+      }
+      if (p.node_cpus.empty()) {
+        p.node_cpus.push_back(p.cpu);
+      }
+      placements.push_back(std::move(p));
+    }
+    return placements;
+  }
+
+  scoped_thread_cpus::scoped_thread_cpus(const std::vector<int> &cpus) {
+    CPU_ZERO(&saved);
+    if (cpus.empty()) return;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved) != 0) return;
+    is_set = set_thread_cpus(cpus);
+  }
+
+  scoped_thread_cpus::~scoped_thread_cpus() {
+    if (is_set) {
+      pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+    }
+  }
+
+}
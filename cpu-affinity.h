@@ -0,0 +1,75 @@
+/* cpu-affinity.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef CPU_AFFINITY_H
+#define CPU_AFFINITY_H
+
+#include <sched.h>
+#include <string_view>
+#include <vector>
+
+/*
+ * CPU and NUMA node placement of threads and child processes. The NUMA
+ * topology is read from sysfs (/sys/devices/system/node), so there is no
+ * dependency on libnuma; on a machine without it every CPU is on node 0.
+ *
+ * Affinity set on a thread is inherited by the child processes it forks and,
+ * as Linux places a page on the node of the CPU that first touches it, the
+ * memory a pinned thread allocates and first writes is node-local.
+ */
+namespace cpu_affinity {
+  // parses a list of the form "0-3,8,10-11" (as in sysfs cpulist files)
+  bool parse_list(std::string_view list, std::vector<int> &ids);
+
+  std::vector<int> allowed_cpus();            // of the calling thread, ascending
+  std::vector<int> cpus_of_node(int node);    // ascending; empty for an unknown node
+  int node_of_cpu(int cpu);                   // 0 when there is no NUMA topology
+
+  bool set_thread_cpus(const std::vector<int> &cpus);
+
+  /*
+   * Where a thread (e.g. an event loop shard) runs: pinned to a single CPU,
+   * while the child processes feeding it may run on any CPU of that CPU's node.
+   */
+  struct placement {
+    int cpu{-1};
+    int node{0};
+    std::vector<int> node_cpus{};
+  };
+
+  /*
+   * Lays out count placements over the given CPUs, or over the CPUs of the
+   * given nodes (taking them in turn, so consecutive placements alternate
+   * nodes), or else over the allowed CPUs. CPUs are reused once all are taken.
+   */
+  std::vector<placement> plan(unsigned count, const std::vector<int> &cpus, const std::vector<int> &nodes);
+
+  // the affinity of the calling thread is changed for the lifetime of this object
+  class scoped_thread_cpus final {
+    cpu_set_t saved;
+    bool is_set{false};
+  public:
+    explicit scoped_thread_cpus(const std::vector<int> &cpus);
+    scoped_thread_cpus(const scoped_thread_cpus &) = delete;
+    scoped_thread_cpus& operator=(const scoped_thread_cpus &) = delete;
+    ~scoped_thread_cpus();
+  };
+}
+
+#endif //CPU_AFFINITY_H
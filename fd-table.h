@@ -0,0 +1,121 @@
+/* fd-table.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef FD_TABLE_H
+#define FD_TABLE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/*
+ * A flat table of per file descriptor state. The entries are kept densely in
+ * a vector (so iterating them, e.g. to build a poll set, is a linear walk of
+ * contiguous memory), and are found from a file descriptor via a vector
+ * indexed by the file descriptor number - which stays compact, as the kernel
+ * hands out the lowest free numbers. Erasing moves the last entry into the
+ * erased one's place, so entries do not keep their addresses across an erase;
+ * state that must (e.g. as referred to from elsewhere) is held by pointer.
+ *
+ * Each file descriptor's generation is bumped whenever its entry is erased,
+ * so a reference taken as (fd, generation) can tell that the entry has since
+ * gone - even should the file descriptor number have been reused meanwhile.
+ */
+template<typename T>
+class fd_table final {
+  struct fd_ref {
+    int32_t index{-1};        // into entries; -1 when the fd has no entry
+    uint32_t generation{0};
+  };
+  std::vector<fd_ref> refs{};   // indexed by fd
+  std::vector<T> entries{};
+  std::vector<int> entry_fds{}; // parallel to entries
+public:
+  T* find(int const fd) {
+    if (fd < 0 || static_cast<size_t>(fd) >= refs.size() || refs[fd].index < 0) return nullptr;
+    return &entries[static_cast<size_t>(refs[fd].index)];
+  }
+  const T* find(int const fd) const { return const_cast<fd_table*>(this)->find(fd); }
+
+  // adds (or replaces) the entry of the file descriptor
+  T& insert(int const fd, T value) {
+    if (static_cast<size_t>(fd) >= refs.size()) {
+      refs.resize(static_cast<size_t>(fd) + 1);
+    }
+    auto &ref = refs[fd];
+    if (ref.index >= 0) {
+      return entries[static_cast<size_t>(ref.index)] = std::move(value);
+    }
+    ref.index = static_cast<int32_t>(entries.size());
+    entry_fds.push_back(fd);
+    return entries.emplace_back(std::move(value));
+  }
+
+  bool erase(int const fd) {
+    if (find(fd) == nullptr) return false;
+    auto &ref = refs[fd];
+    auto const index = static_cast<size_t>(ref.index);
+    auto const last = entries.size() - 1;
+    if (index != last) {
+      entries[index] = std::move(entries[last]);
+      entry_fds[index] = entry_fds[last];
+      refs[entry_fds[index]].index = static_cast<int32_t>(index);
+    }
+    entries.pop_back();
+    entry_fds.pop_back();
+    ref.index = -1;
+    ref.generation++;
+    return true;
+  }
+
+  uint32_t generation(int const fd) const {
+    return fd >= 0 && static_cast<size_t>(fd) < refs.size() ? refs[fd].generation : 0;
+  }
+  // the entry that the reference was taken of is still there
+  bool is_current(int const fd, uint32_t const generation) const {
+    return find(fd) != nullptr && refs[fd].generation == generation;
+  }
+
+  size_t size() const { return entries.size(); }
+  bool empty() const { return entries.empty(); }
+  // dense access - the ith entry (in no particular order) and its file descriptor
+  int fd_at(size_t const i) const { return entry_fds[i]; }
+  T& at(size_t const i) { return entries[i]; }
+
+  // iterates the entries as (fd, entry) pairs - not to be erased from while iterated
+  template<typename Table, typename V>
+  class basic_iterator {
+    Table *table;
+    size_t i;
+  public:
+    basic_iterator(Table *table, size_t i) : table{table}, i{i} {}
+    std::pair<int, V&> operator*() const { return {table->entry_fds[i], table->entries[i]}; }
+    basic_iterator& operator++() { i++; return *this; }
+    bool operator!=(const basic_iterator &other) const { return i != other.i; }
+  };
+  using iterator = basic_iterator<fd_table, T>;
+  using const_iterator = basic_iterator<const fd_table, const T>;
+  iterator begin() { return {this, 0}; }
+  iterator end() { return {this, entries.size()}; }
+  const_iterator begin() const { return {this, 0}; }
+  const_iterator end() const { return {this, entries.size()}; }
+};
+
+#endif //FD_TABLE_H
@@ -0,0 +1,77 @@
+/* flow-control.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include "flow-control.h"
+#include "read-multi-strm.h"
+#include "logging.h"
+#include "metrics.h"
+
+void stream_flow::charge(size_t const bytes) {
+  buffered.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+  ctl.in_use.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+}
+
+void stream_flow::discharge(size_t const bytes) {
+  buffered.fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+  ctl.in_use.fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+}
+
+flow_controller::flow_controller(flow_limits const limits) : limits{limits} {
+  LOG_DEBUG("flow control budget: %lu, high watermark: %lu, low watermark: %lu\n",
+            limits.budget, limits.high_watermark, limits.low_watermark);
+}
+
+stream_flow* flow_controller::add_stream(int const fd) {
+  streams.push_back(std::make_unique<stream_flow>(*this, fd));
+  return streams.back().get();
+}
+
+/**
+ * Pauses and resumes streams per their buffered bytes. To be called on the
+ * reactor thread between poll cycles.
+ */
+void flow_controller::apply(read_multi_stream &rms) {
+  if (!is_enabled()) return;
+  auto const total = get_in_use();
+  auto const budget = static_cast<int64_t>(limits.budget);
+  auto const high = static_cast<int64_t>(limits.high_watermark);
+  auto const low = static_cast<int64_t>(limits.low_watermark);
+  bool const is_over_budget = budget > 0 && total >= budget;
+  bool const is_under_budget = budget == 0 || total <= budget - budget / 4;
+  for(auto const &sp_strm : streams) {
+    auto &strm = *sp_strm;
+    if (strm.is_closed) continue;
+    auto const buffered = strm.get_buffered();
+    if (!strm.is_paused) {
+      if (buffered > 0 && ((high > 0 && buffered >= high) || is_over_budget)) {
+        if (!rms.pause(strm.fd)) {
+          strm.is_closed = true; // no longer polled anyway - its remaining bytes just drain
+          continue;
+        }
+        strm.is_paused = true;
+        metrics::local().flow_pauses.add(1);
+        LOG_TRACE("paused fd %d: %ld bytes buffered, %ld in total\n", strm.fd, buffered, total);
+      }
+    } else if (buffered == 0 || ((high == 0 || buffered <= low) && is_under_budget)) {
+      rms.resume(strm.fd);
+      strm.is_paused = false;
+      LOG_TRACE("resumed fd %d: %ld bytes buffered, %ld in total\n", strm.fd, buffered, total);
+    }
+  }
+}
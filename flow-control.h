@@ -0,0 +1,95 @@
+/* flow-control.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef FLOW_CONTROL_H
+#define FLOW_CONTROL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class read_multi_stream;
+class flow_controller;
+
+size_t const default_flow_high_watermark = 4 * 1024 * 1024;
+size_t const default_flow_low_watermark = 1024 * 1024;
+
+/*
+ * Bounds on the bytes of input held in memory (read from a stream but not
+ * yet written out). A value of 0 is unbounded.
+ */
+struct flow_limits {
+  size_t budget{0};                                     // across all streams
+  size_t high_watermark{default_flow_high_watermark};   // per stream - at or above it the stream is paused
+  size_t low_watermark{default_flow_low_watermark};     // per stream - at or below it the stream is resumed
+};
+
+/*
+ * The bytes a stream has buffered. Charged and discharged from any thread;
+ * whether the stream is paused is decided on the reactor thread.
+ */
+class stream_flow final {
+  flow_controller &ctl;
+  const int fd;
+  std::atomic<int64_t> buffered{0};
+  bool is_paused{false};
+  bool is_closed{false};
+  friend class flow_controller;
+public:
+  stream_flow(flow_controller &ctl, int fd) : ctl{ctl}, fd{fd} {}
+  stream_flow(const stream_flow &) = delete;
+  stream_flow& operator=(const stream_flow &) = delete;
+  int get_fd() const { return fd; }
+  int64_t get_buffered() const { return buffered.load(std::memory_order_relaxed); }
+  void charge(size_t bytes);
+  void discharge(size_t bytes);
+};
+
+/*
+ * Applies backpressure: a stream whose buffered bytes reach its high
+ * watermark, or that holds any bytes while the global budget is exhausted,
+ * has its file descriptor paused - left out of the poll set - so that its
+ * pipe fills and the child process writing it blocks. The stream is resumed
+ * once back down to its low watermark and the global total is back under
+ * three quarters of the budget.
+ *
+ * A stream holding nothing is never paused (nor kept paused), so a consumer
+ * that is waiting on input from some stream - e.g. the ordered merge - can
+ * always get it.
+ */
+class flow_controller final {
+  const flow_limits limits;
+  std::atomic<int64_t> in_use{0};
+  std::vector<std::unique_ptr<stream_flow>> streams{};
+  friend class stream_flow;
+public:
+  explicit flow_controller(flow_limits limits);
+  flow_controller(const flow_controller &) = delete;
+  flow_controller& operator=(const flow_controller &) = delete;
+  bool is_enabled() const { return limits.budget > 0 || limits.high_watermark > 0; }
+  const flow_limits& get_limits() const { return limits; }
+  int64_t get_in_use() const { return in_use.load(std::memory_order_relaxed); }
+  stream_flow* add_stream(int fd);
+  void close_stream(stream_flow &strm) { strm.is_closed = true; }
+  void apply(read_multi_stream &rms);
+};
+
+#endif //FLOW_CONTROL_H
@@ -0,0 +1,570 @@
+/* job-server.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <csignal>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include "logging.h"
+#include "metrics.h"
+#include "job-server.h"
+
+namespace job_server {
+
+  static constexpr size_t max_request_size = 1024 * 1024;
+  static constexpr unsigned default_max_jobs = 4;
+  static constexpr size_t max_pending_reply = 1024 * 1024;
+  static constexpr uint64_t stop_drain_ns = 5'000'000'000; // how long a stopping server gives clients to take replies
+
+  struct job {
+    unsigned id{0};
+    int conn{-1};
+    pid_t pid{-1};
+    bool is_client_gone{false};      // sent SIGTERM, its client having closed the connection
+    std::string dir{};               // the directory the job runs in - else the server's
+    std::vector<std::string> args{}; // the job's command line, less the program name
+  };
+
+  // a connection whose request is still being read
+  struct connection {
+    int fd{-1};
+    std::string request{};
+    bool is_eof{false};
+  };
+
+  // a reply that a client has not yet taken all of - the rest is written as the connection becomes writable
+  struct reply {
+    int fd{-1};
+    std::string pending{};
+    bool is_last{false}; // the connection is closed once the reply is written out
+  };
+
+  // the server's state - file scope, so that a forked job process can close what it inherits of it
+  static int listen_fd = -1;
+  static int signal_fd = -1;
+  static std::vector<connection> connections{};
+  static std::deque<job> queued{};
+  static std::vector<job> running{};
+  static std::vector<reply> replies{};
+
+  static std::vector<reply>::iterator find_reply(int const fd) {
+    return std::find_if(replies.begin(), replies.end(), [fd](const reply &r) { return r.fd == fd; });
+  }
+
+  // sends what the socket buffer takes of the text, leaving the rest in it; false if the client is gone
+  static bool send_some(int const fd, std::string &text) {
+    size_t off = 0;
+    while (off < text.size()) {
+      auto const n = send(fd, text.data() + off, text.size() - off, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (n == -1) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        return false;
+      }
+      off += static_cast<size_t>(n);
+    }
+    text.erase(0, off);
+    return true;
+  }
+
+  /**
+   * Writes a reply line without ever blocking the server, though the
+   * connection of a job is in blocking mode (for the job's log): what the
+   * socket buffer does not take is kept, and written out by the poll loop as
+   * the client reads. False if the client is gone, or has let more than
+   * max_pending_reply pile up - its connection is then to be dropped.
+   */
+  static bool write_line(int const fd, const std::string &line) {
+    if (auto const it = find_reply(fd); it != replies.end()) {
+      if (it->pending.size() + line.size() > max_pending_reply) return false;
+      it->pending += line;
+      return true;
+    }
+    std::string rest{line};
+    if (!send_some(fd, rest)) return false;
+    if (!rest.empty()) {
+      replies.push_back({fd, std::move(rest)});
+    }
+    return true;
+  }
+
+  // closes a connection, dropping what is pending of its reply
+  static void close_conn(int const fd) {
+    if (auto const it = find_reply(fd); it != replies.end()) {
+      replies.erase(it);
+    }
+    close(fd);
+  }
+
+  // closes a connection once its reply is written out
+  static void end_conn(int const fd) {
+    if (auto const it = find_reply(fd); it != replies.end()) {
+      it->is_last = true;
+      return;
+    }
+    close(fd);
+  }
+
+  // writes the last line of a reply, closing the connection once it is written out
+  static void write_last_line(int const fd, const std::string &line) {
+    if (write_line(fd, line)) {
+      end_conn(fd);
+    } else {
+      close_conn(fd);
+    }
+  }
+
+  static std::string job_line(const job &j, std::string_view what) {
+    return "job " + std::to_string(j.id) + " " + std::string{what} + "\n";
+  }
+
+  /**
+   * A request is complete at its first empty line, or at end-of-file; its
+   * lines before that are the job's arguments.
+   */
+  static bool is_complete(const connection &c) {
+    return c.is_eof || c.request.starts_with('\n') || c.request.find("\n\n") != std::string::npos ||
+           c.request.find("\n\r\n") != std::string::npos;
+  }
+
+  static std::vector<std::string> split_request(std::string_view text) {
+    std::vector<std::string> args{};
+    while (!text.empty()) {
+      auto const eol = text.find('\n');
+      auto line = text.substr(0, eol);
+      if (line.ends_with('\r')) {
+        line.remove_suffix(1);
+      }
+      if (line.empty()) break; // the end of the request
+      args.emplace_back(line);
+      if (eol == std::string_view::npos) break;
+      text.remove_prefix(eol + 1);
+    }
+    return args;
+  }
+
+  static bool reply_status(int const fd) {
+    for(const auto &j : running) {
+      if (!write_line(fd, job_line(j, "running " + std::to_string(j.pid) + " " + (j.dir.empty() ? "." : j.dir)))) return false;
+    }
+    for(const auto &j : queued) {
+      if (!write_line(fd, job_line(j, "queued " + (j.dir.empty() ? "." : j.dir)))) return false;
+    }
+    return write_line(fd, "end\n");
+  }
+
+  /**
+   * The forked job process: sheds the server's file descriptors, puts its
+   * connection in place of stderr, runs the job as the program proper would
+   * run, and then writes the metrics report to the connection. What the
+   * server has not yet written of its reply ("job <id> queued") is written
+   * first, ahead of the job's own lines.
+   */
+  [[noreturn]] static void run_forked_job(job &j, const sigset_t &job_sigmask, const run_job_t &run_job,
+                                          const char *const program) {
+    sigprocmask(SIG_SETMASK, &job_sigmask, nullptr);
+    close(listen_fd);
+    close(signal_fd);
+    for(const auto &c : connections) {
+      close(c.fd);
+    }
+    for(const auto &other : running) {
+      close(other.conn);
+    }
+    for(const auto &other : queued) {
+      close(other.conn);
+    }
+    std::string backlog{};
+    for(auto &r : replies) {
+      if (r.fd == j.conn) {
+        backlog = std::move(r.pending);
+      } else if (r.is_last) { // (else the connection of a queued job, closed above)
+        close(r.fd);
+      }
+    }
+    auto const devnull = open("/dev/null", O_RDWR);
+    if (devnull != -1) {
+      dup2(devnull, STDIN_FILENO);
+      dup2(devnull, STDOUT_FILENO);
+      close(devnull);
+    }
+    dup2(j.conn, STDERR_FILENO);
+    close(j.conn);
+    if (!backlog.empty()) {
+      fwrite(backlog.data(), 1, backlog.size(), stderr);
+    }
+    dprintf(STDERR_FILENO, "job %u started %d\n", j.id, getpid());
+    if (!j.dir.empty() && chdir(j.dir.c_str()) == -1) {
+      dprintf(STDERR_FILENO, "ERROR: chdir(\"%s\"): %s\njob %u exit %d\n", j.dir.c_str(), strerror(errno), j.id,
+              EXIT_FAILURE);
+      _exit(EXIT_FAILURE);
+    }
+    metrics::restart_clock();
+
+    std::vector<char*> argv{};
+    argv.push_back(const_cast<char*>(program));
+    for(auto &arg : j.args) {
+      argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+    auto const rc = run_job(static_cast<int>(argv.size() - 1), argv.data());
+
+    // the log is drained first, so that the report follows the last of it
+    logging::shutdown();
+    fprintf(stderr, "job %u report\n", j.id);
+    metrics::write_json_report(stderr);
+    fflush(stderr);
+    exit(rc);
+  }
+
+  static void start_job(job j, const sigset_t &job_sigmask, const run_job_t &run_job, const char *const program) {
+    auto const pid = fork();
+    if (pid == -1) {
+      LOG_ERROR("%d: %s() -> fork(): %s\n", __LINE__, __FUNCTION__, strerror(errno));
+      write_last_line(j.conn, job_line(j, "exit " + std::to_string(EXIT_FAILURE)));
+      return;
+    }
+    if (pid == 0) {
+      run_forked_job(j, job_sigmask, run_job, program);
+    }
+    // the job process has taken over what was pending of the reply
+    if (auto const it = find_reply(j.conn); it != replies.end()) {
+      replies.erase(it);
+    }
+    j.pid = pid;
+    LOG_INFO("job %u started: pid %d, %lu arguments\n", j.id, pid, j.args.size());
+    running.push_back(std::move(j));
+  }
+
+  // a job whose client has closed its connection - no one is left to take its output - is dropped if queued,
+  // else sent SIGTERM (and reaped as usual)
+  static void drop_orphaned_job(int const conn) {
+    auto const by_conn = [conn](const job &j) { return j.conn == conn; };
+    if (auto const it = std::find_if(queued.begin(), queued.end(), by_conn); it != queued.end()) {
+      LOG_INFO("job %u: its client is gone - dropped from the queue\n", it->id);
+      close_conn(it->conn);
+      queued.erase(it);
+      return;
+    }
+    auto const it = std::find_if(running.begin(), running.end(), by_conn);
+    if (it == running.end() || it->is_client_gone) return;
+    LOG_INFO("job %u: its client is gone - sending SIGTERM to pid %d\n", it->id, it->pid);
+    kill(it->pid, SIGTERM);
+    it->is_client_gone = true;
+  }
+
+  // reaps the exited jobs, telling each one's client its exit status
+  static void reap_jobs() {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      auto const it = std::find_if(running.begin(), running.end(), [pid](const job &j) { return j.pid == pid; });
+      if (it == running.end()) continue;
+      auto const rc = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+      LOG_INFO("job %u exited: pid %d, status %d\n", it->id, pid, rc);
+      write_last_line(it->conn, job_line(*it, "exit " + std::to_string(rc)));
+      running.erase(it);
+    }
+  }
+
+  static int listen_on(const std::string &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+      LOG_ERROR("socket path is too long (at most %lu characters): \"%s\"\n", sizeof(addr.sun_path) - 1, path.c_str());
+      return -1;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    auto const fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+      LOG_ERROR("%d: %s() -> socket(): %s\n", __LINE__, __FUNCTION__, strerror(errno));
+      return -1;
+    }
+    // a socket left behind by a server that is gone is replaced - one that a server is listening on is not
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+      LOG_ERROR("a server is already listening on \"%s\"\n", path.c_str());
+      close(fd);
+      return -1;
+    }
+    struct stat st{};
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+      unlink(path.c_str());
+    }
+    auto const lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    close(fd);
+    if (lfd == -1 || bind(lfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1 || listen(lfd, SOMAXCONN) == -1) {
+      LOG_ERROR("%d: %s() -> listening on \"%s\": %s\n", __LINE__, __FUNCTION__, path.c_str(), strerror(errno));
+      if (lfd != -1) {
+        close(lfd);
+      }
+      return -1;
+    }
+    return lfd;
+  }
+
+  static bool parse_options(int const argc, char **argv, std::string &socket_path, unsigned &max_jobs) {
+    for(int i = 1; i < argc; i++) {
+      std::string_view const arg{argv[i]};
+      if (arg == "-serve" && i + 1 < argc) {
+        socket_path = argv[++i];
+      } else if (arg == "-max-jobs" && i + 1 < argc) {
+        char *end = nullptr;
+        auto const nbr = strtoul(argv[++i], &end, 10);
+        if (*end != '\0' || nbr == 0 || nbr > 4096) {
+          LOG_ERROR("expected a job count of 1 through 4096 following command option '-max-jobs': '%s'\n", argv[i]);
+          return false;
+        }
+        max_jobs = static_cast<unsigned>(nbr);
+      } else {
+        LOG_ERROR("unknown or incomplete server option '%s' (the options of a job are sent with its request)\n",
+                  arg.data());
+        return false;
+      }
+    }
+    if (socket_path.empty()) {
+      LOG_ERROR("expected a socket path following command option '-serve'\n");
+      return false;
+    }
+    return true;
+  }
+
+  // reads what is available of a request; false once the connection is to be dropped
+  static bool read_request(connection &c) {
+    char buf[4096];
+    for(;;) {
+      auto const n = read(c.fd, buf, sizeof(buf));
+      if (n > 0) {
+        c.request.append(buf, static_cast<size_t>(n));
+        if (c.request.size() > max_request_size) {
+          write_line(c.fd, "ERROR: request too large\n");
+          return false;
+        }
+        continue;
+      }
+      if (n == 0) {
+        c.is_eof = true;
+        return true;
+      }
+      if (errno == EINTR) continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+  }
+
+  int serve(int const argc, char **argv, const run_job_t &run_job) {
+    std::string socket_path{};
+    unsigned max_jobs = default_max_jobs;
+    if (!parse_options(argc, argv, socket_path, max_jobs)) return EXIT_FAILURE;
+
+    // the server's signals are taken via a signalfd; a job process restores the mask it started with
+    sigset_t server_signals, job_sigmask;
+    sigemptyset(&server_signals);
+    sigaddset(&server_signals, SIGINT);
+    sigaddset(&server_signals, SIGTERM);
+    sigaddset(&server_signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &server_signals, &job_sigmask);
+    signal_fd = signalfd(-1, &server_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+      LOG_ERROR("%d: %s() -> signalfd(): %s\n", __LINE__, __FUNCTION__, strerror(errno));
+      return EXIT_FAILURE;
+    }
+    listen_fd = listen_on(socket_path);
+    if (listen_fd == -1) return EXIT_FAILURE;
+    LOG_INFO("serving jobs on \"%s\" - at most %u at once\n", socket_path.c_str(), max_jobs);
+
+    unsigned next_id = 1;
+    bool is_stopping = false;
+    uint64_t stop_deadline_ns = 0;
+    std::vector<pollfd> pfds{};
+    // once stopping, the replies pending are given until the deadline to be written out
+    while (!is_stopping || !running.empty() || (!replies.empty() && metrics::now_ns() < stop_deadline_ns)) {
+      pfds.clear();
+      pfds.push_back({signal_fd, POLLIN, 0});
+      size_t jobs_pfd = pfds.size(); // where the connections of the jobs start in the poll set
+      if (!is_stopping) {
+        pfds.push_back({listen_fd, POLLIN, 0});
+        for(const auto &c : connections) {
+          pfds.push_back({c.fd, POLLIN, 0});
+        }
+        jobs_pfd = pfds.size();
+        // the request has been read (and a client may have shut down its sending side) - only a hang up is polled for
+        for(const auto &j : running) {
+          if (!j.is_client_gone) {
+            pfds.push_back({j.conn, 0, 0});
+          }
+        }
+        for(const auto &j : queued) {
+          pfds.push_back({j.conn, 0, 0});
+        }
+      }
+      auto const replies_pfd = pfds.size();
+      for(const auto &r : replies) {
+        pfds.push_back({r.fd, POLLOUT, 0});
+      }
+      int timeout_ms = -1;
+      if (is_stopping && running.empty()) {
+        auto const now = metrics::now_ns();
+        timeout_ms = now < stop_deadline_ns ? static_cast<int>((stop_deadline_ns - now + 999'999) / 1'000'000) : 0;
+      }
+      if (poll(pfds.data(), pfds.size(), timeout_ms) == -1) {
+        if (errno == EINTR) continue;
+        LOG_ERROR("%d: %s() -> poll(): %s\n", __LINE__, __FUNCTION__, strerror(errno));
+        break;
+      }
+
+      if (pfds[0].revents != 0) {
+        signalfd_siginfo si{};
+        while (read(signal_fd, &si, sizeof(si)) == sizeof(si)) {
+          if (si.ssi_signo == SIGCHLD) {
+            reap_jobs();
+          } else if (!is_stopping) {
+            LOG_INFO("stopping the server: %lu jobs running, %lu queued dropped\n", running.size(), queued.size());
+            is_stopping = true;
+            for(const auto &j : running) {
+              kill(j.pid, SIGTERM);
+            }
+            for(const auto &j : queued) {
+              write_last_line(j.conn, job_line(j, "exit " + std::to_string(128 + SIGTERM)));
+            }
+            queued.clear();
+            for(const auto &c : connections) {
+              close_conn(c.fd);
+            }
+            connections.clear();
+            close(listen_fd);
+            listen_fd = -1;
+            unlink(socket_path.c_str());
+            stop_deadline_ns = metrics::now_ns() + stop_drain_ns;
+          }
+        }
+      }
+
+      // the replies pending are written on as their clients read - one whose client is gone is dropped, and its
+      // connection closed (for a queued job, so is the job)
+      for(size_t i = replies_pfd; i < pfds.size(); i++) {
+        if (pfds[i].revents == 0) continue;
+        auto const it = find_reply(pfds[i].fd);
+        if (it == replies.end()) continue;
+        auto const is_sent = send_some(it->fd, it->pending);
+        if (is_sent && it->pending.empty()) {
+          if (it->is_last) {
+            close(it->fd);
+          }
+          replies.erase(it);
+        } else if (!is_sent || (pfds[i].revents & (POLLHUP | POLLERR)) != 0) {
+          if (it->is_last) {
+            close_conn(it->fd);
+          } else {
+            drop_orphaned_job(it->fd);
+          }
+        }
+      }
+      if (is_stopping) continue;
+
+      // (the jobs reaped just now are gone, and their connections closed - those polled are passed over)
+      for(size_t i = jobs_pfd; i < replies_pfd; i++) {
+        if ((pfds[i].revents & (POLLHUP | POLLERR)) != 0) {
+          drop_orphaned_job(pfds[i].fd);
+        }
+      }
+
+      if (pfds.size() > 1 && pfds[1].revents != 0) {
+        int fd;
+        while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+          connections.push_back({fd});
+        }
+      }
+
+      // the connections polled are those ahead of any accepted just now
+      for(size_t i = 2; i < jobs_pfd; i++) {
+        if (pfds[i].revents == 0) continue;
+        auto const it = std::find_if(connections.begin(), connections.end(),
+                                     [fd = pfds[i].fd](const connection &c) { return c.fd == fd; });
+        if (it == connections.end()) continue;
+        if (!read_request(*it)) {
+          end_conn(it->fd);
+          connections.erase(it);
+          continue;
+        }
+        if (!is_complete(*it)) continue;
+        auto args = split_request(it->request);
+        auto const conn = it->fd;
+        connections.erase(it);
+        if (args.empty()) {
+          close(conn);
+          continue;
+        }
+        if (args.size() == 1 && args[0] == "-status") {
+          if (reply_status(conn)) {
+            end_conn(conn);
+          } else {
+            close_conn(conn);
+          }
+          continue;
+        }
+        // blocking from here on, so that the job's log is written to it in full (see write_line() for the replies)
+        fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) & ~O_NONBLOCK);
+        job j{next_id++, conn};
+        if (args.size() >= 2 && args[0] == "-cwd") {
+          j.dir = args[1];
+          args.erase(args.begin(), args.begin() + 2);
+        }
+        j.args = std::move(args);
+        if (running.size() < max_jobs) {
+          start_job(std::move(j), job_sigmask, run_job, argv[0]);
+        } else if (write_line(j.conn, job_line(j, "queued"))) {
+          queued.push_back(std::move(j));
+        } else {
+          close_conn(j.conn);
+        }
+      }
+
+      // the slots freed by the jobs reaped go to the jobs queued longest
+      while (!queued.empty() && running.size() < max_jobs) {
+        auto j = std::move(queued.front());
+        queued.pop_front();
+        start_job(std::move(j), job_sigmask, run_job, argv[0]);
+      }
+    }
+
+    for(const auto &r : replies) {
+      close(r.fd);
+    }
+    replies.clear();
+    if (listen_fd != -1) {
+      close(listen_fd);
+      unlink(socket_path.c_str());
+    }
+    close(signal_fd);
+    LOG_INFO("server stopped\n");
+    return EXIT_SUCCESS;
+  }
+}
@@ -0,0 +1,73 @@
+/* job-server.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef JOB_SERVER_H
+#define JOB_SERVER_H
+
+#include <functional>
+
+/*
+ * Long-running server mode: rd-multi-strm -serve <socket-path> [-max-jobs <n>]
+ * listens on a Unix domain socket for job requests, each a command line of
+ * the program proper - its options and input files - sent one argument per
+ * line and ended by an empty line (or by shutting down the sending side). A
+ * leading "-cwd <dir>" pair sets the directory the job runs in.
+ *
+ * The server itself stays single threaded: a poll loop over the listening
+ * socket, the connections and a signalfd. Each job runs in a process forked
+ * from it - no exec, and none of the program's startup beyond its own threads -
+ * with its stderr (the job's log) being the connection, and stdin and stdout
+ * /dev/null. No more than max_jobs jobs run at once, across all clients; the
+ * rest wait in arrival order.
+ *
+ * This is a concurrency-limited job runner, not a shared engine. The jobs do
+ * not run on one warm event loop, thread pool and scheduler: the output sink,
+ * compression pool, partitions, tracing and recording of a run are
+ * process-wide state of their modules, set up and torn down once per run, so
+ * two runs can not be in one process at once. Each job process starts its own
+ * threads. What a job saves is the exec and the program's loading; what the
+ * jobs share is the limit on how many run at once.
+ *
+ * The server replies on the connection with lines:
+ *
+ *   job <id> queued               - waiting for a job slot
+ *   job <id> started <pid>
+ *   ... the job's log lines ...
+ *   job <id> report               - followed by the job's JSON metrics report
+ *   job <id> exit <status>        - the last line; the connection is then closed
+ *
+ * A request of just "-status" is answered with a line per running and queued
+ * job ("job <id> running <pid> <dir>" or "job <id> queued <dir>") and "end".
+ * The server never waits on a client: what of a reply the socket buffer does
+ * not take is kept (up to 1 MiB, else the connection is dropped) and written
+ * out as the client reads. A job whose client has closed its connection is
+ * dropped from the queue, or sent SIGTERM if running.
+ *
+ * SIGINT or SIGTERM stops the server: queued jobs are dropped, running jobs
+ * are sent SIGTERM and waited for, the socket is removed, and the replies
+ * still pending are given 5 seconds to be taken.
+ */
+namespace job_server {
+  using run_job_t = std::function<int(int argc, char **argv)>;
+
+  // runs the server per the -serve command line; returns the program's exit status
+  int serve(int argc, char **argv, const run_job_t &run_job);
+}
+
+#endif //JOB_SERVER_H
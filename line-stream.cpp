@@ -0,0 +1,86 @@
+/* line-stream.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <cerrno>
+#include "line-stream.h"
+
+namespace line_stream {
+
+  static constexpr size_t stream_buffer_size = 64 * 1024;
+
+  static int take_complete_lines(stream &strm) {
+    auto const eol = strm.pending.rfind('\n');
+    if (eol == std::string::npos) return 0;
+    return strm.take_lines(eol + 1);
+  }
+
+  ssize_t group::cookie_write(void *const cookie, const char *const buf, size_t const size) {
+    auto &strm = *static_cast<stream*>(cookie);
+    strm.pending.append(buf, size);
+    if (auto const ec = take_complete_lines(strm); ec != 0) {
+      errno = ec;
+      return -1;
+    }
+    return static_cast<ssize_t>(size);
+  }
+
+  int group::cookie_close(void *const cookie) {
+    auto const strm = static_cast<stream*>(cookie);
+    auto const owner = strm->owner;
+    int ec = 0;
+    // a last line without a newline is ended here, so that it is not run into another stream's line
+    if (!strm->pending.empty()) {
+      strm->pending += '\n';
+      ec = take_complete_lines(*strm);
+    }
+    delete strm;
+    if (owner->open_streams.fetch_sub(1) == 1 && owner->is_finishing.load()) {
+      owner->close_once();
+    }
+    if (ec != 0) {
+      errno = ec;
+      return -1;
+    }
+    return 0;
+  }
+
+  void group::close_once() {
+    if (!is_closed.exchange(true)) {
+      close_output();
+    }
+  }
+
+  FILE* group::open(std::unique_ptr<stream> sp_strm) {
+    sp_strm->owner = this;
+    cookie_io_functions_t const io_funcs{nullptr, cookie_write, nullptr, cookie_close};
+    auto const fp = fopencookie(sp_strm.get(), "w", io_funcs);
+    if (fp == nullptr) return nullptr;
+    sp_strm.release(); // owned by the FILE stream from here on - freed by cookie_close()
+    setvbuf(fp, nullptr, _IOFBF, stream_buffer_size);
+    open_streams.fetch_add(1);
+    return fp;
+  }
+
+  void group::finish() {
+    is_finishing.store(true);
+    if (open_streams.load() == 0) {
+      close_once();
+    }
+  }
+}
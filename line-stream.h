@@ -0,0 +1,73 @@
+/* line-stream.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef LINE_STREAM_H
+#define LINE_STREAM_H
+
+#include <cstdio>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <string>
+
+/*
+ * FILE streams (fopencookie()) that hand on only complete lines, for the
+ * outputs that the lines of many input streams are written to at once (see
+ * output-sink.h and output-partition.h): whatever a write leaves past the last
+ * line ending is held back for the next, so the lines of different streams are
+ * never split or run together. A last line without a line ending is ended when
+ * its stream is closed.
+ *
+ * A group is the set of streams open on one such output. Its output is
+ * closed (once) when the group is finished with none of its streams open -
+ * else, when streams cut short are still open, by the last of them to close.
+ */
+namespace line_stream {
+  class group;
+
+  // the state behind a FILE stream - derived by an output for state of its own
+  struct stream {
+    std::string pending{};  // what has been written past the last complete line
+    group *owner{nullptr};
+    virtual ~stream() = default;
+    // takes the complete lines, pending[0, end), out of pending; returns 0, or an errno value
+    virtual int take_lines(size_t end) = 0;
+  };
+
+  class group final {
+    void (*const close_output)();
+    std::atomic_uint open_streams{0};
+    std::atomic_bool is_finishing{false};
+    std::atomic_bool is_closed{false};
+    void close_once();
+    static ssize_t cookie_write(void *cookie, const char *buf, size_t size);
+    static int cookie_close(void *cookie);
+  public:
+    explicit group(void (*close_fn)()) : close_output{close_fn} {}
+    group(const group &) = delete;
+    group& operator=(const group &) = delete;
+
+    // a buffered FILE stream writing to the stream state - or nullptr, with errno set, if it could not be opened
+    FILE* open(std::unique_ptr<stream> sp_strm);
+    // closes the output now if no stream is open - else the last of them to close does
+    void finish();
+  };
+}
+
+#endif //LINE_STREAM_H
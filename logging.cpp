@@ -0,0 +1,183 @@
+/* logging.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <strings.h>
+#include <thread>
+#include <mutex>
+#include "logging.h"
+
+namespace logging {
+
+  std::atomic_int runtime_level{LOG_LEVEL_INFO};
+
+  static const char * const level_prefix[] = { "TRACE: ", "DEBUG: ", "INFO: ", "WARN: ", "ERROR: ", "" };
+
+  /*
+   * Bounded multi-producer/single-consumer ring of fixed size records. Each
+   * slot carries a sequence number: a producer claims a slot by advancing the
+   * enqueue position with a CAS, formats its record in place, then publishes it
+   * by storing the slot sequence. The consumer reads slots in order once their
+   * sequence shows them published, then releases them for the next lap.
+   */
+  static constexpr size_t ring_slots = 4096; // must be a power of two
+  static constexpr size_t record_size = 512 - sizeof(std::atomic_size_t) - sizeof(unsigned);
+
+  struct alignas(64) slot_t {
+    std::atomic_size_t seq;
+    unsigned len;
+    char text[record_size];
+  };
+
+  static slot_t ring[ring_slots];
+  alignas(64) static std::atomic_size_t enqueue_pos{0};
+  alignas(64) static size_t dequeue_pos{0};
+  static std::atomic_uint published{0};  // bumped per published record - the drain thread waits on it
+  static std::atomic_ulong dropped{0};
+  static std::atomic_bool running{false};
+  static std::atomic_uint active_writers{0}; // producers past the running check that have not yet published
+  static std::atomic_bool stopping{false};
+  static std::thread drain_thread;
+  static std::mutex lifecycle_guard;
+
+  bool set_level(std::string_view name) {
+    static const char * const names[] = { "trace", "debug", "info", "warn", "error", "off" };
+    for(int i = LOG_LEVEL_TRACE; i <= LOG_LEVEL_OFF; i++) {
+      if (name.length() == strlen(names[i]) && strncasecmp(name.data(), names[i], name.length()) == 0) {
+        runtime_level.store(i, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static unsigned format_record(char *buf, size_t buf_size, level lvl, const char *fmt, va_list ap) {
+    auto const prefix = level_prefix[static_cast<int>(lvl)];
+    auto n = static_cast<size_t>(snprintf(buf, buf_size, "%s", prefix));
+    auto const rc = vsnprintf(buf + n, buf_size - n, fmt, ap);
+    n = rc < 0 ? n : std::min(n + static_cast<size_t>(rc), buf_size - 1); // truncated when too long for a record
+    if (n == 0 || buf[n - 1] != '\n') {
+      if (n == buf_size - 1) n--;
+      buf[n++] = '\n';
+      buf[n] = '\0';
+    }
+    return static_cast<unsigned>(n);
+  }
+
+  void write(level lvl, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    // counted before checking running, so that shutdown() either is seen here or waits for this record
+    active_writers.fetch_add(1, std::memory_order_seq_cst);
+    if (!running.load(std::memory_order_seq_cst)) {
+      active_writers.fetch_sub(1, std::memory_order_release);
+      char buf[record_size];
+      auto const n = format_record(buf, sizeof(buf), lvl, fmt, ap);
+      fwrite(buf, 1, n, stderr);
+      va_end(ap);
+      return;
+    }
+    auto pos = enqueue_pos.load(std::memory_order_relaxed);
+    slot_t *slot;
+    for(;;) {
+      slot = &ring[pos & (ring_slots - 1)];
+      auto const seq = slot->seq.load(std::memory_order_acquire);
+      auto const diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        dropped.fetch_add(1, std::memory_order_relaxed); // ring is full - drop rather than stall the caller
+        active_writers.fetch_sub(1, std::memory_order_release);
+        va_end(ap);
+        return;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    slot->len = format_record(slot->text, sizeof(slot->text), lvl, fmt, ap);
+    va_end(ap);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    published.fetch_add(1, std::memory_order_release);
+    published.notify_one();
+    active_writers.fetch_sub(1, std::memory_order_release);
+  }
+
+  // drains published records to stderr; returns the number of records written
+  static size_t drain() {
+    size_t count = 0;
+    for(;;) {
+      auto &slot = ring[dequeue_pos & (ring_slots - 1)];
+      if (slot.seq.load(std::memory_order_acquire) != dequeue_pos + 1) break;
+      fwrite(slot.text, 1, slot.len, stderr);
+      slot.seq.store(dequeue_pos + ring_slots, std::memory_order_release);
+      dequeue_pos++;
+      count++;
+    }
+    if (count > 0) {
+      fflush(stderr);
+    }
+    return count;
+  }
+
+  static void drain_loop() {
+    unsigned seen = published.load(std::memory_order_acquire);
+    while (!stopping.load(std::memory_order_acquire)) {
+      drain();
+      published.wait(seen, std::memory_order_acquire); // sleeps until a record is published
+      seen = published.load(std::memory_order_acquire);
+    }
+    drain();
+  }
+
+  void start() {
+    std::lock_guard<std::mutex> lk(lifecycle_guard);
+    if (running.load()) return;
+    for(size_t i = 0; i < ring_slots; i++) {
+      ring[i].seq.store(i, std::memory_order_relaxed);
+    }
+    enqueue_pos.store(0, std::memory_order_relaxed);
+    dequeue_pos = 0;
+    stopping.store(false);
+    drain_thread = std::thread(drain_loop);
+    running.store(true, std::memory_order_release);
+  }
+
+  void shutdown() {
+    std::lock_guard<std::mutex> lk(lifecycle_guard);
+    if (!running.load()) return;
+    running.store(false, std::memory_order_seq_cst);
+    stopping.store(true, std::memory_order_release);
+    published.fetch_add(1, std::memory_order_release);
+    published.notify_one();
+    drain_thread.join();
+    // a producer that raced with shutdown may still be formatting a record into the slot it claimed - it only
+    // formats, so the wait is short; producers coming later see running unset and write to stderr themselves
+    while (active_writers.load(std::memory_order_acquire) != 0) {
+      std::this_thread::yield();
+    }
+    drain();
+    auto const n = dropped.exchange(0);
+    if (n > 0) {
+      fprintf(stderr, "WARN: %lu log records were dropped due to the log ring buffer being full\n", n);
+    }
+  }
+
+}
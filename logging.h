@@ -0,0 +1,88 @@
+/* logging.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <atomic>
+#include <string_view>
+
+/*
+ * Leveled logging to stderr. Log statements below LOG_LEVEL_COMPILED are
+ * eliminated at compile time; the remainder are checked against a run time
+ * level (a single relaxed atomic load) before any formatting is done.
+ *
+ * Records are formatted into a lock-free ring buffer and written to stderr by
+ * a background thread, so logging threads neither block on stderr nor contend
+ * on its stdio lock. When the ring is full records are dropped (and counted)
+ * rather than stalling the caller. Before logging::start() is called, or after
+ * logging::shutdown(), records are written to stderr synchronously.
+ */
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_WARN  3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF   5
+
+#ifndef LOG_LEVEL_COMPILED
+#ifdef _DEBUG
+#define LOG_LEVEL_COMPILED LOG_LEVEL_TRACE
+#else
+#define LOG_LEVEL_COMPILED LOG_LEVEL_DEBUG
+#endif
+#endif
+
+namespace logging {
+  enum class level : int {
+    TRACE = LOG_LEVEL_TRACE, DEBUG = LOG_LEVEL_DEBUG, INFO = LOG_LEVEL_INFO,
+    WARN = LOG_LEVEL_WARN, ERROR = LOG_LEVEL_ERROR, OFF = LOG_LEVEL_OFF
+  };
+
+  constexpr level compiled_level = static_cast<level>(LOG_LEVEL_COMPILED);
+
+  extern std::atomic_int runtime_level;
+
+  constexpr bool compiled_in(level lvl) { return lvl >= compiled_level && lvl != level::OFF; }
+  inline bool enabled(level lvl) {
+    return compiled_in(lvl) && static_cast<int>(lvl) >= runtime_level.load(std::memory_order_relaxed);
+  }
+  bool set_level(std::string_view name);
+
+  void start();
+  void shutdown();
+
+  void write(level lvl, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+}
+
+#define LOG_AT(lvl, ...) \
+  do { \
+    if constexpr (logging::compiled_in(lvl)) { \
+      if (logging::enabled(lvl)) logging::write(lvl, __VA_ARGS__); \
+    } \
+  } while (false)
+
+#define LOG_TRACE(...) LOG_AT(logging::level::TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(logging::level::DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(logging::level::INFO,  __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(logging::level::WARN,  __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(logging::level::ERROR, __VA_ARGS__)
+
+#endif //LOGGING_H
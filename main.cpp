@@ -20,15 +20,34 @@ limitations under the License.
 */
 #include <string_view>
 #include <cstring>
+#include <climits>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <cxxabi.h>
 #include <set>
-#include <map>
 #include <future>
+#include <atomic>
+#include <thread>
 #include "signal-handling.h"
+#include "logging.h"
+#include "metrics.h"
+#include "tracing.h"
 #include "util.h"
 #include "uncompress-stream.h"
+#include "synthetic-stream.h"
+#include "stream-record.h"
+#include "child-process-tracking.h"
+#include "fd-table.h"
 #include "read-multi-strm.h"
+#include "merge-streams.h"
+#include "stream-coro.h"
+#include "flow-control.h"
+#include "cpu-affinity.h"
+#include "output-file.h"
+#include "output-compress.h"
+#include "output-sink.h"
+#include "output-partition.h"
+#include "job-server.h"
 
 
 //static void do_on_exit();
@@ -53,15 +72,21 @@ using file_stream_unique_ptr = std::unique_ptr<FILE, std::function<decltype(fclo
  * is destructed. (The fclose() function will close the FILE stream.)
  */
 struct output_stream_context {
-  const std::string output_file;
+  // written per line - kept together at the front
   file_stream_unique_ptr output_stream;
   long output_stream_line{1};
+  bool is_line_spilled{false}; // part of the current line has been written ahead of the rest of it
   std::string output_str_buf{};
+  // seldom touched
+  const std::string output_file;
+  std::shared_ptr<metrics::stream_stats> stats;
 
   // the only valid way to construct this object
-  output_stream_context(std::string &&output_file_rval, file_stream_unique_ptr &&output_stream_rval) noexcept :
+  output_stream_context(std::string &&output_file_rval, file_stream_unique_ptr &&output_stream_rval,
+                        std::shared_ptr<metrics::stream_stats> stream_stats) noexcept :
+      output_stream(std::move(output_stream_rval)),
       output_file(std::move(output_file_rval)),
-      output_stream(std::move(output_stream_rval))
+      stats(std::move(stream_stats))
   {
     output_str_buf.reserve(16);
   }
@@ -73,24 +98,84 @@ struct output_stream_context {
   ~output_stream_context() = default;
 };
 
+/**
+ * Limits on how many lines of decompressed output are wanted - in total
+ * across all input files, and per each input file. Once a limit has been
+ * reached, the input streams affected are shut down early (their gzip child
+ * processes are terminated) rather than being decompressed to completion.
+ *
+ * Only lines of the stdout streams count; the '.err' output is not limited.
+ */
+struct output_line_limits {
+  std::atomic_long global_remaining{-1}; // -1 means no limit
+  long per_file{-1};                     // -1 means no limit
+
+  // claims an output line, where lines_written is the count already written for the input file
+  bool try_acquire_line(long lines_written) {
+    if (per_file >= 0 && lines_written >= per_file) return false;
+    auto remaining = global_remaining.load(std::memory_order_relaxed);
+    while (remaining != -1) {
+      if (remaining <= 0) return false;
+      if (global_remaining.compare_exchange_weak(remaining, remaining - 1, std::memory_order_relaxed)) break;
+    }
+    return true;
+  }
+  bool global_exhausted() const { return global_remaining.load(std::memory_order_relaxed) == 0; }
+};
+
 using WR = enum class WRITE_RESULT : char {
-  NO_OP = 0, SUCCESS, FAILURE, INTERRUPTED, END_OF_FILE
+  NO_OP = 0, SUCCESS, FAILURE, INTERRUPTED, END_OF_FILE, LIMIT_REACHED
 };
 
 using read_multi_result = std::tuple<int, WRITE_RESULT>;
 
-using output_streams_context_map_t = std::map<int, std::shared_ptr<output_stream_context>>;
+// the output contexts of the input streams, by file descriptor - a flat table (see fd-table.h) as is the reactor's
+using output_streams_context_map_t = fd_table<std::unique_ptr<output_stream_context>>;
 
-static read_multi_result read_on_ready(bool &is_ctrl_z_registered, read_multi_stream &rms,
-                                       output_streams_context_map_t &output_streams_map);
+/**
+ * An event loop of the sharded mode. Each shard is a thread - pinned to a CPU -
+ * with a read_multi_stream and output contexts of its own, for the streams of
+ * the inputs assigned to it when they were spawned. Its streams are read and
+ * written out on that thread alone, so nothing is handed between threads. The
+ * child processes of its inputs run on the CPUs of its NUMA node.
+ */
+struct event_loop_shard {
+  const unsigned index;
+  const cpu_affinity::placement placement;
+  read_multi_stream rms;
+  output_streams_context_map_t output_streams_map{};
+  uint64_t load{0};   // the load estimates of the inputs assigned to it, summed
+  event_loop_shard(unsigned index, cpu_affinity::placement placement, u_int read_buf_size)
+      : index{index}, placement{std::move(placement)}, rms{read_buf_size} {}
+};
+
+using event_loop_shards_t = std::vector<std::unique_ptr<event_loop_shard>>;
+
+static read_multi_result read_on_ready(read_multi_stream &rms, output_streams_context_map_t &output_streams_map,
+                                       output_line_limits &limits);
+
+static read_multi_result merge_on_ready(read_multi_stream &rms, output_streams_context_map_t &output_streams_map,
+                                        ordered_merge &merge, long per_file_limit, flow_controller &flow_ctl);
+
+static read_multi_result coro_on_ready(read_multi_stream &rms, output_streams_context_map_t &output_streams_map,
+                                       output_line_limits &limits, unsigned thread_count);
+
+static read_multi_result shards_on_ready(event_loop_shards_t &shards, output_line_limits &limits);
+
+static event_loop_shard* least_loaded_shard(const event_loop_shards_t &shards);
+
+static void stop_input_stream(int fd, read_multi_stream &rms, output_streams_context_map_t &output_streams_map);
 
 using write_result = std::tuple<int, int, WRITE_RESULT>;
 
 using write_to_output_callback = std::function<int(FILE *, std::string_view, std::string_view)>;
 
 static write_result
-write_to_output_stream(int fd, read_buf_ctx &rbc, FILE *output_stream, long &input_line, std::string &str_buf,
-                       const write_to_output_callback &writer);
+write_to_output_stream(int fd, read_buf_ctx &rbc, output_stream_context &output_stream_ctx,
+                       const write_to_output_callback &writer, output_line_limits *limits = nullptr,
+                       bool is_drain = false, stream_quantum budget = {});
+
+static int write_text_line(FILE *os, std::string_view str, std::string_view nl);
 
 static const char *write_result_str(WRITE_RESULT result) {
   switch (result) {
@@ -102,28 +187,407 @@ static const char *write_result_str(WRITE_RESULT result) {
       return "thread interrupted";
     case WR::END_OF_FILE:
       return "end of input stream";
+    case WR::LIMIT_REACHED:
+      return "output line limit reached";
     default:
       return "";
   }
 }
 
-int main(int argc, char **argv) {
+/**
+ * Parses the numeric value that follows a command line option. A missing
+ * value is a fatal error; a value that is not valid, or is out of range,
+ * is warned about and the option keeps its default setting.
+ *
+ * @return false if the option value is missing, otherwise true
+ */
+static bool parse_numeric_option(int &i, int argc, char **argv, unsigned long max_value, const char *what,
+                                 unsigned long &value)
+{
+  const char * const opt = argv[i];
+  if (++i >= argc) {
+    LOG_ERROR("expected numeric value following command option '%s'\n", opt);
+    return false;
+  }
+  const char * const nbr_str = argv[i];
   try {
-    signal_handling::set_signals_handler();
+    const auto nbr = std::stoul(nbr_str);
+    if (nbr <= max_value) {
+      value = nbr;
+    } else {
+      LOG_WARN("%lu was out of range for maximum allowed (%lu) %s\n", nbr, max_value, what);
+    }
+  } catch (const std::invalid_argument &ex) {
+    LOG_WARN("'%s' was not a valid positive integer expressing %s\n", nbr_str, what);
+  } catch (const std::out_of_range &ex) {
+    LOG_WARN("'%s' was out of range as a positive integer expressing %s\n", nbr_str, what);
+  }
+  return true;
+}
 
+/**
+ * Parses the string value that follows a command line option.
+ *
+ * @return false if the option value is missing, otherwise true
+ */
+static bool parse_string_option(int &i, int argc, char **argv, std::string_view &value) {
+  const char * const opt = argv[i];
+  if (++i >= argc) {
+    LOG_ERROR("expected value following command option '%s'\n", opt);
+    return false;
+  }
+  value = argv[i];
+  return true;
+}
+
+static int run(int argc, char **argv);
+
+int main(int argc, char **argv) {
+  // -serve runs the program as a long-running server of jobs instead, each job a run of its own (see job-server.h)
+  if (argc > 1 && strcmp(argv[1], "-serve") == 0) {
+    return job_server::serve(argc, argv, run);
+  }
+  return run(argc, argv);
+}
+
+/**
+ * Runs the program per its command line - in the process as started, or in a
+ * job process forked from the server.
+ */
+static int run(int argc, char **argv) {
+  try {
 //    atexit(do_on_exit);
 
     u_int read_buf_size = 64; // default
 
+    // when a merge output file is specified, the stdout of all input files are
+    // k-way merged, per merge key order, into that single output file
+    std::string_view merge_output_file{};
+    merge_key_spec merge_key{};
+    size_t merge_lookahead = default_merge_lookahead;
+
+    // early termination and sampling of the decompressed output
+    output_line_limits limits{};
+    double sample_rate = 1.0;
+
+    // throughput metrics - a JSON report written at exit and/or periodically
+    // to a file (a SIGUSR1 logs a report on demand regardless)
+    std::string_view stats_json_file{};
+    std::string_view stats_file{};
+    u_int stats_interval = 10; // seconds
+
+    // when specified, a timeline of the program's activity is written to this file
+    std::string_view trace_file{};
+
+    // when specified, the arrival (time and size) of input chunks is recorded to this file
+    std::string_view record_file{};
+    bool record_data = false;
+
+    // when non-zero, the streams are read by coroutines resumed on a pool of this many threads
+    u_int coro_threads = 0;
+
+    // bounds on the bytes of input held in memory
+    flow_limits flow{};
+    bool is_flow_low_set = false;
+
+    // when non-zero, the inputs are divided among this many event loops, each on a thread of its own
+    u_int shard_count = 0;
+
+    // deficit round robin service of the ready streams - the quantum per round, and the weight of the inputs that follow
+    stream_quantum sched_quantum{default_sched_quantum_bytes, 0};
+    u_int input_weight = 1;
+
+    // the CPUs, or NUMA nodes, that the shards are pinned to (or that the process is confined to)
+    std::vector<int> affinity_cpus{};
+    std::vector<int> affinity_nodes{};
+
+    // the output files are written compressed, in blocks compressed on a pool of threads
+    output_compress::settings compress{};
+    // output file space preallocation and write-behind
+    output_file::settings output_hints{};
+    // when a sink is specified, the stdout of all input files is written, line by line as it arrives, to that
+    // single output - a file, or stdout for "-" - with each line optionally tagged by the name of its input
+    std::string_view sink_output{};
+    bool is_sink_tagged = false;
+    size_t sink_ring_size = output_sink::default_ring_size;
+    // when a partition prefix is specified, the stdout lines of all input files are routed to a fixed number of
+    // partition files by a hash of a key of each line, and/or rolled over to a new file at a size
+    output_partition::settings partition{};
+
     auto const stdin_fd = get_file_desc(stdin, __LINE__); // default
     if (stdin_fd == -1) {
-      fprintf(stderr, "ERROR: unexpected error - unable to obtain stdin file descriptor\n");
+      LOG_ERROR("unexpected error - unable to obtain stdin file descriptor\n");
       return EXIT_FAILURE;
     }
     dbg_dump_file_desc_flags(stdin_fd);
 
+    std::vector<std::string_view> input_files{};
+    std::vector<u_int> input_weights{}; // per input file
+
+    for(int i = 1; i < argc; i++) {
+      std::string_view arg{argv[i]};
+      LOG_DEBUG("arg: \"%s\"\n", arg.data());
+      switch(arg[0]) {
+        case '-': {
+          unsigned long nbr;
+          if (arg.compare("-bufsize") == 0) {
+            nbr = read_buf_size;
+            if (!parse_numeric_option(i, argc, argv, UINT16_MAX, "read buffer size", nbr)) return EXIT_FAILURE;
+            read_buf_size = (u_int) nbr;
+          } else if (arg.compare("-log-level") == 0) {
+            std::string_view level{};
+            if (!parse_string_option(i, argc, argv, level)) return EXIT_FAILURE;
+            if (!logging::set_level(level)) {
+              LOG_ERROR("unknown log level '%s' (expected trace, debug, info, warn, error or off)\n", level.data());
+              return EXIT_FAILURE;
+            }
+          } else if (arg.compare("-merge") == 0) {
+            if (!parse_string_option(i, argc, argv, merge_output_file)) return EXIT_FAILURE;
+          } else if (arg.compare("-merge-key-field") == 0) {
+            nbr = (unsigned long) merge_key.field;
+            if (!parse_numeric_option(i, argc, argv, INT16_MAX, "merge key field", nbr)) return EXIT_FAILURE;
+            merge_key.field = (int) nbr;
+          } else if (arg.compare("-merge-key-delim") == 0) {
+            std::string_view delim{};
+            if (!parse_string_option(i, argc, argv, delim)) return EXIT_FAILURE;
+            if (delim.length() != 1) {
+              LOG_ERROR("merge key delimiter must be a single character: '%s'\n", delim.data());
+              return EXIT_FAILURE;
+            }
+            merge_key.delim = delim[0];
+          } else if (arg.compare("-merge-lookahead") == 0) {
+            nbr = merge_lookahead;
+            if (!parse_numeric_option(i, argc, argv, UINT32_MAX, "merge lookahead line count", nbr)) {
+              return EXIT_FAILURE;
+            }
+            merge_lookahead = nbr;
+          } else if (arg.compare("-limit") == 0) {
+            nbr = ULONG_MAX;
+            if (!parse_numeric_option(i, argc, argv, LONG_MAX, "output line limit", nbr)) return EXIT_FAILURE;
+            if (nbr != ULONG_MAX) limits.global_remaining = (long) nbr;
+          } else if (arg.compare("-per-file-limit") == 0) {
+            nbr = ULONG_MAX;
+            if (!parse_numeric_option(i, argc, argv, LONG_MAX, "per file output line limit", nbr)) return EXIT_FAILURE;
+            if (nbr != ULONG_MAX) limits.per_file = (long) nbr;
+          } else if (arg.compare("-sample-rate") == 0) {
+            std::string_view rate_str{};
+            if (!parse_string_option(i, argc, argv, rate_str)) return EXIT_FAILURE;
+            char *end = nullptr;
+            const auto rate = strtod(rate_str.data(), &end);
+            if (end == rate_str.data() || *end != '\0' || rate < 0.0 || rate > 1.0) {
+              LOG_ERROR("sample rate must be a fraction between 0 and 1: '%s'\n", rate_str.data());
+              return EXIT_FAILURE;
+            }
+            sample_rate = rate;
+          } else if (arg.compare("-stats-json") == 0) {
+            if (!parse_string_option(i, argc, argv, stats_json_file)) return EXIT_FAILURE;
+          } else if (arg.compare("-stats-file") == 0) {
+            if (!parse_string_option(i, argc, argv, stats_file)) return EXIT_FAILURE;
+          } else if (arg.compare("-stats-interval") == 0) {
+            nbr = stats_interval;
+            if (!parse_numeric_option(i, argc, argv, 86400, "stats interval seconds", nbr)) return EXIT_FAILURE;
+            stats_interval = (u_int) nbr;
+          } else if (arg.compare("-trace") == 0) {
+            if (!parse_string_option(i, argc, argv, trace_file)) return EXIT_FAILURE;
+          } else if (arg.compare("-record") == 0) {
+            if (!parse_string_option(i, argc, argv, record_file)) return EXIT_FAILURE;
+          } else if (arg.compare("-record-data") == 0) {
+            record_data = true;
+          } else if (arg.compare("-flow-budget") == 0) {
+            nbr = flow.budget;
+            if (!parse_numeric_option(i, argc, argv, LONG_MAX, "flow control budget bytes", nbr)) return EXIT_FAILURE;
+            flow.budget = nbr;
+          } else if (arg.compare("-flow-high") == 0) {
+            nbr = flow.high_watermark;
+            if (!parse_numeric_option(i, argc, argv, LONG_MAX, "flow control high watermark bytes", nbr)) {
+              return EXIT_FAILURE;
+            }
+            flow.high_watermark = nbr;
+          } else if (arg.compare("-flow-low") == 0) {
+            nbr = flow.low_watermark;
+            if (!parse_numeric_option(i, argc, argv, LONG_MAX, "flow control low watermark bytes", nbr)) {
+              return EXIT_FAILURE;
+            }
+            flow.low_watermark = nbr;
+            is_flow_low_set = true;
+          } else if (arg.compare("-coro-threads") == 0) {
+            nbr = coro_threads;
+            if (!parse_numeric_option(i, argc, argv, 1024, "coroutine pool thread count", nbr)) return EXIT_FAILURE;
+            coro_threads = (u_int) nbr;
+          } else if (arg.compare("-shards") == 0) {
+            nbr = shard_count;
+            if (!parse_numeric_option(i, argc, argv, 1024, "event loop shard count", nbr)) return EXIT_FAILURE;
+            shard_count = (u_int) nbr;
+          } else if (arg.compare("-sched-quantum") == 0) {
+            nbr = sched_quantum.bytes;
+            if (!parse_numeric_option(i, argc, argv, LONG_MAX, "scheduling quantum bytes", nbr)) return EXIT_FAILURE;
+            sched_quantum.bytes = nbr;
+          } else if (arg.compare("-sched-quantum-lines") == 0) {
+            nbr = sched_quantum.lines;
+            if (!parse_numeric_option(i, argc, argv, LONG_MAX, "scheduling quantum lines", nbr)) return EXIT_FAILURE;
+            sched_quantum.lines = nbr;
+          } else if (arg.compare("-weight") == 0) {
+            nbr = input_weight;
+            if (!parse_numeric_option(i, argc, argv, 1024, "input stream weight", nbr)) return EXIT_FAILURE;
+            input_weight = std::max(1u, (u_int) nbr);
+          } else if (arg.compare("-cpus") == 0 || arg.compare("-numa-nodes") == 0) {
+            bool const is_cpus = arg.compare("-cpus") == 0;
+            std::string_view list{};
+            if (!parse_string_option(i, argc, argv, list)) return EXIT_FAILURE;
+            if (!cpu_affinity::parse_list(list, is_cpus ? affinity_cpus : affinity_nodes)) {
+              LOG_ERROR("expected a list of %s such as '0-3,8' following command option '%s': '%s'\n",
+                        is_cpus ? "CPUs" : "NUMA nodes", arg.data(), list.data());
+              return EXIT_FAILURE;
+            }
+          } else if (arg.compare("-compress") == 0) {
+            std::string_view name{};
+            if (!parse_string_option(i, argc, argv, name)) return EXIT_FAILURE;
+            if (!output_compress::parse_codec(name, compress.kind)) {
+              LOG_ERROR("expected 'gzip', 'zstd' or 'none' following command option '%s': '%s'\n", arg.data(), name.data());
+              return EXIT_FAILURE;
+            }
+          } else if (arg.compare("-compress-level") == 0) {
+            nbr = 0;
+            if (!parse_numeric_option(i, argc, argv, 22, "compression level", nbr)) return EXIT_FAILURE;
+            compress.level = (int) nbr;
+          } else if (arg.compare("-compress-threads") == 0) {
+            nbr = compress.threads;
+            if (!parse_numeric_option(i, argc, argv, 1024, "compression thread count", nbr)) return EXIT_FAILURE;
+            compress.threads = (u_int) nbr;
+          } else if (arg.compare("-compress-block") == 0) {
+            nbr = compress.block_size;
+            if (!parse_numeric_option(i, argc, argv, 256 * 1024 * 1024, "compression block bytes", nbr)) {
+              return EXIT_FAILURE;
+            }
+            compress.block_size = std::max(4096UL, nbr);
+          } else if (arg.compare("-write-behind") == 0) {
+            nbr = output_hints.write_behind;
+            if (!parse_numeric_option(i, argc, argv, LONG_MAX, "write-behind window bytes", nbr)) return EXIT_FAILURE;
+            output_hints.write_behind = nbr;
+          } else if (arg.compare("-prealloc-max") == 0) {
+            nbr = output_hints.prealloc_max;
+            if (!parse_numeric_option(i, argc, argv, LONG_MAX, "output preallocation bytes", nbr)) return EXIT_FAILURE;
+            output_hints.prealloc_max = nbr;
+          } else if (arg.compare("-sink") == 0) {
+            if (!parse_string_option(i, argc, argv, sink_output)) return EXIT_FAILURE;
+          } else if (arg.compare("-sink-tag") == 0) {
+            is_sink_tagged = true;
+          } else if (arg.compare("-sink-ring-size") == 0) {
+            nbr = sink_ring_size;
+            if (!parse_numeric_option(i, argc, argv, 1UL << 40, "sink ring buffer bytes", nbr)) return EXIT_FAILURE;
+            sink_ring_size = nbr;
+          } else if (arg.compare("-partition") == 0) {
+            std::string_view prefix{};
+            if (!parse_string_option(i, argc, argv, prefix)) return EXIT_FAILURE;
+            partition.prefix = prefix;
+          } else if (arg.compare("-partitions") == 0) {
+            nbr = partition.count;
+            if (!parse_numeric_option(i, argc, argv, 65536, "partition count", nbr)) return EXIT_FAILURE;
+            partition.count = std::max(1u, (u_int) nbr);
+          } else if (arg.compare("-partition-size") == 0) {
+            nbr = partition.roll_size;
+            if (!parse_numeric_option(i, argc, argv, LONG_MAX, "partition roll over bytes", nbr)) return EXIT_FAILURE;
+            partition.roll_size = nbr;
+          } else if (arg.compare("-partition-key-field") == 0) {
+            nbr = (unsigned long) partition.key.field;
+            if (!parse_numeric_option(i, argc, argv, INT16_MAX, "partition key field", nbr)) return EXIT_FAILURE;
+            partition.key.field = (int) nbr;
+          } else if (arg.compare("-partition-key-delim") == 0) {
+            std::string_view delim{};
+            if (!parse_string_option(i, argc, argv, delim)) return EXIT_FAILURE;
+            if (delim.length() != 1) {
+              LOG_ERROR("partition key delimiter must be a single character: '%s'\n", delim.data());
+              return EXIT_FAILURE;
+            }
+            partition.key.delim = delim[0];
+          } else {
+            LOG_ERROR("unknown command option '%s'\n", arg.data());
+            return EXIT_FAILURE;
+          }
+          break;
+        }
+        default: // assume argument is a file path
+          input_files.push_back(arg);
+          input_weights.push_back(input_weight);
+      }
+    }
+
+    LOG_DEBUG("using %u bytes as read buffer size\n", read_buf_size);
+
+    if (!is_flow_low_set) {
+      flow.low_watermark = std::min(flow.low_watermark, flow.high_watermark / 4); // keeps to a lowered high watermark
+    } else if (flow.high_watermark > 0 && flow.low_watermark > flow.high_watermark) {
+      LOG_ERROR("flow control low watermark (%lu) is above the high watermark (%lu)\n",
+                flow.low_watermark, flow.high_watermark);
+      return EXIT_FAILURE;
+    }
+
+    if (shard_count > 0 && (!merge_output_file.empty() || coro_threads > 0)) {
+      LOG_ERROR("the -shards option can not be combined with -merge or -coro-threads\n");
+      return EXIT_FAILURE;
+    }
+    if (!sink_output.empty() && (!merge_output_file.empty() || compress.kind != output_compress::codec::NONE)) {
+      LOG_ERROR("the -sink option can not be combined with -merge or -compress\n");
+      return EXIT_FAILURE;
+    }
+    if (!partition.prefix.empty() && (!merge_output_file.empty() || !sink_output.empty())) {
+      LOG_ERROR("the -partition option can not be combined with -merge or -sink\n");
+      return EXIT_FAILURE;
+    }
+    if (is_sink_tagged && sink_output.empty()) {
+      LOG_ERROR("the -sink-tag option requires the -sink option\n");
+      return EXIT_FAILURE;
+    }
+    // streams are paused only by the merge - elsewhere the high watermark just bounds a line fragment
+    if ((flow.budget > 0 || is_flow_low_set) && merge_output_file.empty()) {
+      LOG_ERROR("the -flow-budget and -flow-low options require the -merge option\n");
+      return EXIT_FAILURE;
+    }
+
+    // the shards are placed on these CPUs - or, when not sharded, the process as a whole is confined to them
+    auto const shard_placements = cpu_affinity::plan(std::max(shard_count, 1u), affinity_cpus, affinity_nodes);
+    if (shard_count == 0 && (!affinity_cpus.empty() || !affinity_nodes.empty())) {
+      std::vector<int> cpus{affinity_cpus};
+      for(auto const node : affinity_nodes) {
+        auto const node_cpus = cpu_affinity::cpus_of_node(node);
+        cpus.insert(cpus.end(), node_cpus.begin(), node_cpus.end());
+      }
+      // inherited by the threads and child processes started from here on - so set before any is started
+      if (cpus.empty() || !cpu_affinity::set_thread_cpus(cpus)) return EXIT_FAILURE;
+    }
+
+    // the signal handling and logging threads are the first started (until now, diagnostics were written directly)
+    signal_handling::set_signals_handler();
+    signal_handling::set_stats_request_handler([] { metrics::log_report(); });
+
+    // diagnostics are written to stderr by a background thread from here on; the
+    // exit handler drains whatever is still buffered when the program terminates
+    logging::start();
+    atexit(logging::shutdown);
+
+    // each input takes four file descriptors (its stdout and stderr pipes, and their two
+    // output files), so many inputs soon exceed the default soft limit of 1024
+    raise_open_files_limit();
+
+    if (!trace_file.empty()) {
+      if (!tracing::start(trace_file)) return EXIT_FAILURE;
+      tracing::set_thread_name("main reactor");
+    }
+
     // holds the output context of all input files (hence "multi stream" moniker)
-    read_multi_stream rms;
+    read_multi_stream rms{read_buf_size};
+    rms.set_quantum(sched_quantum);
+
+    // accounts the bytes of input held in memory, pausing streams that hold too much
+    flow_controller flow_ctl{flow};
+
+    // the event loops of the sharded mode, each with a read_multi_stream of its own
+    event_loop_shards_t shards{};
+    for(u_int i = 0; i < shard_count; i++) {
+      shards.push_back(std::make_unique<event_loop_shard>(i, shard_placements[i % shard_placements.size()],
+                                                          read_buf_size));
+      shards.back()->rms.set_quantum(sched_quantum);
+    }
 
     // file descriptors to the output (stdout and stderr) of processing
     // a given input file are used as keys to this map. Can dereference
@@ -131,169 +595,302 @@ int main(int argc, char **argv) {
     // the output files context retrieved
     output_streams_context_map_t output_streams_map;
 
-    if (argc > 1) {
-      for(int i = 1; i < argc; i++) {
-        std::string_view arg{argv[i]};
-        fprintf(stderr, "DEBUG: arg: \"%s\"\n", arg.data());
-        switch(arg[0]) {
-          case '-': {
-            if (arg.compare("-bufsize") == 0) {
-              if (++i < argc) {
-                const char * const nbr_str = argv[i];
-                try {
-                  const auto nbr = std::stoul(nbr_str);
-                  if (nbr <= UINT16_MAX) {
-                    read_buf_size = (u_int) nbr;
-                  } else {
-                    fprintf(stderr, "WARN: %lu was out of range for maximum allowed (%u bytes) read buffer size\n", nbr, UINT16_MAX);
-                  }
-                } catch (const std::invalid_argument &ex) {
-                  fprintf(stderr, "WARN: '%s' was not a valid positive integer expressing read buffer size\n", nbr_str);
-                } catch (const std::out_of_range &ex) {
-                  fprintf(stderr, "WARN: '%s' was out of range as a positive integer expressing read buffer size\n", nbr_str);
-                }
-              } else {
-                fprintf(stderr, "ERROR: expected numeric value following command option '%s'\n", arg.data());
-                return EXIT_FAILURE;
-              }
-            } else {
-              fprintf(stderr, "ERROR: unknown command option '%s'\n", arg.data());
-              return EXIT_FAILURE;
-            } 
-            break;
-          }
-          default: { // assume argument is a file path
-            if (valid_file(arg)) {
-              int offset;
-              std::string_view input_file{arg};
-              if (has_ending(input_file, ".gz", offset, __LINE__)) {
-                auto const fd_pair = get_uncompressed_stream(arg);
-                auto const fd_stdout = std::get<0>(fd_pair);
-                auto const fd_stderr = std::get<1>(fd_pair);
-                if (fd_stdout != -1) {
-                  rms += std::make_tuple(fd_stdout, fd_stderr);
-
-                  std::string output_file{input_file.substr(0, static_cast<unsigned long>(offset))};
-                  std::string output_err_file{output_file + ".err"};
-                  fprintf(stderr, "output file: \"%s\" output error file: \"%s\"\n",
-                          output_file.c_str(), output_err_file.c_str());
-
-                  auto output_stream = fopen(output_file.c_str(), "wb");
-                  static const char * const errfmt = "ERROR: failed opening output file \"%s\":\n\t%s\n";
-                  if (output_stream == nullptr) {
-                    fprintf(stderr, errfmt, output_file.c_str(), strerror(errno));
-                    return EXIT_FAILURE;
-                  }
-                  file_stream_unique_ptr sp_output_stream{output_stream, &fclose};
-
-                  auto output_err_stream = fopen(output_err_file.c_str(), "wb");
-                  if (output_err_stream == nullptr) {
-                    fprintf(stderr, errfmt, output_err_file.c_str(), strerror(errno));
-                    return EXIT_FAILURE;
-                  }
-                  file_stream_unique_ptr sp_output_err_stream{output_err_stream, &fclose};
-
-                  output_streams_map.insert(
-                      std::make_pair(fd_stdout,
-                                     std::make_shared<output_stream_context>(std::move(output_file),
-                                                                             std::move(sp_output_stream))));
-                  output_streams_map.insert(
-                      std::make_pair(fd_stderr,
-                                     std::make_shared<output_stream_context>(std::move(output_err_file),
-                                                                             std::move(sp_output_err_stream))));
-
-                  continue;
-                }
-              }
-            }
-            return EXIT_FAILURE;
+    static const char * const errfmt = "failed opening output file \"%s\":\n\t%s\n";
+
+    output_file::configure(output_hints);
+    if (!output_compress::start(compress)) return EXIT_FAILURE;
+    if (!sink_output.empty() && !output_sink::start(sink_output, is_sink_tagged, sink_ring_size)) return EXIT_FAILURE;
+    // the output files named after the input files are given the suffix of the compression (a -merge output is
+    // not) - with ".out" ahead of it where it would otherwise name the input file itself (gzip output of a .gz input)
+    const std::string compress_suffix{output_compress::file_suffix(compress.kind)};
+
+    const bool is_merge_mode = !merge_output_file.empty();
+    file_stream_unique_ptr sp_merge_output_stream{nullptr, &fclose};
+    std::unique_ptr<ordered_merge> sp_merge{};
+    if (is_merge_mode) {
+      auto merge_output_stream = output_compress::open(std::string{merge_output_file});
+      if (merge_output_stream == nullptr) {
+        LOG_ERROR(errfmt, merge_output_file.data(), strerror(errno));
+        return EXIT_FAILURE;
+      }
+      sp_merge_output_stream.reset(merge_output_stream);
+      sp_merge = std::make_unique<ordered_merge>(merge_output_stream, merge_key, merge_lookahead);
+      sp_merge->set_line_limit(limits.global_remaining);
+    }
+
+    // each input source is started as a child process that the stdout and stderr pipes are read from
+    struct input_source {
+      std::string name;          // the input as given on the command line
+      std::string output_file;
+      std::function<std::tuple<int, int>()> spawn;
+      uint64_t load;             // estimate of the input's size - to balance the shards
+      u_int weight{1};           // share of each scheduling round
+      uint64_t output_size{0};   // expected size of its stdout output, when known - its output file is preallocated
+    };
+    std::vector<input_source> input_sources{};
+    for(size_t k = 0; k < input_files.size(); k++) {
+      auto const input_file = input_files[k];
+      auto const sources_count = input_sources.size();
+      if (is_synthetic_input(input_file)) {
+        // a load generator child process stands in for gzip
+        synthetic_stream_spec spec{};
+        if (!parse_synthetic_spec(input_file, static_cast<int>(input_sources.size()), spec)) return EXIT_FAILURE;
+        auto name = spec.name;
+        auto const expected_size = spec.lines * ((spec.line_min + spec.line_max) / 2 + 1);
+        input_sources.push_back({name, name, [spec] { return get_synthetic_stream(spec); }, expected_size, 1,
+                                 expected_size});
+      } else if (stream_record::is_replay_input(input_file)) {
+        // each input of a recorded trace is replayed by its own child process
+        auto const sp_trace = stream_record::load_replay(input_file.substr(stream_record::replay_input_prefix.size()));
+        if (!sp_trace) return EXIT_FAILURE;
+        for(size_t i = 0; i < sp_trace->inputs.size(); i++) {
+          auto const &name = sp_trace->inputs[i].name;
+          uint64_t load = 0;
+          for(const auto &event : sp_trace->inputs[i].events) {
+            load += event.size;
           }
+          input_sources.push_back({name, name, [sp_trace, i] { return stream_record::get_replay_stream(sp_trace, i); },
+                                   load, 1, load});
         }
+      } else {
+        if (!valid_file(input_file)) return EXIT_FAILURE;
+        int offset;
+        if (!has_ending(input_file, ".gz", offset, __LINE__)) return EXIT_FAILURE;
+        struct stat st{};
+        input_sources.push_back({std::string{input_file},
+                                 std::string{input_file.substr(0, static_cast<unsigned long>(offset))},
+                                 [input_file] { return get_uncompressed_stream(input_file); },
+                                 stat(input_file.data(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0, 1,
+                                 get_uncompressed_size_hint(input_file)});
+      }
+      for(auto j = sources_count; j < input_sources.size(); j++) {
+        input_sources[j].weight = input_weights[k];
+      }
+    }
+
+    if (!record_file.empty() && !stream_record::start(record_file, record_data)) return EXIT_FAILURE;
+
+    if (!partition.prefix.empty()) {
+      uint64_t expected_size = 0;
+      for(const auto &input_source : input_sources) {
+        expected_size += input_source.output_size;
       }
+      if (!output_partition::start(partition, compress_suffix, expected_size)) return EXIT_FAILURE;
     }
 
-    fprintf(stderr, "DEBUG: using %u bytes as read buffer size\n", read_buf_size);
+    for(auto &input_source : input_sources) {
+      // in sharded mode an input goes to the least loaded shard, whose event loop alone then reads its streams
+      auto const shard = shards.empty() ? nullptr : least_loaded_shard(shards);
+      auto &input_rms = shard != nullptr ? shard->rms : rms;
+      auto &input_streams_map = shard != nullptr ? shard->output_streams_map : output_streams_map;
+      if (shard != nullptr) {
+        shard->load += input_source.load;
+      }
+      // the child process inherits the affinity to the shard's node - as does the memory first touched here
+      cpu_affinity::scoped_thread_cpus const input_affinity{shard != nullptr ? shard->placement.node_cpus
+                                                                             : std::vector<int>{}};
+      auto const fd_pair = input_source.spawn();
+      auto const &input_file = input_source.name;
+      auto &output_file = input_source.output_file;
+      auto const fd_stdout = std::get<0>(fd_pair);
+      auto const fd_stderr = std::get<1>(fd_pair);
+      if (fd_stdout == -1) return EXIT_FAILURE;
+      input_rms += std::make_tuple(fd_stdout, fd_stderr);
+      input_rms.set_weight(fd_stdout, input_source.weight);
+      input_rms.set_weight(fd_stderr, input_source.weight);
+      // an overlong line is written out in pieces rather than held whole - but the merge needs whole lines
+      if (!is_merge_mode) {
+        input_rms.get_mutable_read_buf_ctx(fd_stdout)->set_line_fragment_limit(flow.high_watermark);
+      }
+      input_rms.get_mutable_read_buf_ctx(fd_stderr)->set_line_fragment_limit(flow.high_watermark);
+      if (sample_rate < 1.0) {
+        auto const seed = static_cast<uint32_t>(fd_stdout) * 2654435761u; // reproducible per run
+        input_rms.get_mutable_read_buf_ctx(fd_stdout)->set_sample_rate(sample_rate, seed);
+      }
+
+      // the recording names an input per its output file - which is what its replay writes to
+      auto const record_input = stream_record::register_input(output_file);
+      if (record_input >= 0) {
+        input_rms.get_mutable_read_buf_ctx(fd_stdout)->set_record_stream(record_input * 2);
+        input_rms.get_mutable_read_buf_ctx(fd_stderr)->set_record_stream(record_input * 2 + 1);
+      }
 
-    bool is_ctrl_z_registered = false;
+      std::string output_err_file{output_file + ".err" + compress_suffix};
+
+      file_stream_unique_ptr sp_output_stream{nullptr, &fclose};
+      if (is_merge_mode) {
+        // the stdout context only accumulates line fragments - complete lines go to the merge output
+        LOG_INFO("output file: \"%s\" output error file: \"%s\"\n", merge_output_file.data(), output_err_file.c_str());
+        sp_merge->add_stream(fd_stdout, flow_ctl.add_stream(fd_stdout));
+        output_file = merge_output_file;
+      } else if (output_sink::is_enabled()) {
+        LOG_INFO("output sink: \"%s\" output error file: \"%s\"\n", sink_output.data(), output_err_file.c_str());
+        auto output_stream = output_sink::open_stream(input_file);
+        if (output_stream == nullptr) return EXIT_FAILURE;
+        sp_output_stream.reset(output_stream);
+        output_file = sink_output;
+      } else if (output_partition::is_enabled()) {
+        LOG_INFO("output partitions: \"%s-*\" output error file: \"%s\"\n", partition.prefix.c_str(),
+                 output_err_file.c_str());
+        auto output_stream = output_partition::open_stream();
+        if (output_stream == nullptr) return EXIT_FAILURE;
+        sp_output_stream.reset(output_stream);
+        output_file = partition.prefix;
+      } else {
+        output_file += compress_suffix;
+        if (output_file == input_file) {
+          output_file.insert(output_file.size() - compress_suffix.size(), ".out");
+        }
+        LOG_INFO("output file: \"%s\" output error file: \"%s\"\n", output_file.c_str(), output_err_file.c_str());
+        auto output_stream = output_compress::open(output_file, input_source.output_size);
+        if (output_stream == nullptr) {
+          LOG_ERROR(errfmt, output_file.c_str(), strerror(errno));
+          return EXIT_FAILURE;
+        }
+        sp_output_stream.reset(output_stream);
+      }
 
-    auto const result = read_on_ready(is_ctrl_z_registered, rms, output_streams_map);
+      auto output_err_stream = output_compress::open(output_err_file);
+      if (output_err_stream == nullptr) {
+        LOG_ERROR(errfmt, output_err_file.c_str(), strerror(errno));
+        return EXIT_FAILURE;
+      }
+      file_stream_unique_ptr sp_output_err_stream{output_err_stream, &fclose};
+
+      // per stream metrics are registered under the name of the input file
+      auto sp_stdout_stats = metrics::register_stream(input_file, false);
+      auto sp_stderr_stats = metrics::register_stream(input_file, true);
+      input_rms.get_mutable_read_buf_ctx(fd_stdout)->set_stats(sp_stdout_stats.get());
+      input_rms.get_mutable_read_buf_ctx(fd_stderr)->set_stats(sp_stderr_stats.get());
+
+      input_streams_map.insert(fd_stdout, std::make_unique<output_stream_context>(std::move(output_file),
+                                                                                  std::move(sp_output_stream),
+                                                                                  std::move(sp_stdout_stats)));
+      input_streams_map.insert(fd_stderr, std::make_unique<output_stream_context>(std::move(output_err_file),
+                                                                                  std::move(sp_output_err_stream),
+                                                                                  std::move(sp_stderr_stats)));
+    }
+
+    if (!stats_file.empty()) {
+      metrics::start_periodic_report(stats_file, stats_interval);
+    }
+
+    auto const result = is_merge_mode
+                        ? merge_on_ready(rms, output_streams_map, *sp_merge, limits.per_file, flow_ctl)
+                        : !shards.empty()
+                        ? shards_on_ready(shards, limits)
+                        : coro_threads > 0
+                        ? coro_on_ready(rms, output_streams_map, limits, coro_threads)
+                        : read_on_ready(rms, output_streams_map, limits);
     auto const ec = std::get<0>(result);
     auto const wr = std::get<1>(result);
     const std::string msg{write_result_str(wr)};
 
-    auto const rtn = ec == 0 || wr == WR::END_OF_FILE ? EXIT_SUCCESS : EXIT_FAILURE;
+    auto rtn = ec == 0 || wr == WR::END_OF_FILE || wr == WR::LIMIT_REACHED ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if (is_merge_mode) {
+      LOG_INFO("merged %ld lines into output file \"%s\"\n", sp_merge->get_lines_emitted(), merge_output_file.data());
+      // closed rather than just flushed - a compressed output is only written out in full once closed
+      if (fclose(sp_merge_output_stream.release()) != 0) {
+        LOG_ERROR("failed writing to output stream: %s\n", strerror(errno));
+        rtn = EXIT_FAILURE;
+      }
+    }
+    // the partition files are closed by the last of their streams when some are still open (cut short)
+    if (!output_partition::finish()) {
+      rtn = EXIT_FAILURE;
+    }
+    // the output files not yet closed were those of streams cut short - they are closed after this
+    // on the closing thread, while the compressed files closed so far have all been written
+    if (!output_compress::finish()) {
+      rtn = EXIT_FAILURE;
+    }
+    // likewise the sink: the lines of the streams closed after this are written on the closing thread
+    if (!output_sink::finish()) {
+      rtn = EXIT_FAILURE;
+    }
+
+    metrics::stop_periodic_report();
+    if (!stream_record::finish()) {
+      rtn = EXIT_FAILURE;
+    }
+    if (!tracing::finish()) {
+      rtn = EXIT_FAILURE;
+    }
+    if (!stats_file.empty()) {
+      metrics::write_json_report(stats_file.data());
+    }
+    if (!stats_json_file.empty() && !metrics::write_json_report(stats_json_file.data())) {
+      rtn = EXIT_FAILURE;
+    }
+    if (logging::enabled(logging::level::DEBUG)) {
+      metrics::log_report();
+    } else {
+      metrics::log_latency_report();
+    }
 
-    fprintf(stderr, "INFO: program exiting with status: [%d] %s\n", rtn, msg.c_str());
+    LOG_INFO("program exiting with status: [%d] %s\n", rtn, msg.c_str());
     return rtn;
   } catch(...) {
     const auto ex_nm = get_unmangled_name(abi::__cxa_current_exception_type()->name());
-    fprintf(stderr, "process %d terminating due to unhandled exception of type %s", getpid(), ex_nm.c_str());
+    LOG_ERROR("process %d terminating due to unhandled exception of type %s", getpid(), ex_nm.c_str());
     return EXIT_FAILURE;
   }
 }
 
-static read_multi_result read_on_ready(bool &is_ctrl_z_registered, read_multi_stream &rms,
-                                       output_streams_context_map_t &output_streams_map)
+/**
+ * Runs the poll cycle of the reactor: the handler of each ready stream is
+ * given its output stream context as user data, and dispatches reading the
+ * stream as an asynchronous task. The tasks' futures are harvested once all
+ * ready streams of a poll cycle have been dispatched.
+ */
+static read_multi_result read_on_ready(read_multi_stream &rms, output_streams_context_map_t &output_streams_map,
+                                       output_line_limits &limits)
 {
-  std::vector<pollfd_result> fds{};
   std::vector<std::future<write_result>> futures{};
+  std::vector<int> limited_fds{};
   WRITE_RESULT wr{WR::FAILURE};
   int rc{0};
+  bool is_init_failure = false;
 
-  while (rms.size() > 0 && !signal_handling::interrupted() && ((rc = rms.poll_for_io(fds)) == 0 || rc == EINTR)) {
-    futures.clear();
-    futures.reserve(fds.size());
-    for(const auto& pollfd : fds) {
-      const auto fd = pollfd.fd;
-      auto const prbc = rms.get_mutable_read_buf_ctx(fd);
-      assert(prbc != nullptr); // lookup should never dereference to a null pointer
-      if (prbc == nullptr) continue;
-      if (prbc->is_valid_init()) {
-        if (!is_ctrl_z_registered) { // a one-time-only initialization
-          const auto curr_thread = pthread_self();
-          signal_handling::register_ctrl_z_handler([curr_thread](int sig) -> void {
-//            fprintf(stderr, "DEBUG: << %s(sig: %d)\n", "signal_interrupt_thread", sig);
-            pthread_kill(curr_thread, sig);
-          });
-          is_ctrl_z_registered = true;
-        }
-        auto search = output_streams_map.find(fd); // look up the file descriptor to find its output stream context
-        if (search == output_streams_map.end()) {
-          fputs("WARN: a ready-to-read file descriptor failed to dereference an output context - skipping\n", stderr);
-          continue;
-        }
-        auto output_stream_ctx = search->second;
-        std::function<std::tuple<int, int, WRITE_RESULT>()> write_output_task_callback = [fd, prbc, output_stream_ctx] {
-          auto const output_stream = output_stream_ctx->output_stream.get();
-          auto &input_line = output_stream_ctx->output_stream_line;
-          auto &str_buf = output_stream_ctx->output_str_buf;
-          // the writer callback accepts line of text and writes it to output stream;
-          // however, could do application logic processing on text line here as well
-          return write_to_output_stream(fd, *prbc, output_stream, input_line, str_buf,
-                                        [](FILE *os, std::string_view str, std::string_view nl) -> int {
-                                          auto rc2 = fputs(str.data(), os);
-                                          if (rc2 != -1 && !nl.empty()) {
-                                            rc2 = fputs(nl.data(), os);
-                                          }
-                                          return rc2;
-                                        });
-        };
-        // will invoke write to the output stream context in an asynchronous manner, using a future to get the outcome
-        futures.emplace_back(std::async(std::launch::async, std::move(write_output_task_callback)));
-      } else {
-        // A failed initialization detected for the read_buf_ctx (the input source), so remove
-        // dereference key for the input and output stream context items per this file descriptor
-        rms.remove(fd); // input context
-        output_streams_map.erase(fd); // output context
-        fputs("ERROR: initialization failure of read_buf_ctx object", stderr);
-        rc = EXIT_FAILURE;
-        break;
-      }
+  const stream_handler_t on_ready = [&](read_buf_ctx &rbc, const stream_event &event) {
+    const auto fd = event.fd;
+    if (is_init_failure) return; // the rest of this poll cycle is skipped
+    if (!rbc.is_valid_init()) {
+      // A failed initialization detected for the read_buf_ctx (the input source), so remove
+      // the input and output stream context items per this file descriptor
+      rms.remove(fd); // input context
+      output_streams_map.erase(fd); // output context
+      LOG_ERROR("initialization failure of read_buf_ctx object");
+      rc = EXIT_FAILURE;
+      is_init_failure = true;
+      return;
     }
+    auto const prbc = &rbc;
+    auto const output_stream_ctx = static_cast<output_stream_context*>(event.user_data);
+    auto const plimits = prbc->is_stderr_stream() ? nullptr : &limits;
+    auto const ready_ns = event.ready_ns;
+    // will invoke write to the output stream context in an asynchronous manner, using a future to get the outcome
+    // (the lambda is handed to std::async as is - wrapped in a std::function it would be a heap allocation more)
+    futures.emplace_back(std::async(std::launch::async, [fd, prbc, output_stream_ctx, plimits, ready_ns] {
+      metrics::local().poll_to_task.record(metrics::now_ns() - ready_ns);
+      // the writer callback accepts line of text and writes it to output stream;
+      // however, could do application logic processing on text line here as well
+      return write_to_output_stream(fd, *prbc, *output_stream_ctx, write_text_line, plimits);
+    }));
+  };
+
+  const cycle_callback_t on_cycle_end = [&]() -> bool {
+    is_init_failure = false;
     // obtain results from all the async futures
+    limited_fds.clear();
     for(auto &fut : futures) {
       auto [rtn_fd, rtn_rc, rtn_wr] = fut.get();
-      if (rtn_rc != EXIT_SUCCESS) {
+      if (rtn_wr == WR::LIMIT_REACHED) {
+        rc = rtn_rc;
+        wr = rtn_wr;
+        limited_fds.push_back(rtn_fd); // the paired stderr stream may have a task in this batch, so defer
+      } else if (rtn_rc != EXIT_SUCCESS) {
         rc = rtn_rc;
         wr = rtn_wr;
         // removed dereference key for output context per this file descriptor
@@ -301,6 +898,24 @@ static read_multi_result read_on_ready(bool &is_ctrl_z_registered, read_multi_st
         output_streams_map.erase(rtn_fd);
       }
     }
+    futures.clear();
+    if (limits.global_exhausted()) {
+      terminate_all_child_processes();
+      return false;
+    }
+    for(const auto fd : limited_fds) {
+      stop_input_stream(fd, rms, output_streams_map);
+    }
+    return true;
+  };
+
+  for(const auto &[fd, sp_output_stream_ctx] : output_streams_map) {
+    rms.set_handler(fd, on_ready, sp_output_stream_ctx.get());
+  }
+
+  auto const poll_rc = rms.run_until_idle(on_cycle_end);
+  if (poll_rc != 0) {
+    rc = poll_rc;
   }
 
   if (rc == EXIT_SUCCESS) {
@@ -309,31 +924,480 @@ static read_multi_result read_on_ready(bool &is_ctrl_z_registered, read_multi_st
   return std::make_tuple(rc, wr);
 }
 
+/**
+ * Runs the poll cycle for merge mode. Both stdout and stderr streams are read
+ * on the calling thread: the merge output is a single serialized stream anyway,
+ * and the decompression work itself proceeds in parallel in the gzip children.
+ *
+ * Complete stdout lines are queued to the ordered merge (never more than its
+ * lookahead limit per stream), and whenever some stream is starved - nothing
+ * buffered and not at end-of-file - only the starved streams (plus stderr
+ * streams) are polled, as nothing can be emitted until they produce a line.
+ * Flow control additionally pauses streams holding too many bytes of queued
+ * lines (a starved stream holds none, so is never paused).
+ */
+static read_multi_result merge_on_ready(read_multi_stream &rms, output_streams_context_map_t &output_streams_map,
+                                        ordered_merge &merge, long const per_file_limit, flow_controller &flow_ctl)
+{
+  WRITE_RESULT wr{WR::FAILURE};
+  int rc{0};
+  bool is_done = false;
+
+  const poll_filter_t poll_filter = [&merge](int fd) -> bool {
+    if (!merge.has_stream(fd)) return true; // a stderr stream
+    return merge.any_starved() ? merge.is_starved(fd) : merge.wants_input(fd);
+  };
+
+  const stream_handler_t on_ready = [&](read_buf_ctx &rbc, const stream_event &event) {
+    const auto fd = event.fd;
+    if (is_done) return;
+    metrics::local().poll_to_task.record(metrics::now_ns() - event.ready_ns);
+    auto &output_stream_ctx = *static_cast<output_stream_context*>(event.user_data);
+    if (!rbc.is_valid_init()) {
+      rms.remove(fd);
+      output_streams_map.erase(fd);
+      LOG_ERROR("initialization failure of read_buf_ctx object");
+      rc = EXIT_FAILURE;
+      is_done = true;
+      return;
+    }
+
+    if (rbc.is_stderr_stream()) {
+      auto [rtn_fd, rtn_rc, rtn_wr] = write_to_output_stream(fd, rbc, output_stream_ctx, write_text_line);
+      if (rtn_rc != EXIT_SUCCESS) {
+        rc = rtn_rc;
+        wr = rtn_wr;
+        rms.remove(rtn_fd);
+        output_streams_map.erase(rtn_fd);
+      }
+      return;
+    }
+
+    // the context's string buffer holds any line fragment carried over from a prior poll cycle
+    auto &str_buf = output_stream_ctx.output_str_buf;
+    auto const bytes_mark = rbc.get_bytes_read();
+    auto const lines_mark = rbc.get_lines_read();
+    while (merge.wants_input(fd)) {
+      const auto rtn_rc = rbc.read_line(str_buf);
+      if (rtn_rc == EXIT_SUCCESS) {
+        if (per_file_limit != 0) {
+          merge.push_line(fd, std::move(str_buf));
+          str_buf.clear();
+          output_stream_ctx.output_stream_line++;
+        }
+        if (per_file_limit >= 0 && output_stream_ctx.output_stream_line > per_file_limit) {
+          merge.mark_eof(fd);
+          stop_input_stream(fd, rms, output_streams_map);
+          break;
+        }
+        if ((event.budget.bytes > 0 && rbc.get_bytes_read() - bytes_mark >= event.budget.bytes) ||
+            (event.budget.lines > 0 && rbc.get_lines_read() - lines_mark >= event.budget.lines))
+        {
+          break; // the rest of the input is read in a later round
+        }
+        continue;
+      }
+      if (rtn_rc == EOF || rtn_rc == EXIT_FAILURE) {
+        if (!str_buf.empty()) {
+          merge.push_line(fd, std::move(str_buf)); // last line of input was not newline terminated
+          str_buf.clear();
+        }
+        merge.mark_eof(fd);
+        rc = rtn_rc;
+        wr = rtn_rc == EOF ? WR::END_OF_FILE : WR::FAILURE;
+        rms.remove(fd);
+        output_streams_map.erase(fd);
+      }
+      break; // EAGAIN or EINTR - wait on the next poll cycle
+    }
+  };
+
+  const cycle_callback_t on_cycle_end = [&]() -> bool {
+    if (is_done) return false;
+    if (merge.emit_ready() != EXIT_SUCCESS) {
+      rc = EXIT_FAILURE;
+      wr = WR::FAILURE;
+      is_done = true;
+      return false;
+    }
+    if (merge.line_limit_reached()) {
+      terminate_all_child_processes();
+      rc = EOF;
+      wr = WR::LIMIT_REACHED;
+      is_done = true;
+      return false;
+    }
+    flow_ctl.apply(rms); // the lines just emitted may let paused streams resume
+    return true;
+  };
+
+  for(const auto &[fd, sp_output_stream_ctx] : output_streams_map) {
+    rms.set_handler(fd, on_ready, sp_output_stream_ctx.get());
+  }
+
+  auto const poll_rc = rms.run_until_idle(on_cycle_end, poll_filter);
+  if (is_done) {
+    return std::make_tuple(rc, wr);
+  }
+  if (poll_rc != 0) {
+    rc = poll_rc;
+  }
+
+  if (rc == EXIT_SUCCESS) {
+    wr = WR::SUCCESS;
+  }
+  return std::make_tuple(rc, wr);
+}
+
+/**
+ * The coroutine that processes an input stream in coroutine mode: batches of
+ * lines are written to the stream's output, flushing once per batch. The
+ * pieces of an overlong line are written as they come.
+ *
+ * @return EXIT_SUCCESS at end of input, EOF when stopped by a line limit, or
+ * EXIT_FAILURE (or EINTR) otherwise
+ */
+static stream_task write_output_lines(line_stream &strm, output_stream_context &output_stream_ctx,
+                                      output_line_limits *const limits)
+{
+  FILE *const output_stream = output_stream_ctx.output_stream.get();
+  auto const stats = output_stream_ctx.stats.get();
+  int status = EXIT_SUCCESS;
+  for(;;) {
+    auto const [rc, lines] = co_await strm.next_batch();
+    if (rc != EXIT_SUCCESS && rc != E2BIG) {
+      co_return rc == EOF ? EXIT_SUCCESS : rc;
+    }
+    bool const is_piece = rc == E2BIG;
+    // the coroutine may be resumed on a different pool thread after every await
+    auto &counters = metrics::local();
+    metrics::scoped_timer task_timer{counters.task_duration};
+    uint64_t bytes = 0;
+    for(const auto line : lines) {
+      if (limits != nullptr && !output_stream_ctx.is_line_spilled &&
+          !limits->try_acquire_line(output_stream_ctx.output_stream_line - 1))
+      {
+        status = EOF;
+        break;
+      }
+      if (write_text_line(output_stream, line, is_piece ? "" : "\n") == -1) {
+        LOG_ERROR("failed writing to output stream: %s\n", strerror(errno));
+        status = EXIT_FAILURE;
+        break;
+      }
+      if (is_piece) {
+        output_stream_ctx.is_line_spilled = true;
+        counters.line_spills.add(1);
+        bytes += line.size();
+      } else {
+        output_stream_ctx.is_line_spilled = false;
+        output_stream_ctx.output_stream_line++;
+        bytes += line.size() + 1;
+      }
+    }
+    int flush_rc;
+    {
+      metrics::scoped_timer flush_timer{counters.flush_latency};
+      flush_rc = fflush(output_stream);
+    }
+    counters.output_bytes.add(bytes);
+    counters.flushes.add(1);
+    if (stats != nullptr) {
+      stats->output_bytes.add(bytes);
+      stats->flushes.add(1);
+    }
+    if (flush_rc != 0) {
+      LOG_ERROR("failed writing to output stream: %s\n", strerror(errno));
+      status = EXIT_FAILURE;
+    }
+    if (status != EXIT_SUCCESS) {
+      co_return status;
+    }
+  }
+}
+
+/**
+ * Runs the streams as coroutines (see stream-coro.h) resumed on a pool of
+ * threads - an alternative to the std::async dispatch of read_on_ready().
+ */
+static read_multi_result coro_on_ready(read_multi_stream &rms, output_streams_context_map_t &output_streams_map,
+                                       output_line_limits &limits, unsigned const thread_count)
+{
+  WRITE_RESULT wr{WR::FAILURE};
+  int rc{0};
+
+  coro_scheduler scheduler{rms, thread_count};
+  for(const auto &[fd, sp_output_stream_ctx] : output_streams_map) {
+    auto const prbc = rms.get_read_buf_ctx(fd);
+    auto const plimits = prbc != nullptr && prbc->is_stderr_stream() ? nullptr : &limits;
+    scheduler.spawn(fd, [plimits](line_stream &strm) {
+      return write_output_lines(strm, *static_cast<output_stream_context*>(strm.get_user_data()), plimits);
+    }, sp_output_stream_ctx.get());
+  }
+
+  const stream_done_callback_t on_done = [&](int fd, int rtn_rc) -> bool {
+    if (rtn_rc == EOF) { // a line limit was reached
+      rc = EOF;
+      wr = WR::LIMIT_REACHED;
+      if (limits.global_exhausted()) {
+        terminate_all_child_processes();
+        return false;
+      }
+      auto const paired_fd = rms.get_paired_fd(fd);
+      terminate_child_process(fd);
+      if (paired_fd != -1) {
+        scheduler.stop_stream(paired_fd);
+        output_streams_map.erase(paired_fd);
+      }
+    } else if (rtn_rc != EXIT_SUCCESS) {
+      rc = rtn_rc;
+      wr = rtn_rc == EINTR ? WR::INTERRUPTED : WR::FAILURE;
+    }
+    output_streams_map.erase(fd);
+    return true;
+  };
+
+  auto const poll_rc = scheduler.run(on_done);
+  if (poll_rc != 0) {
+    rc = poll_rc;
+  }
+
+  if (rc == EXIT_SUCCESS) {
+    wr = WR::SUCCESS;
+  }
+  return std::make_tuple(rc, wr);
+}
+
+/**
+ * Runs the poll cycle of a shard's event loop, on the shard's own thread. The
+ * handler of each ready stream reads the stream inline - until its input is
+ * drained - writing the lines to its output and flushing once.
+ */
+static read_multi_result shard_on_ready(event_loop_shard &shard, output_line_limits &limits) {
+  auto &rms = shard.rms;
+  auto &output_streams_map = shard.output_streams_map;
+  WRITE_RESULT wr{WR::FAILURE};
+  int rc{0};
+  bool is_done = false;
+
+  const stream_handler_t on_ready = [&](read_buf_ctx &rbc, const stream_event &event) {
+    const auto fd = event.fd;
+    if (is_done) return;
+    metrics::local().poll_to_task.record(metrics::now_ns() - event.ready_ns);
+    if (!rbc.is_valid_init()) {
+      rms.remove(fd);
+      output_streams_map.erase(fd);
+      LOG_ERROR("initialization failure of read_buf_ctx object");
+      rc = EXIT_FAILURE;
+      is_done = true;
+      return;
+    }
+    auto &output_stream_ctx = *static_cast<output_stream_context*>(event.user_data);
+    auto const plimits = rbc.is_stderr_stream() ? nullptr : &limits;
+    auto [rtn_fd, rtn_rc, rtn_wr] = write_to_output_stream(fd, rbc, output_stream_ctx, write_text_line, plimits,
+                                                           true, event.budget);
+    if (rtn_wr == WR::LIMIT_REACHED) {
+      rc = rtn_rc;
+      wr = rtn_wr;
+      stop_input_stream(rtn_fd, rms, output_streams_map); // its stderr stream is skipped should it be pending too
+    } else if (rtn_rc != EXIT_SUCCESS) {
+      rc = rtn_rc;
+      wr = rtn_wr;
+      rms.remove(rtn_fd);
+      output_streams_map.erase(rtn_fd);
+    }
+  };
+
+  const cycle_callback_t on_cycle_end = [&]() -> bool {
+    if (is_done) return false;
+    if (limits.global_exhausted()) {
+      terminate_all_child_processes(); // the other shards see their streams end
+      return false;
+    }
+    return true;
+  };
+
+  for(const auto &[fd, sp_output_stream_ctx] : output_streams_map) {
+    rms.set_handler(fd, on_ready, sp_output_stream_ctx.get());
+  }
+
+  auto const poll_rc = rms.run_until_idle(on_cycle_end);
+  if (poll_rc != 0) {
+    rc = poll_rc;
+  }
+
+  if (rc == EXIT_SUCCESS) {
+    wr = WR::SUCCESS;
+  }
+  return std::make_tuple(rc, wr);
+}
+
+/**
+ * Runs the event loop of each shard on a thread of its own and waits for them
+ * all to finish. A failure of any shard is the outcome, else a line limit
+ * having been reached, else success.
+ */
+static read_multi_result shards_on_ready(event_loop_shards_t &shards, output_line_limits &limits) {
+  std::vector<read_multi_result> results(shards.size(), std::make_tuple(EXIT_FAILURE, WR::FAILURE));
+  std::vector<std::thread> threads{};
+  threads.reserve(shards.size());
+  for(auto &sp_shard : shards) {
+    auto &shard = *sp_shard;
+    LOG_DEBUG("event loop shard %u: %lu streams, load %lu, cpu %d (node %d)\n", shard.index,
+              shard.output_streams_map.size(), shard.load, shard.placement.cpu, shard.placement.node);
+    threads.emplace_back([&shard, &limits, &result = results[shard.index]] {
+      tracing::set_thread_name("event loop shard " + std::to_string(shard.index));
+      if (shard.placement.cpu != -1) {
+        cpu_affinity::set_thread_cpus({shard.placement.cpu});
+      }
+      try {
+        result = shard_on_ready(shard, limits);
+      } catch(...) {
+        const auto ex_nm = get_unmangled_name(abi::__cxa_current_exception_type()->name());
+        LOG_ERROR("event loop shard %u terminated by unhandled exception of type %s\n", shard.index, ex_nm.c_str());
+      }
+    });
+  }
+  for(auto &thrd : threads) {
+    thrd.join();
+  }
+
+  read_multi_result outcome{EXIT_SUCCESS, WR::SUCCESS};
+  for(const auto &result : results) {
+    auto const [rc, wr] = result;
+    if (rc == EXIT_SUCCESS || wr == WR::END_OF_FILE) continue;
+    if (wr != WR::LIMIT_REACHED) return result;
+    outcome = result;
+  }
+  return outcome;
+}
+
+static event_loop_shard* least_loaded_shard(const event_loop_shards_t &shards) {
+  event_loop_shard *least = shards.front().get();
+  for(const auto &sp_shard : shards) {
+    // ties go to the shard with the fewest streams, so inputs of no known size are spread evenly
+    if (sp_shard->load < least->load ||
+        (sp_shard->load == least->load && sp_shard->output_streams_map.size() < least->output_streams_map.size()))
+    {
+      least = sp_shard.get();
+    }
+  }
+  return least;
+}
+
+/**
+ * Reads a line of input from the stream and writes it to its output stream,
+ * flushing the output. When draining, lines are read and written until the
+ * input is drained (EAGAIN) or the budget of input is consumed, and the
+ * output is flushed once for them all.
+ */
 static write_result write_to_output_stream(int fd, read_buf_ctx &rbc,
-                                           FILE *const output_stream,
-                                           long &input_line,
-                                           std::string &str_buf,
-                                           const write_to_output_callback &writer)
+                                           output_stream_context &output_stream_ctx,
+                                           const write_to_output_callback &writer,
+                                           output_line_limits *const limits,
+                                           bool const is_drain, stream_quantum const budget)
 {
   WRITE_RESULT wr{WR::NO_OP};
+  auto &counters = metrics::local();
+  metrics::scoped_timer task_timer{counters.task_duration};
+  FILE *const output_stream = output_stream_ctx.output_stream.get();
+  long &input_line = output_stream_ctx.output_stream_line;
+  std::string &str_buf = output_stream_ctx.output_str_buf;
+  auto const stats = output_stream_ctx.stats.get();
 
   auto const check_output_io = [&wr](int rc) -> bool {
     if (rc == -1) {
-      fprintf(stderr,"ERROR: failed writing to output stream: [%d] %s\n", rc, strerror(errno));
+      LOG_ERROR("failed writing to output stream: [%d] %s\n", rc, strerror(errno));
       wr = WR::FAILURE;
       return false;
     }
     return true;
   };
 
+  auto const count_output = [&counters, stats](uint64_t bytes, bool flushed) {
+    counters.output_bytes.add(bytes);
+    counters.flushes.add(flushed ? 1 : 0);
+    if (stats != nullptr) {
+      stats->output_bytes.add(bytes);
+      stats->flushes.add(flushed ? 1 : 0);
+    }
+  };
+
+  // traced as a span noting the fd and the bytes and lines read from it by this task
+  struct task_trace {
+    tracing::span span{"read task", "task"};
+    const metrics::stream_stats *const stats;
+    const uint64_t bytes_read, lines;
+    task_trace(int fd, const metrics::stream_stats *stats)
+        : stats{span.is_active() ? stats : nullptr},
+          bytes_read{this->stats != nullptr ? stats->bytes_read.get() : 0},
+          lines{this->stats != nullptr ? stats->lines.get() : 0}
+    {
+      span.arg("fd", fd);
+    }
+    ~task_trace() {
+      if (stats == nullptr) return;
+      span.arg("bytes", static_cast<int64_t>(stats->bytes_read.get() - bytes_read));
+      span.arg("lines", static_cast<int64_t>(stats->lines.get() - lines));
+    }
+  } const task_trace{fd, stats};
+
+  auto const timed_flush = [&counters, output_stream]() -> int {
+    metrics::scoped_timer flush_timer{counters.flush_latency};
+    return fflush(output_stream);
+  };
+
   bool is_eintr;
   int rc;
+  bool is_written = false; // lines written by this call (when draining) that are not yet flushed
+  auto const bytes_mark = rbc.get_bytes_read();
+  auto const lines_mark = rbc.get_lines_read();
+  auto const is_budget_spent = [&]() -> bool {
+    return (budget.bytes > 0 && rbc.get_bytes_read() - bytes_mark >= budget.bytes) ||
+           (budget.lines > 0 && rbc.get_lines_read() - lines_mark >= budget.lines);
+  };
 
   while (!(is_eintr = signal_handling::interrupted())) {
-    fprintf(stderr, "DEBUG: string buffer capacity: %lu, string length: %lu\nDEBUG: read line (%05lu) of input:\n",
-            str_buf.capacity(), str_buf.length(), input_line);
-    str_buf.clear();
-    rc = rbc.read_line(str_buf);
+    LOG_TRACE("string buffer capacity: %lu, string length: %lu\n", str_buf.capacity(), str_buf.length());
+    LOG_TRACE("read line (%05lu) of input:\n", input_line);
+    rc = rbc.read_line(str_buf); // appends to any line fragment carried over from a prior call
+    if (rc == EAGAIN) {
+      // input drained mid-line - the fragment stays in the string buffer until the rest of the line arrives
+      if (is_written) break;
+      return std::make_tuple(fd, EXIT_SUCCESS, WR::NO_OP);
+    }
+    bool const is_line_end = rc == EXIT_SUCCESS || (rc == EOF && (!str_buf.empty() || output_stream_ctx.is_line_spilled));
+    if (limits != nullptr && (is_line_end || rc == E2BIG) && !output_stream_ctx.is_line_spilled &&
+        !limits->try_acquire_line(input_line - 1))
+    {
+      str_buf.clear();
+      return std::make_tuple(fd, EOF, WR::LIMIT_REACHED);
+    }
+    if (rc == E2BIG) {
+      // an overlong line - write out what has been read of it so far, holding back a trailing CR
+      // (which is dropped should the LF of a CRLF end-of-line come next)
+      bool const is_cr_held = str_buf.back() == '\r';
+      if (is_cr_held) {
+        str_buf.pop_back();
+      }
+      auto const rc2 = writer(output_stream, str_buf, "");
+      auto const bytes = str_buf.size();
+      str_buf.clear();
+      if (is_cr_held) {
+        str_buf.push_back('\r');
+      }
+      output_stream_ctx.is_line_spilled = true;
+      if (!check_output_io(rc2)) {
+        timed_flush();
+        return std::make_tuple(fd, EXIT_FAILURE, wr);
+      }
+      count_output(bytes, false);
+      counters.line_spills.add(1);
+      continue;
+    }
+    if (is_line_end) {
+      output_stream_ctx.is_line_spilled = false;
+    }
     if (rc != EXIT_SUCCESS) {
       const char* nl = "";
       switch(rc) {
@@ -342,7 +1406,7 @@ static write_result write_to_output_stream(int fd, read_buf_ctx &rbc,
           break;
         case EINTR:
           wr = WR::INTERRUPTED;
-          fprintf(stderr, "INFO: read-input thread interrupted; status: [%d] %s\n", rc, strerror(rc));
+          LOG_INFO("read-input thread interrupted; status: [%d] %s\n", rc, strerror(rc));
           continue;
         case EOF:
           wr = WR::END_OF_FILE;
@@ -351,11 +1415,14 @@ static write_result write_to_output_stream(int fd, read_buf_ctx &rbc,
         default:
           wr = WR::NO_OP;
       }
-      if (!str_buf.empty()) {
+      if (!str_buf.empty() || (rc == EOF && is_line_end)) {
         auto rc2 = writer(output_stream, str_buf, nl); // write to output whatever is in string buffer
+        auto const bytes = str_buf.size() + strlen(nl);
+        str_buf.clear();
         if (check_output_io(rc2)) {
-          rc2 = fflush(output_stream); // flushing output because reached end-of-file, was interrupted, or input failure
+          rc2 = timed_flush(); // flushing output because reached end-of-file, was interrupted, or input failure
           check_output_io(rc2);
+          count_output(bytes, true);
         }
         if (rc == EOF && rc2 == -1) {
           rc = EXIT_FAILURE;
@@ -364,26 +1431,57 @@ static write_result write_to_output_stream(int fd, read_buf_ctx &rbc,
       return std::make_tuple(fd, rc, wr);
     }
     rc = writer(output_stream, str_buf, "\n"); // write string buffer as a line of text to output stream
+    auto const bytes = str_buf.size() + 1;
+    str_buf.clear();
     if (check_output_io(rc)) {
       input_line++;
+      count_output(bytes, false);
     } else {
-      fflush(output_stream); // encountered error condition writing to output, but still making attempt to flush output
+      timed_flush(); // encountered error condition writing to output, but still making attempt to flush output
       return std::make_tuple(fd, EXIT_FAILURE, wr);
     }
-    break;
+    if (!is_drain) break;
+    is_written = true;
+    if (is_budget_spent()) break; // the rest of the input is read in a later round
   }
-  rc = fflush(output_stream); // flushing output because just wrote a full text line
+  rc = timed_flush(); // flushing output because just wrote a full text line
   rc = check_output_io(rc) ? EXIT_SUCCESS : EXIT_FAILURE;
+  count_output(0, true);
   if (is_eintr) {
-    fputs("DEBUG: breaking out of read-line input loop due to interrupt signal\n", stderr);
+    LOG_DEBUG("breaking out of read-line input loop due to interrupt signal\n");
   }
   return std::make_tuple(fd, rc, wr);
 }
 
+/**
+ * Shuts down an input file early: its gzip child process is terminated and
+ * both its stdout and stderr streams are removed from further processing.
+ *
+ * @param fd the stdout stream file descriptor of the input
+ */
+static void stop_input_stream(int const fd, read_multi_stream &rms, output_streams_context_map_t &output_streams_map) {
+  auto const paired_fd = rms.get_paired_fd(fd);
+  terminate_child_process(fd);
+  rms.remove(fd);
+  output_streams_map.erase(fd);
+  if (paired_fd != -1) {
+    rms.remove(paired_fd);
+    output_streams_map.erase(paired_fd);
+  }
+}
+
+static int write_text_line(FILE *os, std::string_view str, std::string_view nl) {
+  auto rc2 = fputs(str.data(), os);
+  if (rc2 != -1 && !nl.empty()) {
+    rc2 = fputs(nl.data(), os);
+  }
+  return rc2;
+}
+
 /*
 static void do_on_exit() {
   extern void test();
   test();
-  fputs("DEBUG: call to test completed\n", stderr);
+  LOG_DEBUG("call to test completed\n");
 }
 */
\ No newline at end of file
@@ -0,0 +1,144 @@
+/* merge-streams.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <cerrno>
+#include "logging.h"
+#include "metrics.h"
+#include "merge-streams.h"
+
+std::string_view extract_merge_key(std::string_view line, const merge_key_spec &spec) {
+  if (spec.field <= 0) return line;
+  size_t start = 0;
+  for(int i = 1; i < spec.field; i++) {
+    auto const pos = line.find(spec.delim, start);
+    if (pos == std::string_view::npos) return {}; // line has fewer fields - sorts first
+    start = pos + 1;
+  }
+  auto const end = line.find(spec.delim, start);
+  return line.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start);
+}
+
+ordered_merge::ordered_merge(FILE * const output_stream, merge_key_spec key_spec, size_t const lookahead_limit)
+    : output_stream{output_stream}, key_spec{key_spec}, lookahead_limit{std::max<size_t>(lookahead_limit, 1)}
+{
+}
+
+void ordered_merge::add_stream(int const fd, stream_flow * const flow) {
+  assert(!has_stream(fd));
+  fd_index.emplace(fd, streams.size());
+  streams.push_back(stream_lookahead{fd});
+  streams.back().flow = flow;
+  starved_count++; // a new stream has nothing buffered yet
+}
+
+bool ordered_merge::wants_input(int const fd) const {
+  auto const search = fd_index.find(fd);
+  if (search == fd_index.end()) return false;
+  auto const &strm = streams[search->second];
+  return !strm.eof && strm.lines.size() < lookahead_limit;
+}
+
+bool ordered_merge::is_starved(int const fd) const {
+  auto const search = fd_index.find(fd);
+  if (search == fd_index.end()) return false;
+  auto const &strm = streams[search->second];
+  return !strm.eof && strm.lines.empty();
+}
+
+void ordered_merge::push_line(int const fd, std::string &&line) {
+  auto const idx = fd_index.at(fd);
+  auto &strm = streams[idx];
+  strm.lines.push_back(std::move(line));
+  if (strm.flow != nullptr) {
+    strm.flow->charge(strm.lines.back().size());
+  }
+  if (strm.lines.size() == 1) {
+    // deque::push_back() does not relocate existing elements, so a key view into the front line stays valid
+    strm.front_key = extract_merge_key(strm.lines.front(), key_spec);
+    heap_push(idx);
+    if (!strm.eof) {
+      starved_count--;
+    }
+  }
+}
+
+void ordered_merge::mark_eof(int const fd) {
+  auto &strm = streams[fd_index.at(fd)];
+  if (strm.eof) return;
+  strm.eof = true;
+  if (strm.lines.empty()) {
+    starved_count--;
+  }
+}
+
+/**
+ * Writes lines to the output stream, in key order, for as long as it is safe
+ * to do so - i.e., every live stream has a line in its lookahead queue - or
+ * until the line limit (if any) has been reached.
+ *
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if writing to the output stream failed
+ */
+int ordered_merge::emit_ready() {
+  while (starved_count == 0 && !heap.empty() && !line_limit_reached()) {
+    auto const idx = heap_pop();
+    auto &strm = streams[idx];
+    auto const &line = strm.lines.front();
+    if (fwrite(line.data(), 1, line.size(), output_stream) != line.size() || fputc('\n', output_stream) == EOF) {
+      LOG_ERROR("%d: %s() -> fwrite(): %s\n", __LINE__, __FUNCTION__, strerror(errno));
+      return EXIT_FAILURE;
+    }
+    lines_emitted++;
+    metrics::local().output_bytes.add(line.size() + 1);
+    if (strm.flow != nullptr) {
+      strm.flow->discharge(line.size());
+    }
+    strm.lines.pop_front();
+    if (!strm.lines.empty()) {
+      strm.front_key = extract_merge_key(strm.lines.front(), key_spec);
+      heap_push(idx);
+    } else {
+      strm.front_key = {};
+      if (!strm.eof) {
+        starved_count++; // must hear from this stream again before anything more can be emitted
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+bool ordered_merge::heap_less(size_t const lhs, size_t const rhs) const {
+  auto const cmp = streams[lhs].front_key.compare(streams[rhs].front_key);
+  return cmp != 0 ? cmp < 0 : lhs < rhs; // ties go to the stream given first on the command line
+}
+
+void ordered_merge::heap_push(size_t const idx) {
+  heap.push_back(idx);
+  // std heap algorithms maintain a max-heap, so invert the comparison to keep the smallest key on top
+  std::push_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return heap_less(b, a); });
+}
+
+size_t ordered_merge::heap_pop() {
+  std::pop_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return heap_less(b, a); });
+  auto const idx = heap.back();
+  heap.pop_back();
+  return idx;
+}
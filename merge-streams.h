@@ -0,0 +1,97 @@
+/* merge-streams.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef MERGE_STREAMS_H
+#define MERGE_STREAMS_H
+
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "flow-control.h"
+
+size_t const default_merge_lookahead = 256;
+
+/**
+ * Describes how the ordering key is extracted from a text line. Lines are
+ * split on the delimiter character and the key is the field at the given
+ * (1-based) position; a field position of 0 means the entire line is the key.
+ * Keys are compared as byte strings, so timestamps should be in a sortable
+ * representation (ISO 8601, zero-padded epoch, etc).
+ */
+struct merge_key_spec {
+  char delim{' '};
+  int field{0};
+};
+
+std::string_view extract_merge_key(std::string_view line, const merge_key_spec &spec);
+
+/**
+ * Performs a k-way ordered merge of text lines arriving from multiple input
+ * streams, each of which is assumed to already be sorted per the merge key.
+ *
+ * Each stream has a bounded lookahead queue of lines. A line can only be
+ * emitted once every stream that has not reached end-of-file has at least
+ * one line buffered, as otherwise a not yet read line could sort before it.
+ * Streams that are live but have nothing buffered are "starved" - the caller
+ * should poll those preferentially (see wants_input() and any_starved()).
+ */
+class ordered_merge final {
+  struct stream_lookahead {
+    int fd;
+    std::deque<std::string> lines{};
+    std::string_view front_key{};
+    bool eof{false};
+    stream_flow *flow{nullptr}; // charged with the bytes of the lines queued
+  };
+  FILE * const output_stream;
+  const merge_key_spec key_spec;
+  const size_t lookahead_limit;
+  std::vector<stream_lookahead> streams{};
+  std::unordered_map<int, size_t> fd_index{};
+  std::vector<size_t> heap{}; // indexes of streams having a buffered line, ordered by front_key
+  size_t starved_count{0};
+  long lines_emitted{0};
+  long line_limit{-1}; // -1 means no limit
+public:
+  ordered_merge(FILE *output_stream, merge_key_spec key_spec, size_t lookahead_limit = default_merge_lookahead);
+  ordered_merge(const ordered_merge &) = delete;
+  ordered_merge& operator=(const ordered_merge &) = delete;
+  ~ordered_merge() = default;
+  void add_stream(int fd, stream_flow *flow = nullptr);
+  bool has_stream(int fd) const { return fd_index.find(fd) != fd_index.end(); }
+  bool wants_input(int fd) const;
+  bool is_starved(int fd) const;
+  bool any_starved() const { return starved_count > 0; }
+  void push_line(int fd, std::string &&line);
+  void mark_eof(int fd);
+  int emit_ready();
+  bool done() const { return heap.empty() && starved_count == 0; }
+  long get_lines_emitted() const { return lines_emitted; }
+  void set_line_limit(long limit) { line_limit = limit; }
+  bool line_limit_reached() const { return line_limit >= 0 && lines_emitted >= line_limit; }
+private:
+  bool heap_less(size_t lhs, size_t rhs) const;
+  void heap_push(size_t idx);
+  size_t heap_pop();
+};
+
+#endif //MERGE_STREAMS_H
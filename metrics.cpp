@@ -0,0 +1,315 @@
+/* metrics.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <ctime>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <condition_variable>
+#include "logging.h"
+#include "metrics.h"
+
+namespace metrics {
+
+  // snapshot of the global counters (plain values summed over all threads)
+  struct totals_t {
+    uint64_t bytes_read{0}, lines{0}, read_calls{0}, eagain{0}, poll_calls{0}, poll_wakeups{0};
+    uint64_t ready_fds{0}, max_ready_fds{0}, output_bytes{0}, flushes{0}, threads{0};
+    uint64_t flow_pauses{0}, line_spills{0}, compressed_blocks{0}, compressed_bytes{0};
+    uint64_t prealloc_bytes{0}, written_behind_bytes{0}, sink_batches{0}, sink_writes{0};
+    histogram_snapshot poll_to_task{}, task_duration{}, read_latency{}, flush_latency{};
+  };
+
+  void histogram_snapshot::add(const histogram &h) {
+    auto const n = h.count.get();
+    if (n == 0) return;
+    for(unsigned i = 0; i < histogram::bucket_count; i++) {
+      if (auto const v = h.buckets[i].get(); v != 0) {
+        buckets[i] += v;
+      }
+    }
+    count += n;
+    max = std::max(max, h.max.get());
+  }
+
+  uint64_t histogram_snapshot::percentile(double const q) const {
+    if (count == 0) return 0;
+    auto const target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(count))));
+    uint64_t seen = 0;
+    for(unsigned i = 0; i < histogram::bucket_count; i++) {
+      seen += buckets[i];
+      if (seen >= target) return std::min(histogram::value_at(i), max);
+    }
+    return max;
+  }
+
+  static std::mutex registry_guard;
+  static std::vector<std::shared_ptr<stream_stats>> streams;
+  static std::vector<thread_counters*> live_threads;
+  static totals_t retired{}; // counts of threads that have exited
+  static uint64_t start_ns = coarse_now_ns();
+
+  thread_local thread_slot tls_slot;
+
+  static void accumulate(totals_t &t, const thread_counters &c) {
+    t.bytes_read += c.bytes_read.get();
+    t.lines += c.lines.get();
+    t.read_calls += c.read_calls.get();
+    t.eagain += c.eagain.get();
+    t.poll_calls += c.poll_calls.get();
+    t.poll_wakeups += c.poll_wakeups.get();
+    t.ready_fds += c.ready_fds.get();
+    t.max_ready_fds = std::max(t.max_ready_fds, c.max_ready_fds.get());
+    t.output_bytes += c.output_bytes.get();
+    t.flushes += c.flushes.get();
+    t.flow_pauses += c.flow_pauses.get();
+    t.line_spills += c.line_spills.get();
+    t.compressed_blocks += c.compressed_blocks.get();
+    t.compressed_bytes += c.compressed_bytes.get();
+    t.prealloc_bytes += c.prealloc_bytes.get();
+    t.written_behind_bytes += c.written_behind_bytes.get();
+    t.sink_batches += c.sink_batches.get();
+    t.sink_writes += c.sink_writes.get();
+    t.poll_to_task.add(c.poll_to_task);
+    t.task_duration.add(c.task_duration);
+    t.read_latency.add(c.read_latency);
+    t.flush_latency.add(c.flush_latency);
+  }
+
+  void thread_slot::enlist() {
+    std::lock_guard<std::mutex> lk(registry_guard);
+    live_threads.push_back(&counters);
+    is_listed = true;
+  }
+
+  thread_slot::~thread_slot() {
+    if (!is_listed) return;
+    std::lock_guard<std::mutex> lk(registry_guard);
+    accumulate(retired, counters);
+    retired.threads++;
+    auto const it = std::find(live_threads.begin(), live_threads.end(), &counters);
+    if (it != live_threads.end()) {
+      live_threads.erase(it);
+    }
+  }
+
+  uint64_t coarse_now_ns() {
+    struct timespec ts{0, 0};
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000UL + static_cast<uint64_t>(ts.tv_nsec);
+  }
+
+  std::shared_ptr<stream_stats> register_stream(std::string_view name, bool const is_stderr) {
+    auto sp_stats = std::make_shared<stream_stats>(name, is_stderr);
+    std::lock_guard<std::mutex> lk(registry_guard);
+    streams.push_back(sp_stats);
+    return sp_stats;
+  }
+
+  static totals_t snapshot_totals(std::vector<std::shared_ptr<stream_stats>> &streams_copy) {
+    std::lock_guard<std::mutex> lk(registry_guard);
+    totals_t t = retired; // (the histogram buckets make this a sizable copy, but it is only done per report)
+    for(auto const pc : live_threads) {
+      accumulate(t, *pc);
+    }
+    t.threads += live_threads.size();
+    streams_copy = streams;
+    return t;
+  }
+
+  void restart_clock() {
+    start_ns = coarse_now_ns();
+  }
+
+  static double elapsed_secs() {
+    return static_cast<double>(coarse_now_ns() - start_ns) / 1e9;
+  }
+
+  static const char * const latency_names[] = { "poll_to_task", "task_duration", "read", "flush" };
+
+  static const histogram_snapshot* latency_histograms(const totals_t &t, size_t i) {
+    const histogram_snapshot * const hists[] = { &t.poll_to_task, &t.task_duration, &t.read_latency,
+                                                 &t.flush_latency };
+    return hists[i];
+  }
+
+  static void log_latency(const totals_t &t) {
+    for(size_t i = 0; i < std::size(latency_names); i++) {
+      auto const &h = *latency_histograms(t, i);
+      LOG_INFO("latency: %-13s %10lu samples, p50 %9.3f us, p99 %9.3f us, p999 %9.3f us, max %9.3f us\n",
+               latency_names[i], h.count, static_cast<double>(h.percentile(0.50)) / 1e3,
+               static_cast<double>(h.percentile(0.99)) / 1e3, static_cast<double>(h.percentile(0.999)) / 1e3,
+               static_cast<double>(h.max) / 1e3);
+    }
+  }
+
+  void log_latency_report() {
+    std::vector<std::shared_ptr<stream_stats>> strms{};
+    auto const sp_totals = std::make_unique<totals_t>(snapshot_totals(strms));
+    log_latency(*sp_totals);
+  }
+
+  void log_report() {
+    std::vector<std::shared_ptr<stream_stats>> strms{};
+    auto const sp_totals = std::make_unique<totals_t>(snapshot_totals(strms));
+    auto const &t = *sp_totals;
+    auto const secs = elapsed_secs();
+    auto const mib_per_sec = secs > 0 ? static_cast<double>(t.bytes_read) / (1024.0 * 1024.0) / secs : 0.0;
+    LOG_INFO("stats: elapsed %.3f s, read %lu bytes (%.2f MiB/s), %lu lines, %lu read() calls, %lu EAGAIN\n",
+             secs, t.bytes_read, mib_per_sec, t.lines, t.read_calls, t.eagain);
+    LOG_INFO("stats: %lu polls, %lu wakeups, %.2f avg / %lu max ready fds per wakeup, "
+             "%lu output bytes, %lu flushes, %lu threads\n",
+             t.poll_calls, t.poll_wakeups,
+             t.poll_wakeups > 0 ? static_cast<double>(t.ready_fds) / static_cast<double>(t.poll_wakeups) : 0.0,
+             t.max_ready_fds, t.output_bytes, t.flushes, t.threads);
+    if (t.flow_pauses > 0 || t.line_spills > 0) {
+      LOG_INFO("stats: %lu flow control pauses, %lu line fragments spilled\n", t.flow_pauses, t.line_spills);
+    }
+    if (t.compressed_blocks > 0) {
+      LOG_INFO("stats: %lu output blocks compressed to %lu bytes (%.1f%% of the output bytes)\n",
+               t.compressed_blocks, t.compressed_bytes,
+               t.output_bytes > 0 ? 100.0 * static_cast<double>(t.compressed_bytes) / static_cast<double>(t.output_bytes)
+                                  : 0.0);
+    }
+    if (t.prealloc_bytes > 0 || t.written_behind_bytes > 0) {
+      LOG_INFO("stats: %lu output bytes preallocated, %lu written behind\n", t.prealloc_bytes, t.written_behind_bytes);
+    }
+    if (t.sink_batches > 0) {
+      LOG_INFO("stats: %lu line batches to the output sink in %lu writes\n", t.sink_batches, t.sink_writes);
+    }
+    log_latency(t);
+    auto const now = coarse_now_ns();
+    for(auto const &sp : strms) {
+      auto const last = sp->last_read_ns.get();
+      const std::string idle = sp->done ? "done" : last == 0 ? "no data yet"
+                                                             : std::to_string((now - last) / 1000000) + " ms idle";
+      LOG_INFO("stats: %s%s: %lu bytes, %lu lines, %lu reads, %lu EAGAIN, %lu output bytes, %s\n",
+               sp->name.c_str(), sp->is_stderr ? " (stderr)" : "", sp->bytes_read.get(), sp->lines.get(),
+               sp->read_calls.get(), sp->eagain.get(), sp->output_bytes.get(), idle.c_str());
+    }
+  }
+
+  static void write_json_string(FILE *const out, std::string_view str) {
+    fputc('"', out);
+    for(const char ch : str) {
+      switch(ch) {
+        case '"':  fputs("\\\"", out); break;
+        case '\\': fputs("\\\\", out); break;
+        case '\n': fputs("\\n", out); break;
+        case '\t': fputs("\\t", out); break;
+        default:
+          if (static_cast<unsigned char>(ch) < 0x20) {
+            fprintf(out, "\\u%04x", ch);
+          } else {
+            fputc(ch, out);
+          }
+      }
+    }
+    fputc('"', out);
+  }
+
+  void write_json_report(FILE *const out) {
+    std::vector<std::shared_ptr<stream_stats>> strms{};
+    auto const sp_totals = std::make_unique<totals_t>(snapshot_totals(strms));
+    auto const &t = *sp_totals;
+    auto const now = coarse_now_ns();
+    fprintf(out, "{\n  \"elapsed_secs\": %.3f,\n", elapsed_secs());
+    fprintf(out, "  \"totals\": {\"bytes_read\": %lu, \"lines\": %lu, \"read_calls\": %lu, \"eagain\": %lu, "
+                 "\"poll_calls\": %lu, \"poll_wakeups\": %lu, \"ready_fds\": %lu, \"max_ready_fds\": %lu, "
+                 "\"output_bytes\": %lu, \"flushes\": %lu, \"flow_pauses\": %lu, \"line_spills\": %lu, "
+                 "\"compressed_blocks\": %lu, \"compressed_bytes\": %lu, \"prealloc_bytes\": %lu, "
+                 "\"written_behind_bytes\": %lu, \"sink_batches\": %lu, \"sink_writes\": %lu, \"threads\": %lu},\n",
+            t.bytes_read, t.lines, t.read_calls, t.eagain, t.poll_calls, t.poll_wakeups, t.ready_fds,
+            t.max_ready_fds, t.output_bytes, t.flushes, t.flow_pauses, t.line_spills, t.compressed_blocks,
+            t.compressed_bytes, t.prealloc_bytes, t.written_behind_bytes, t.sink_batches, t.sink_writes, t.threads);
+    fputs("  \"latency_ns\": {", out);
+    for(size_t i = 0; i < std::size(latency_names); i++) {
+      auto const &h = *latency_histograms(t, i);
+      fprintf(out, "%s\n    \"%s\": {\"count\": %lu, \"p50\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu}",
+              i > 0 ? "," : "", latency_names[i], h.count, h.percentile(0.50), h.percentile(0.99),
+              h.percentile(0.999), h.max);
+    }
+    fputs("\n  },\n", out);
+    fputs("  \"streams\": [", out);
+    const char *sep = "\n";
+    for(auto const &sp : strms) {
+      auto const last = sp->last_read_ns.get();
+      fprintf(out, "%s    {\"name\": ", sep);
+      write_json_string(out, sp->name);
+      fprintf(out, ", \"stderr\": %s, \"bytes_read\": %lu, \"lines\": %lu, \"read_calls\": %lu, \"eagain\": %lu, "
+                   "\"output_bytes\": %lu, \"flushes\": %lu, \"done\": %s, \"idle_ms\": %ld}",
+              sp->is_stderr ? "true" : "false", sp->bytes_read.get(), sp->lines.get(), sp->read_calls.get(),
+              sp->eagain.get(), sp->output_bytes.get(), sp->flushes.get(), sp->done ? "true" : "false",
+              last == 0 ? -1L : static_cast<long>((now - last) / 1000000));
+      sep = ",\n";
+    }
+    fputs("\n  ]\n}\n", out);
+  }
+
+  bool write_json_report(const char *const file_path) {
+    // written to a temporary file then renamed, so a reader never sees a partial report
+    const std::string tmp_path = std::string{file_path} + ".tmp";
+    auto const out = fopen(tmp_path.c_str(), "w");
+    if (out == nullptr) {
+      LOG_ERROR("%d: %s() -> fopen(\"%s\"): %s\n", __LINE__, __FUNCTION__, tmp_path.c_str(), strerror(errno));
+      return false;
+    }
+    write_json_report(out);
+    if (fclose(out) != 0 || rename(tmp_path.c_str(), file_path) != 0) {
+      LOG_ERROR("%d: %s() -> writing \"%s\": %s\n", __LINE__, __FUNCTION__, file_path, strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+  static std::mutex periodic_guard;
+  static std::condition_variable periodic_cv;
+  static bool periodic_stop{false};
+  static std::thread periodic_thread;
+
+  void start_periodic_report(std::string_view file_path, unsigned const interval_secs) {
+    std::lock_guard<std::mutex> lk(periodic_guard);
+    if (periodic_thread.joinable() || interval_secs == 0) return;
+    periodic_stop = false;
+    periodic_thread = std::thread([path = std::string{file_path}, interval_secs] {
+      std::unique_lock<std::mutex> lk(periodic_guard);
+      while (!periodic_cv.wait_for(lk, std::chrono::seconds(interval_secs), [] { return periodic_stop; })) {
+        lk.unlock();
+        write_json_report(path.c_str());
+        lk.lock();
+      }
+    });
+  }
+
+  void stop_periodic_report() {
+    {
+      std::lock_guard<std::mutex> lk(periodic_guard);
+      if (!periodic_thread.joinable()) return;
+      periodic_stop = true;
+    }
+    periodic_cv.notify_all();
+    periodic_thread.join();
+  }
+
+}
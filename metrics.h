@@ -0,0 +1,193 @@
+/* metrics.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstdio>
+#include <cstdint>
+#include <ctime>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace metrics {
+
+  /*
+   * A counter that has a single writer at any one time but may be read by
+   * other threads taking a snapshot - updated with a relaxed load and store
+   * (no locked read-modify-write instruction on the hot path).
+   */
+  struct counter {
+    std::atomic_uint64_t v{0};
+    void add(uint64_t n) { v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    void set_max(uint64_t n) { if (n > v.load(std::memory_order_relaxed)) v.store(n, std::memory_order_relaxed); }
+    void set(uint64_t n) { v.store(n, std::memory_order_relaxed); }
+    uint64_t get() const { return v.load(std::memory_order_relaxed); }
+  };
+
+  /*
+   * Log-linear latency histogram (in the manner of HdrHistogram): values are
+   * bucketed per power of two, with each power of two split into 16 linear
+   * sub-buckets, so a reported percentile is within 1/16th of the true value.
+   * Values are nanoseconds and are clamped to 2^40 (about 18 minutes).
+   */
+  struct histogram {
+    static constexpr unsigned sub_bucket_bits = 4;
+    static constexpr unsigned sub_buckets = 1u << sub_bucket_bits;
+    static constexpr unsigned max_bits = 40;
+    static constexpr unsigned bucket_count = (max_bits - sub_bucket_bits + 1) * sub_buckets;
+
+    counter buckets[bucket_count]{};
+    counter count{};
+    counter max{};
+
+    static unsigned index_of(uint64_t v) {
+      if (v < sub_buckets) return static_cast<unsigned>(v);
+      if (v >= (1UL << max_bits)) v = (1UL << max_bits) - 1;
+      auto const msb = 63u - static_cast<unsigned>(__builtin_clzl(v));
+      auto const shift = msb - sub_bucket_bits;
+      return (msb - sub_bucket_bits + 1) * sub_buckets + static_cast<unsigned>((v >> shift) & (sub_buckets - 1));
+    }
+    // the highest value that maps to the bucket at the given index
+    static uint64_t value_at(unsigned idx) {
+      if (idx < sub_buckets) return idx;
+      auto const shift = idx / sub_buckets - 1;
+      auto const sub = idx % sub_buckets;
+      return ((static_cast<uint64_t>(sub_buckets + sub) + 1) << shift) - 1;
+    }
+    void record(uint64_t v) {
+      buckets[index_of(v)].add(1);
+      count.add(1);
+      max.set_max(v);
+    }
+  };
+
+  // a plain copy of one or more histograms summed together, as taken for a report
+  struct histogram_snapshot {
+    uint64_t buckets[histogram::bucket_count]{};
+    uint64_t count{0};
+    uint64_t max{0};
+    void add(const histogram &h);
+    uint64_t percentile(double q) const;
+  };
+
+  inline uint64_t now_ns() {
+    struct timespec ts{0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000UL + static_cast<uint64_t>(ts.tv_nsec);
+  }
+
+  // records the time from construction to destruction of this object into a histogram
+  class scoped_timer {
+    histogram &hist;
+    const uint64_t start_ns;
+  public:
+    explicit scoped_timer(histogram &hist) : hist{hist}, start_ns{now_ns()} {}
+    scoped_timer(const scoped_timer &) = delete;
+    scoped_timer& operator=(const scoped_timer &) = delete;
+    ~scoped_timer() { hist.record(now_ns() - start_ns); }
+  };
+
+  /*
+   * Per stream counters. The input side is maintained by the stream's
+   * read_buf_ctx, the output side by its output stream context.
+   */
+  struct stream_stats {
+    const std::string name;
+    const bool is_stderr;
+    counter bytes_read{};
+    counter lines{};
+    counter read_calls{};
+    counter eagain{};
+    counter output_bytes{};
+    counter flushes{};
+    counter last_read_ns{};  // monotonic time of the last read() that returned data
+    std::atomic_bool done{false};
+    stream_stats(std::string_view name, bool is_stderr) : name{name}, is_stderr{is_stderr} {}
+  };
+
+  std::shared_ptr<stream_stats> register_stream(std::string_view name, bool is_stderr);
+
+  /*
+   * Global counters are kept per thread, so that threads processing different
+   * streams never write to the same cache line; a snapshot sums over all of
+   * the threads (including the counts of threads that have since exited).
+   */
+  struct thread_counters {
+    counter bytes_read{};
+    counter lines{};
+    counter read_calls{};
+    counter eagain{};
+    counter poll_calls{};
+    counter poll_wakeups{};
+    counter ready_fds{};
+    counter max_ready_fds{};
+    counter output_bytes{};
+    counter flushes{};
+    counter flow_pauses{};      // streams paused by flow control
+    counter line_spills{};      // line fragments written out ahead of the rest of an overlong line
+    counter compressed_blocks{}; // output blocks compressed (see output-compress.h)
+    counter compressed_bytes{};  // their size once compressed
+    counter prealloc_bytes{};    // output file space preallocated (see output-file.h)
+    counter written_behind_bytes{}; // output written back and dropped from the page cache
+    counter sink_batches{};      // batches of lines queued to the merged output sink (see output-sink.h)
+    counter sink_writes{};       // writev() calls that wrote them
+    histogram poll_to_task{};   // poll() returning a ready fd -> the task servicing it starting
+    histogram task_duration{};  // time spent in write_to_output_stream()
+    histogram read_latency{};   // read() system call
+    histogram flush_latency{};  // fflush() of an output stream
+  };
+
+  /*
+   * A thread's counters are listed for snapshots on its first record, not on
+   * its start - so a thread that never records (or a short lived one, before it
+   * does) takes no registry lock - and on exit only what it did record is
+   * folded into the counts of exited threads.
+   */
+  struct thread_slot {
+    thread_counters counters{};
+    bool is_listed{false};
+    void enlist();
+    ~thread_slot();
+  };
+
+  extern thread_local thread_slot tls_slot;
+  inline thread_counters& local() {
+    if (!tls_slot.is_listed) [[unlikely]] {
+      tls_slot.enlist();
+    }
+    return tls_slot.counters;
+  }
+
+  uint64_t coarse_now_ns();
+  // restarts the elapsed time reported - for a job process forked from a long-running server (see job-server.h)
+  void restart_clock();
+
+  void log_report();
+  void log_latency_report();
+  void write_json_report(FILE *out);
+  bool write_json_report(const char *file_path);
+
+  void start_periodic_report(std::string_view file_path, unsigned interval_secs);
+  void stop_periodic_report();
+}
+
+#endif //METRICS_H
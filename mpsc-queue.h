@@ -0,0 +1,77 @@
+/* mpsc-queue.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+
+/*
+ * An intrusive lock-free multiple producer, single consumer queue (after
+ * Dmitry Vyukov's). push() is wait-free - a single atomic exchange - and may
+ * be called from any thread; pop() is called from one consumer thread only.
+ * Nodes are of a type T having a `std::atomic<T*> next` member, and are owned
+ * by the caller: the queue only links them.
+ *
+ * pop() may return nullptr while a push is part way through (its node not yet
+ * linked in), so an empty result is not proof that the queue is empty - the
+ * consumer is expected to wait to be notified of the push, and to pop again.
+ */
+template<typename T>
+class mpsc_queue final {
+  std::atomic<T*> head;   // the most recently pushed node - where producers link in
+  T *tail;                // the next node to pop - the consumer's end
+  T stub{};
+public:
+  mpsc_queue() : head{&stub}, tail{&stub} {}
+  mpsc_queue(const mpsc_queue &) = delete;
+  mpsc_queue& operator=(const mpsc_queue &) = delete;
+
+  void push(T *const node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    auto const prev = head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  T* pop() {
+    auto t = tail;
+    auto next = t->next.load(std::memory_order_acquire);
+    if (t == &stub) {
+      if (next == nullptr) return nullptr;
+      tail = next;
+      t = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+      tail = next;
+      return t;
+    }
+    if (t != head.load(std::memory_order_acquire)) return nullptr; // a push is part way through
+    // t is the last node - the stub goes in behind it, so that t can be handed out
+    push(&stub);
+    next = t->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+      tail = next;
+      return t;
+    }
+    return nullptr;
+  }
+};
+
+#endif //MPSC_QUEUE_H
@@ -0,0 +1,368 @@
+/* output-compress.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+#include <cerrno>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "logging.h"
+#include "metrics.h"
+#include "tracing.h"
+#include "output-file.h"
+#include "output-compress.h"
+
+namespace output_compress {
+
+  struct block {
+    std::string input{};
+    std::string output{};
+    bool is_done{false};
+  };
+
+  // the cookie of a compressed FILE stream
+  struct compressed_file {
+    output_file::file_writer writer;
+    std::string pending{};     // the block being filled - touched only by the thread writing the FILE stream
+    std::mutex guard{};
+    std::condition_variable cv{};
+    std::deque<std::unique_ptr<block>> blocks{}; // submitted and not yet written out, in file order
+    bool is_writing{false};    // a thread is writing out the compressed blocks at the front
+    bool is_any_block{false};
+    int error{0};
+    compressed_file(std::string path, int fd) : writer{std::move(path), fd, 0} {}
+  };
+
+  struct job {
+    compressed_file *file;
+    block *blk;
+  };
+
+  static settings cfg{};
+  static size_t max_blocks_in_flight = 2; // per file
+  static std::mutex pool_guard;
+  static std::condition_variable pool_cv;
+  static std::deque<job> jobs;
+  static std::vector<std::thread> workers;
+  static bool is_stopping = false;
+  static std::atomic_bool is_any_failed{false};
+
+  bool parse_codec(std::string_view const name, codec &kind) {
+    if (name == "gzip" || name == "gz") {
+      kind = codec::GZIP;
+    } else if (name == "zstd" || name == "zst") {
+      kind = codec::ZSTD;
+    } else if (name == "none") {
+      kind = codec::NONE;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  std::string_view file_suffix(codec const kind) {
+    switch(kind) {
+      case codec::GZIP: return ".gz";
+      case codec::ZSTD: return ".zst";
+      default:          return "";
+    }
+  }
+
+  bool is_enabled() { return cfg.kind != codec::NONE; }
+
+  static bool compress_block(block &blk) {
+    auto &out = blk.output;
+    if (cfg.kind == codec::GZIP) {
+      // a deflate stream per thread, reset per block - each block becomes a complete gzip member
+      struct deflater {
+        z_stream zs{};
+        bool is_init{false};
+        ~deflater() { if (is_init) deflateEnd(&zs); }
+      };
+      thread_local deflater d{};
+      if (!d.is_init) {
+        // 15 window bits, plus 16 for a gzip header and trailer rather than a zlib one
+        if (deflateInit2(&d.zs, cfg.level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+        d.is_init = true;
+      } else if (deflateReset(&d.zs) != Z_OK) {
+        return false;
+      }
+      out.resize(deflateBound(&d.zs, blk.input.size()));
+      d.zs.next_in = reinterpret_cast<Bytef*>(blk.input.data());
+      d.zs.avail_in = static_cast<uInt>(blk.input.size());
+      d.zs.next_out = reinterpret_cast<Bytef*>(out.data());
+      d.zs.avail_out = static_cast<uInt>(out.size());
+      if (deflate(&d.zs, Z_FINISH) != Z_STREAM_END) return false;
+      out.resize(d.zs.total_out);
+      return true;
+    }
+#ifdef HAVE_ZSTD
+    struct zstd_ctx {
+      ZSTD_CCtx *cctx{ZSTD_createCCtx()};
+      ~zstd_ctx() { ZSTD_freeCCtx(cctx); }
+    };
+    thread_local zstd_ctx z{};
+    if (z.cctx == nullptr) return false;
+    out.resize(ZSTD_compressBound(blk.input.size()));
+    auto const n = ZSTD_compressCCtx(z.cctx, out.data(), out.size(), blk.input.data(), blk.input.size(), cfg.level);
+    if (ZSTD_isError(n)) return false;
+    out.resize(n);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * Marks the block compressed, then writes out the compressed blocks at the
+   * front of the file's queue - unless another thread already is, in which
+   * case that thread comes to this block in turn.
+   */
+  static void complete_block(compressed_file &file, block &blk, bool const is_ok) {
+    std::unique_lock<std::mutex> lk(file.guard);
+    blk.is_done = true;
+    if (!is_ok && file.error == 0) {
+      LOG_ERROR("%d: %s() -> compressing a block of \"%s\" failed\n", __LINE__, __FUNCTION__,
+                file.writer.get_path().c_str());
+      file.error = EIO;
+    }
+    if (file.is_writing) return;
+    file.is_writing = true;
+    while (!file.blocks.empty() && file.blocks.front()->is_done) {
+      auto const sp_blk = std::move(file.blocks.front());
+      file.blocks.pop_front();
+      bool const is_failed = file.error != 0;
+      // written without holding the lock, so that blocks after it can complete meanwhile
+      lk.unlock();
+      file.cv.notify_all();
+      int const ec = is_failed ? 0 : file.writer.write(sp_blk->output.data(), sp_blk->output.size());
+      lk.lock();
+      if (ec != 0 && file.error == 0) {
+        LOG_ERROR("%d: %s() -> write(\"%s\"): %s\n", __LINE__, __FUNCTION__, file.writer.get_path().c_str(),
+                  strerror(ec));
+        file.error = ec;
+      }
+    }
+    file.is_writing = false;
+    file.cv.notify_all();
+  }
+
+  static void worker_main(unsigned const index) {
+    tracing::set_thread_name("compress " + std::to_string(index));
+    for(;;) {
+      job next{};
+      {
+        std::unique_lock<std::mutex> lk(pool_guard);
+        pool_cv.wait(lk, [] { return is_stopping || !jobs.empty(); });
+        if (jobs.empty()) return; // stopping, with nothing left to compress
+        next = jobs.front();
+        jobs.pop_front();
+      }
+      bool is_ok;
+      {
+        tracing::span compress_span{"compress_block", "output"};
+        compress_span.arg("bytes", static_cast<int64_t>(next.blk->input.size()));
+        is_ok = compress_block(*next.blk);
+      }
+      auto &counters = metrics::local();
+      counters.compressed_blocks.add(1);
+      counters.compressed_bytes.add(next.blk->output.size());
+      complete_block(*next.file, *next.blk, is_ok);
+    }
+  }
+
+  /**
+   * Queues the pending input of the file as a block to compress - waiting, if
+   * the file has as many blocks in flight as are allowed, for one to be
+   * written out. Once the pool is stopped the block is compressed right here.
+   */
+  static void submit(compressed_file &file) {
+    auto sp_blk = std::make_unique<block>();
+    sp_blk->input.swap(file.pending);
+    file.pending.reserve(cfg.block_size);
+    auto const blk = sp_blk.get();
+    {
+      std::unique_lock<std::mutex> lk(file.guard);
+      file.cv.wait(lk, [&file] { return file.blocks.size() < max_blocks_in_flight || file.error != 0; });
+      file.blocks.push_back(std::move(sp_blk));
+      file.is_any_block = true;
+    }
+    {
+      std::lock_guard<std::mutex> lk(pool_guard);
+      if (!workers.empty() && !is_stopping) {
+        jobs.push_back({&file, blk});
+        pool_cv.notify_one();
+        return;
+      }
+    }
+    auto const is_ok = compress_block(*blk);
+    auto &counters = metrics::local();
+    counters.compressed_blocks.add(1);
+    counters.compressed_bytes.add(blk->output.size());
+    complete_block(file, *blk, is_ok);
+  }
+
+  static ssize_t cookie_write(void *cookie, const char *buf, size_t size) {
+    auto &file = *static_cast<compressed_file*>(cookie);
+    {
+      std::lock_guard<std::mutex> lk(file.guard);
+      if (file.error != 0) {
+        errno = file.error;
+        return -1;
+      }
+    }
+    file.pending.append(buf, size);
+    if (file.pending.size() >= cfg.block_size) {
+      submit(file);
+    }
+    return static_cast<ssize_t>(size);
+  }
+
+  static int cookie_close(void *cookie) {
+    std::unique_ptr<compressed_file> const sp_file{static_cast<compressed_file*>(cookie)};
+    auto &file = *sp_file;
+    // an empty file still gets a block (of no input), so that it is a valid compressed file
+    if (!file.pending.empty() || !file.is_any_block) {
+      submit(file);
+    }
+    int ec;
+    {
+      std::unique_lock<std::mutex> lk(file.guard);
+      file.cv.wait(lk, [&file] { return file.blocks.empty() && !file.is_writing; });
+      ec = file.error;
+    }
+    auto const close_ec = file.writer.close();
+    if (ec == 0) {
+      ec = close_ec;
+    }
+    if (ec != 0) {
+      is_any_failed = true;
+      errno = ec;
+      return -1;
+    }
+    return 0;
+  }
+
+  bool start(const settings &s) {
+    cfg = s;
+    if (cfg.kind == codec::NONE) return true;
+#ifndef HAVE_ZSTD
+    if (cfg.kind == codec::ZSTD) {
+      LOG_ERROR("zstd output compression is not built into this program (it requires libzstd)\n");
+      return false;
+    }
+#endif
+    if (cfg.level < 0) {
+      cfg.level = cfg.kind == codec::GZIP ? Z_DEFAULT_COMPRESSION : 3;
+    } else if (cfg.kind == codec::GZIP && cfg.level > Z_BEST_COMPRESSION) {
+      LOG_ERROR("gzip compression level must be 0 through %d: %d\n", Z_BEST_COMPRESSION, cfg.level);
+      return false;
+    }
+    auto const threads = cfg.threads > 0 ? cfg.threads : std::max(1u, std::thread::hardware_concurrency());
+    // enough blocks in flight that a single file keeps every compression thread busy
+    max_blocks_in_flight = 2 * static_cast<size_t>(threads);
+    std::lock_guard<std::mutex> lk(pool_guard);
+    is_stopping = false;
+    for(unsigned i = 0; i < threads; i++) {
+      workers.emplace_back(worker_main, i);
+    }
+    LOG_DEBUG("compressing output (%s) on %u threads in blocks of %lu bytes\n",
+              std::string{file_suffix(cfg.kind)}.c_str(), threads, cfg.block_size);
+    return true;
+  }
+
+  bool finish() {
+    {
+      std::lock_guard<std::mutex> lk(pool_guard);
+      is_stopping = true;
+    }
+    pool_cv.notify_all();
+    for(auto &worker : workers) {
+      worker.join();
+    }
+    std::lock_guard<std::mutex> lk(pool_guard);
+    workers.clear();
+    return !is_any_failed;
+  }
+
+  // the cookie of an uncompressed FILE stream - written straight through
+  struct plain_file {
+    output_file::file_writer writer;
+    plain_file(std::string path, int fd, uint64_t expected_size) : writer{std::move(path), fd, expected_size} {}
+  };
+
+  static ssize_t plain_write(void *cookie, const char *buf, size_t size) {
+    auto const ec = static_cast<plain_file*>(cookie)->writer.write(buf, size);
+    if (ec != 0) {
+      errno = ec;
+      return -1;
+    }
+    return static_cast<ssize_t>(size);
+  }
+
+  static int plain_close(void *cookie) {
+    std::unique_ptr<plain_file> const sp_file{static_cast<plain_file*>(cookie)};
+    auto const ec = sp_file->writer.close();
+    if (ec != 0) {
+      errno = ec;
+      return -1;
+    }
+    return 0;
+  }
+
+  FILE* open(const std::string &path, uint64_t const expected_size) {
+    auto const fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd == -1) return nullptr;
+    void *cookie;
+    cookie_io_functions_t io{};
+    if (cfg.kind == codec::NONE) {
+      cookie = new plain_file{path, fd, expected_size};
+      io.write = plain_write;
+      io.close = plain_close;
+    } else {
+      // the size of the compressed file is not known ahead - it is preallocated for as it grows
+      auto const file = new compressed_file{path, fd};
+      file->pending.reserve(cfg.block_size);
+      cookie = file;
+      io.write = cookie_write;
+      io.close = cookie_close;
+    }
+    auto const fp = fopencookie(cookie, "wb", io);
+    if (fp == nullptr) {
+      auto const ec = errno;
+      io.close(cookie); // closes the file descriptor too
+      errno = ec;
+      return nullptr;
+    }
+    // the stdio buffer batches the writes (or, compressing, the appends to the block being filled)
+    setvbuf(fp, nullptr, _IOFBF, 64 * 1024);
+    return fp;
+  }
+}
@@ -0,0 +1,75 @@
+/* output-compress.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef OUTPUT_COMPRESS_H
+#define OUTPUT_COMPRESS_H
+
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+ * Compressed output files. An output file opened here is a FILE stream like
+ * any other (it is written with fwrite() and closed with fclose()), but what
+ * is written to it is cut into blocks that are each compressed independently
+ * - as a gzip member, or a zstd frame - by a pool of compression threads, and
+ * are written to the file in order. Concatenated gzip members (and zstd
+ * frames) are themselves a valid gzip (zstd) file, so the output decompresses
+ * with the stock tools, while the blocks of even a single large stream are
+ * compressed on several cores at once.
+ *
+ * A block is compressed once it fills (or the file is closed), so fflush()
+ * does not push out a partial block. The blocks of a file that are queued or
+ * being compressed are bounded; fwrite() waits on the pool beyond that.
+ *
+ * zstd is available when the program is built with libzstd (HAVE_ZSTD).
+ */
+namespace output_compress {
+  enum class codec : char { NONE = 0, GZIP, ZSTD };
+
+  constexpr size_t default_block_size = 1024 * 1024;
+
+  struct settings {
+    codec kind{codec::NONE};
+    int level{-1};                 // -1 is the codec's default
+    unsigned threads{0};           // 0 is one per CPU
+    size_t block_size{default_block_size};
+  };
+
+  bool parse_codec(std::string_view name, codec &kind); // "gzip", "zstd" or "none"
+  std::string_view file_suffix(codec kind);              // ".gz", ".zst", or empty
+
+  // starts the compression threads - false if the codec is not built in
+  bool start(const settings &s);
+  // stops the compression threads (files closed after this compress on the closing thread);
+  // false if writing any compressed file failed
+  bool finish();
+  bool is_enabled();
+
+  /*
+   * Opens the output file for writing - compressed per the started settings,
+   * or else plain - through an output_file::file_writer (see output-file.h),
+   * given the expected size of the (plain) output, or 0 if not known.
+   */
+  FILE* open(const std::string &path, uint64_t expected_size = 0);
+}
+
+#endif //OUTPUT_COMPRESS_H
@@ -0,0 +1,122 @@
+/* output-file.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include "logging.h"
+#include "metrics.h"
+#include "output-file.h"
+
+namespace output_file {
+
+  static constexpr uint64_t min_prealloc_chunk = 1024 * 1024;
+
+  static settings cfg{};
+
+  void configure(const settings &s) {
+    cfg = s;
+  }
+
+  file_writer::file_writer(std::string path, int const fd, uint64_t const expected_size)
+      : path{std::move(path)}, fd{fd}, expected_size{expected_size}, is_prealloc{cfg.prealloc_max > 0} {}
+
+  file_writer::~file_writer() {
+    if (fd != -1) {
+      close();
+    }
+  }
+
+  /**
+   * Preallocates past the given end of the writes: to the expected size of
+   * the file while it is short of that, else by as much again as it has
+   * grown to - in either case by no more than the preallocation maximum.
+   */
+  void file_writer::preallocate(uint64_t const end) {
+    auto target = expected_size > end ? expected_size : end + std::max(end, min_prealloc_chunk);
+    target = std::max(end, std::min(target, allocated_end + cfg.prealloc_max));
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(allocated_end),
+                  static_cast<off_t>(target - allocated_end)) == -1) {
+      // not supported by the file system, or out of space - the writes themselves may yet succeed
+      LOG_DEBUG("%d: %s() -> fallocate(\"%s\"): %s - not preallocating\n", __LINE__, __FUNCTION__, path.c_str(),
+                strerror(errno));
+      is_prealloc = false;
+      return;
+    }
+    metrics::local().prealloc_bytes.add(target - allocated_end);
+    allocated_end = target;
+  }
+
+  /**
+   * Starts the writeback of each write-behind window as it is completed, and
+   * drops the window before it from the page cache - by then its writeback,
+   * started a window earlier, has normally finished, so the wait is short.
+   */
+  void file_writer::write_behind() {
+    auto const window = static_cast<uint64_t>(cfg.write_behind);
+    while (offset - window_start >= window) {
+      sync_file_range(fd, static_cast<off_t>(window_start), static_cast<off_t>(window), SYNC_FILE_RANGE_WRITE);
+      if (window_start >= window) {
+        auto const prev = static_cast<off_t>(window_start - window);
+        sync_file_range(fd, prev, static_cast<off_t>(window),
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, prev, static_cast<off_t>(window), POSIX_FADV_DONTNEED);
+        metrics::local().written_behind_bytes.add(window);
+      }
+      window_start += window;
+    }
+  }
+
+  int file_writer::write(const char *data, size_t len) {
+    if (is_prealloc && offset + len > allocated_end) {
+      preallocate(offset + len);
+    }
+    while (len > 0) {
+      auto const n = ::write(fd, data, len);
+      if (n == -1) {
+        if (errno == EINTR) continue;
+        return errno;
+      }
+      data += n;
+      len -= static_cast<size_t>(n);
+      offset += static_cast<uint64_t>(n);
+    }
+    if (cfg.write_behind > 0) {
+      write_behind();
+    }
+    return 0;
+  }
+
+  int file_writer::close() {
+    int ec = 0;
+    // the file size was never extended by preallocating, so this only releases what went unused past the end
+    if (allocated_end > offset && ftruncate(fd, static_cast<off_t>(offset)) == -1) {
+      ec = errno;
+      LOG_ERROR("%d: %s() -> ftruncate(\"%s\"): %s\n", __LINE__, __FUNCTION__, path.c_str(), strerror(ec));
+    }
+    if (::close(fd) == -1 && ec == 0) {
+      ec = errno;
+      LOG_ERROR("%d: %s() -> close(\"%s\"): %s\n", __LINE__, __FUNCTION__, path.c_str(), strerror(ec));
+    }
+    fd = -1;
+    return ec;
+  }
+}
@@ -0,0 +1,71 @@
+/* output-file.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef OUTPUT_FILE_H
+#define OUTPUT_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ * The writing of an output file to its file descriptor, with hints to the
+ * file system and page cache for many large files being appended to at once:
+ *
+ * - Space is preallocated ahead of the writes with fallocate() in large
+ *   chunks - up to the expected size of the file when it is known (e.g. from
+ *   the ISIZE field of a gzip input's trailer), else growing with the file -
+ *   so that concurrently growing files get long extents rather than
+ *   interleaved small ones. The file size is not extended by it, and the
+ *   unused preallocation is released by truncating the file at close.
+ * - Write-behind: once a window of the file has been written, its writeback
+ *   is started with sync_file_range(), and the window before it - by then
+ *   written back - is dropped from the page cache with posix_fadvise(), so
+ *   the dirty and cached pages per file stay bounded.
+ */
+namespace output_file {
+  struct settings {
+    size_t write_behind{8 * 1024 * 1024};      // write-behind window; 0 turns write-behind off
+    size_t prealloc_max{256 * 1024 * 1024};    // most preallocated by one fallocate(); 0 turns preallocation off
+  };
+
+  void configure(const settings &s);
+
+  class file_writer final {
+    const std::string path;
+    int fd;
+    uint64_t offset{0};           // bytes written
+    uint64_t allocated_end{0};    // end of the space preallocated so far
+    const uint64_t expected_size;
+    uint64_t window_start{0};     // start of the write-behind window being written
+    bool is_prealloc;
+    void preallocate(uint64_t end);
+    void write_behind();
+  public:
+    file_writer(std::string path, int fd, uint64_t expected_size);
+    file_writer(const file_writer &) = delete;
+    file_writer& operator=(const file_writer &) = delete;
+    ~file_writer();
+    const std::string& get_path() const { return path; }
+    int write(const char *data, size_t len); // 0, or the errno of the failed write
+    int close();                             // likewise
+  };
+}
+
+#endif //OUTPUT_FILE_H
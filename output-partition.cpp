@@ -0,0 +1,203 @@
+/* output-partition.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include "logging.h"
+#include "output-compress.h"
+#include "line-stream.h"
+#include "output-partition.h"
+
+namespace output_partition {
+
+  struct partition {
+    std::mutex guard{};
+    FILE *out{nullptr};
+    unsigned index{0};
+    unsigned segment{0};
+    uint64_t bytes{0};        // written to the current file
+  };
+
+  static settings cfg{};
+  static std::string suffix{};
+  static uint64_t expected_file_size{0};
+  static std::vector<std::unique_ptr<partition>> partitions{};
+  static std::atomic_int write_error{0};
+  static std::atomic_uint files_opened{0};
+
+  uint64_t hash_key(std::string_view key) {
+    uint64_t h = 14695981039346656037ULL;
+    for(const char ch : key) {
+      h ^= static_cast<unsigned char>(ch);
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  static std::string file_name(const partition &part) {
+    char numbers[32];
+    if (cfg.roll_size > 0) {
+      snprintf(numbers, sizeof(numbers), "-%05u-%05u", part.index, part.segment);
+    } else {
+      snprintf(numbers, sizeof(numbers), "-%05u", part.index);
+    }
+    return cfg.prefix + numbers + suffix;
+  }
+
+  static int note_error(int const ec, const char *const what, const std::string &path) {
+    int expected = 0;
+    if (write_error.compare_exchange_strong(expected, ec)) {
+      LOG_ERROR("%s partition file \"%s\" failed: %s\n", what, path.c_str(), strerror(ec));
+    }
+    return ec;
+  }
+
+  // opens the file of the partition's current segment - called holding the partition's lock (or at start)
+  static int open_file(partition &part) {
+    auto const path = file_name(part);
+    part.out = output_compress::open(path, expected_file_size);
+    if (part.out == nullptr) return note_error(errno, "opening", path);
+    part.bytes = 0;
+    files_opened.fetch_add(1, std::memory_order_relaxed);
+    LOG_DEBUG("opened partition file \"%s\"\n", path.c_str());
+    return 0;
+  }
+
+  static int close_file(partition &part) {
+    auto const fp = part.out;
+    part.out = nullptr;
+    if (fp != nullptr && fclose(fp) != 0) return note_error(errno, "writing", file_name(part));
+    return 0;
+  }
+
+  // writes complete lines to the partition, rolling it over to a new file first once it has reached the size
+  static int write_lines(partition &part, std::string_view lines) {
+    std::lock_guard<std::mutex> lk(part.guard);
+    if (cfg.roll_size > 0 && part.bytes >= cfg.roll_size) {
+      if (auto const ec = close_file(part); ec != 0) return ec;
+      part.segment++;
+      if (auto const ec = open_file(part); ec != 0) return ec;
+    }
+    if (part.out == nullptr) return write_error.load() != 0 ? write_error.load() : EBADF;
+    if (fwrite(lines.data(), 1, lines.size(), part.out) != lines.size()) {
+      return note_error(errno, "writing", file_name(part));
+    }
+    part.bytes += lines.size();
+    return 0;
+  }
+
+  static std::string_view key_of(std::string_view line) {
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+      line.remove_suffix(1);
+    }
+    return extract_merge_key(line, cfg.key);
+  }
+
+  // a stream written to the partitions
+  struct partition_stream final : line_stream::stream {
+    std::vector<std::string> staged{};   // per partition, the complete lines routed to it
+    std::vector<unsigned> touched{};     // the partitions having staged lines
+
+    // routes the complete lines to their partitions
+    int take_lines(size_t const end) override {
+      int ec = 0;
+      if (partitions.size() == 1) {
+        ec = write_lines(*partitions.front(), std::string_view{pending}.substr(0, end));
+      } else {
+        std::string_view const text{pending.data(), end};
+        for(size_t pos = 0; pos < end; ) {
+          auto const next = text.find('\n', pos) + 1;
+          auto const line = text.substr(pos, next - pos);
+          auto const p = static_cast<unsigned>(hash_key(key_of(line)) % partitions.size());
+          if (staged[p].empty()) {
+            touched.push_back(p);
+          }
+          staged[p].append(line);
+          pos = next;
+        }
+        for(auto const p : touched) {
+          if (ec == 0) {
+            ec = write_lines(*partitions[p], staged[p]);
+          }
+          staged[p].clear();
+        }
+        touched.clear();
+      }
+      pending.erase(0, end);
+      return ec;
+    }
+  };
+
+  static void close_partitions() {
+    for(auto const &sp_part : partitions) {
+      std::lock_guard<std::mutex> lk(sp_part->guard);
+      close_file(*sp_part);
+    }
+    LOG_INFO("wrote output to %u partition files \"%s-*\"\n", files_opened.load(), cfg.prefix.c_str());
+  }
+
+  // the partition files outlive finish() while streams cut short are still open - the last of them closes them
+  static line_stream::group streams{close_partitions};
+
+  bool start(const settings &s, std::string_view file_suffix, uint64_t const expected_size) {
+    cfg = s;
+    cfg.count = std::max(cfg.count, 1u);
+    suffix = file_suffix;
+    // the hash spreads the output evenly - and a rolled over file is no larger than the roll size (give or take a batch)
+    expected_file_size = expected_size / cfg.count;
+    if (cfg.roll_size > 0) {
+      expected_file_size = std::min(expected_file_size, cfg.roll_size);
+    }
+    for(unsigned i = 0; i < cfg.count; i++) {
+      partitions.push_back(std::make_unique<partition>());
+      partitions.back()->index = i;
+      if (open_file(*partitions.back()) != 0) return false;
+    }
+    LOG_DEBUG("partitioning output into %u partitions \"%s-*\"%s\n", cfg.count, cfg.prefix.c_str(),
+              cfg.roll_size > 0 ? " rolled over by size" : "");
+    return true;
+  }
+
+  bool finish() {
+    if (partitions.empty()) return true;
+    streams.finish();
+    return write_error.load() == 0;
+  }
+
+  bool is_enabled() {
+    return !partitions.empty();
+  }
+
+  FILE* open_stream() {
+    auto sp_strm = std::make_unique<partition_stream>();
+    if (partitions.size() > 1) {
+      sp_strm->staged.resize(partitions.size());
+    }
+    auto const fp = streams.open(std::move(sp_strm));
+    if (fp == nullptr) {
+      LOG_ERROR("%d: %s() -> fopencookie(\"%s-*\"): %s\n", __LINE__, __FUNCTION__, cfg.prefix.c_str(), strerror(errno));
+    }
+    return fp;
+  }
+}
@@ -0,0 +1,68 @@
+/* output-partition.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef OUTPUT_PARTITION_H
+#define OUTPUT_PARTITION_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "merge-streams.h"
+
+/*
+ * Partitioned output: the lines of all of the input streams are routed to a
+ * fixed number of output partitions - by a hash of a key extracted from each
+ * line (see merge_key_spec), so that the lines of a key all land in the same
+ * partition - and/or the file of a partition is rolled over to a new one once
+ * it has reached a size threshold, so that the output files are evenly sized
+ * whatever the sizes of the inputs.
+ *
+ * Each stream writes through a FILE stream of its own (see open_stream() and
+ * line-stream.h), which hands on only complete lines, staged per partition.
+ * Each partition has a buffered output file of its own (see
+ * output_compress::open()), written under a lock of its own, so a line is
+ * never split and streams writing to different partitions do not contend.
+ *
+ * The files are named <prefix>-<partition>, or <prefix>-<partition>-<segment>
+ * when rolling over at a size, each number being zero padded to 5 digits.
+ */
+namespace output_partition {
+  struct settings {
+    std::string prefix{};
+    unsigned count{1};           // partitions hashed to
+    uint64_t roll_size{0};       // a partition's file is rolled over once this size (0 is never)
+    merge_key_spec key{};        // the key hashed - the whole line by default
+  };
+
+  // opens the first file of each partition, given the expected size of all of the output (or 0 if not known)
+  bool start(const settings &s, std::string_view file_suffix, uint64_t expected_size);
+  // closes the partition files - else, while streams are still open, the last of them to close does;
+  // false if writing any of them failed so far
+  bool finish();
+  bool is_enabled();
+
+  // a FILE stream writing the lines of an input stream to the partitions
+  FILE* open_stream();
+
+  // stable across runs and builds (FNV-1a), so a key always maps to the same partition
+  uint64_t hash_key(std::string_view key);
+}
+
+#endif //OUTPUT_PARTITION_H
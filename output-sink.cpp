@@ -0,0 +1,268 @@
+/* output-sink.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <unistd.h>
+#include <fcntl.h>
+#include <climits>
+#include <sys/uio.h>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include "logging.h"
+#include "metrics.h"
+#include "tracing.h"
+#include "mpsc-queue.h"
+#include "shm-ring.h"
+#include "line-stream.h"
+#include "output-sink.h"
+
+namespace output_sink {
+
+  // a producer gets no further ahead of the writer thread than this
+  static constexpr size_t max_queued_bytes = 64 * 1024 * 1024;
+
+  struct batch {
+    std::atomic<batch*> next{nullptr};
+    std::string data{};  // complete lines only
+  };
+
+  static mpsc_queue<batch> queue;
+  static std::atomic_uint32_t pushed{0};   // bumped by each push - what the writer thread waits on
+  static std::atomic_uint32_t drained{0};  // bumped by each write - what a producer held back waits on
+  static std::atomic<size_t> queued_bytes{0};
+  static std::atomic_bool is_running{false};
+  static std::atomic_bool is_stopping{false};
+  static std::thread writer;
+  static std::mutex direct_guard;          // serializes the writes made once the writer thread is stopped
+  static std::atomic_int write_error{0};
+  static std::string sink_name;
+  static int sink_fd = -1;
+  static std::unique_ptr<shm_ring::writer> sp_ring{}; // in place of sink_fd, for a shm: sink
+  static bool is_tagged_lines = false;
+
+  static void note_write_error(int const ec) {
+    int expected = 0;
+    if (write_error.compare_exchange_strong(expected, ec)) {
+      LOG_ERROR("writing to the sink \"%s\" failed: %s\n", sink_name.c_str(), strerror(ec));
+    }
+  }
+
+  /**
+   * Writes all of the iovec entries, however many calls it takes - the
+   * entries are advanced past whatever a short write did write.
+   */
+  static int writev_fully(std::vector<iovec> &iov) {
+    size_t i = 0;
+    while (i < iov.size()) {
+      auto const count = static_cast<int>(std::min(iov.size() - i, static_cast<size_t>(IOV_MAX)));
+      auto const n = writev(sink_fd, &iov[i], count);
+      if (n == -1) {
+        if (errno == EINTR) continue;
+        return errno;
+      }
+      metrics::local().sink_writes.add(1);
+      auto left = static_cast<size_t>(n);
+      while (i < iov.size() && left >= iov[i].iov_len) {
+        left -= iov[i].iov_len;
+        i++;
+      }
+      if (left > 0) {
+        iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + left;
+        iov[i].iov_len -= left;
+      }
+    }
+    return 0;
+  }
+
+  // the rest of the output is discarded once writing has failed
+  static void write_batches(std::vector<iovec> &iov) {
+    if (write_error.load(std::memory_order_relaxed) != 0) return;
+    int ec = 0;
+    if (sp_ring) {
+      for(size_t i = 0; i < iov.size() && ec == 0; i++) {
+        ec = sp_ring->write({static_cast<const char*>(iov[i].iov_base), iov[i].iov_len});
+      }
+    } else {
+      ec = writev_fully(iov);
+    }
+    if (ec != 0) {
+      note_write_error(ec);
+    }
+  }
+
+  /**
+   * The writer thread: takes whatever batches are queued (up to IOV_MAX of
+   * them) and writes them with one writev(), so the more the streams write the
+   * fewer the system calls per batch. Exits once stopping with the queue empty.
+   */
+  static void writer_main() {
+    tracing::set_thread_name("output sink");
+    std::vector<batch*> taken{};
+    std::vector<iovec> iov{};
+    taken.reserve(IOV_MAX);
+    iov.reserve(IOV_MAX);
+    for(;;) {
+      auto const seen = pushed.load(std::memory_order_acquire);
+      size_t bytes = 0;
+      batch *b;
+      while (taken.size() < IOV_MAX && (b = queue.pop()) != nullptr) {
+        taken.push_back(b);
+        iov.push_back({b->data.data(), b->data.size()});
+        bytes += b->data.size();
+      }
+      if (taken.empty()) {
+        if (is_stopping.load(std::memory_order_acquire)) return;
+        pushed.wait(seen, std::memory_order_acquire);
+        continue;
+      }
+      write_batches(iov);
+      for(auto const p : taken) {
+        delete p;
+      }
+      taken.clear();
+      iov.clear();
+      queued_bytes.fetch_sub(bytes, std::memory_order_release);
+      drained.fetch_add(1, std::memory_order_release);
+      drained.notify_all();
+    }
+  }
+
+  // writes the batch on the calling thread - the writer thread having stopped
+  static void write_direct(batch *const b) {
+    std::lock_guard<std::mutex> lk(direct_guard);
+    std::vector<iovec> iov{{b->data.data(), b->data.size()}};
+    write_batches(iov);
+    delete b;
+  }
+
+  static void emit(batch *const b) {
+    metrics::local().sink_batches.add(1);
+    if (!is_running.load(std::memory_order_acquire)) {
+      write_direct(b);
+      return;
+    }
+    for(;;) {
+      auto const seen = drained.load(std::memory_order_acquire);
+      if (queued_bytes.load(std::memory_order_acquire) < max_queued_bytes) break;
+      drained.wait(seen, std::memory_order_acquire);
+    }
+    queued_bytes.fetch_add(b->data.size(), std::memory_order_relaxed);
+    queue.push(b);
+    pushed.fetch_add(1, std::memory_order_release);
+    pushed.notify_one();
+  }
+
+  // a stream written to the sink
+  struct sink_stream final : line_stream::stream {
+    std::string tag{};     // the source name and a tab, when lines are tagged
+
+    // hands on the complete lines as a batch
+    int take_lines(size_t const end) override {
+      auto const b = new batch{};
+      if (tag.empty()) {
+        if (end == pending.size()) {
+          b->data.swap(pending);
+        } else {
+          b->data.assign(pending, 0, end);
+          pending.erase(0, end);
+        }
+      } else {
+        auto const lines = static_cast<size_t>(std::count(pending.data(), pending.data() + end, '\n'));
+        b->data.reserve(end + lines * tag.size());
+        for(size_t pos = 0; pos < end; ) {
+          auto const next = pending.find('\n', pos) + 1;
+          b->data += tag;
+          b->data.append(pending, pos, next - pos);
+          pos = next;
+        }
+        pending.erase(0, end);
+      }
+      emit(b);
+      return 0; // a write error is noted by the writer, and the rest of the output discarded
+    }
+  };
+
+  // closes a shm: ring once the writer thread is stopped and every stream is closed - the reader then ends
+  static void close_ring() {
+    std::lock_guard<std::mutex> lk(direct_guard);
+    if (sp_ring) {
+      sp_ring->close();
+    }
+  }
+
+  static line_stream::group streams{close_ring};
+
+  bool start(std::string_view path, bool const is_tagged, size_t const ring_size) {
+    if (path.starts_with(shm_prefix)) {
+      sp_ring = std::make_unique<shm_ring::writer>();
+      if (sp_ring->create(path.substr(shm_prefix.size()), ring_size) != 0) return false;
+      sink_name = std::string{shm_prefix} + sp_ring->get_name();
+    } else if (path == "-") {
+      sink_fd = STDOUT_FILENO;
+      sink_name = "stdout";
+    } else {
+      sink_name = path;
+      sink_fd = open(sink_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+      if (sink_fd == -1) {
+        LOG_ERROR("%d: %s() -> open(\"%s\"): %s\n", __LINE__, __FUNCTION__, sink_name.c_str(), strerror(errno));
+        return false;
+      }
+    }
+    is_tagged_lines = is_tagged;
+    is_running.store(true, std::memory_order_release);
+    writer = std::thread(writer_main);
+    LOG_DEBUG("writing merged output to %s%s\n", sink_name.c_str(), is_tagged ? " (lines tagged by source)" : "");
+    return true;
+  }
+
+  bool finish() {
+    if (!is_running.load(std::memory_order_acquire)) return write_error.load() == 0;
+    is_stopping.store(true, std::memory_order_release);
+    pushed.fetch_add(1, std::memory_order_release);
+    pushed.notify_one();
+    writer.join();
+    is_running.store(false, std::memory_order_release);
+    streams.finish();
+    return write_error.load() == 0;
+  }
+
+  bool is_enabled() {
+    return sink_fd != -1 || sp_ring;
+  }
+
+  FILE* open_stream(std::string_view source_name) {
+    auto sp_strm = std::make_unique<sink_stream>();
+    if (is_tagged_lines) {
+      sp_strm->tag.reserve(source_name.size() + 1);
+      sp_strm->tag.append(source_name);
+      sp_strm->tag += '\t';
+    }
+    auto const fp = streams.open(std::move(sp_strm));
+    if (fp == nullptr) {
+      LOG_ERROR("%d: %s() -> fopencookie(\"%s\"): %s\n", __LINE__, __FUNCTION__, sink_name.c_str(), strerror(errno));
+    }
+    return fp;
+  }
+}
@@ -0,0 +1,58 @@
+/* output-sink.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <cstdio>
+#include <cstddef>
+#include <string_view>
+
+/*
+ * A single merged output - stdout or one file - that the lines of all of the
+ * input streams are written to, in whatever order they arrive (unlike the
+ * ordered -merge). Each stream writes through a FILE stream of its own (see
+ * open_stream() and line-stream.h), which hands on only complete lines: a
+ * batch of them at a time, pushed to a lock-free MPSC queue (see
+ * mpsc-queue.h). A single writer thread drains the queue, writing many
+ * batches per writev() call, so the lines of different streams are
+ * interleaved but never split.
+ *
+ * Optionally each line is tagged with the name of its source: the name and a
+ * tab ahead of the line.
+ *
+ * A sink named shm:<name> is a shared memory ring buffer (see shm-ring.h) that
+ * a consumer process on the same host reads the batches from in place. It is
+ * closed - so the reader ends - once every stream writing to it is closed.
+ */
+namespace output_sink {
+  constexpr std::string_view shm_prefix{"shm:"};
+  constexpr size_t default_ring_size = 64 * 1024 * 1024;
+
+  // starts the writer thread, writing to the file path - or to stdout for "-", or to a ring of the given size
+  bool start(std::string_view path, bool is_tagged, size_t ring_size = default_ring_size);
+  // drains the queue and stops the writer thread; false if writing failed
+  bool finish();
+  bool is_enabled();
+
+  // a FILE stream writing the lines of the named source to the sink
+  FILE* open_stream(std::string_view source_name);
+}
+
+#endif //OUTPUT_SINK_H
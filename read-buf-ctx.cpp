@@ -23,76 +23,97 @@ limitations under the License.
 #include <cassert>
 #include <fcntl.h>
 #include "signal-handling.h"
+#include "logging.h"
+#include "stream-record.h"
 #include "read-buf-ctx.h"
 
-static int get_dup_file_desc(int fd, const int line_nbr) {
-  fd = dup(fd);
-  if (fd == -1) {
-    fprintf(stderr, "ERROR: %d: %s() -> dup(): %s\n", line_nbr, __FUNCTION__, strerror(errno));
-    return -1;
-  }
-  return fd;
-}
-
-void close_dup_fd(fd_t *p) {
-  if (p != nullptr && p->dup_fd >= 0) {
-    close(p->dup_fd);
-    p->dup_fd = -1;
-  }
-}
-
 read_buf_ctx::read_buf_ctx(const int input_fd, const u_int read_buf_size)
-    : orig_fd{input_fd}, // file descriptor of input source
+    : input_fd{input_fd}, // file descriptor of input source
       read_buffer{static_cast<char *const>(malloc(read_buf_size))},
       read_buf_limit{read_buf_size - 1},
-      sp_input_fd{this, &close_dup_fd},
       sp_read_buf_rb{read_buffer, &free}
 {
-  if (orig_fd != -1) {
-    dup_fd = get_dup_file_desc(orig_fd, __LINE__); // get a dup file descriptor from original
-    if (dup_fd != -1) {
-      // bounds check the file descriptor against max fd set size
-      assert(this->dup_fd < FD_SETSIZE);
-      // set the dup file descriptor to non-blocking mode
-      int flags = fcntl(dup_fd, F_GETFL, 0);
-      auto rtn = fcntl(dup_fd, F_SETFL, flags | O_NONBLOCK); int line_nbr = __LINE__;
-      if (rtn == -1) {
-        fprintf(stderr, "ERROR: %d: %s() -> fcntl(): %s\n", line_nbr, __FUNCTION__, strerror(errno));
-        sp_input_fd.reset(nullptr);
-      }
+  if (input_fd != -1) {
+    // set the file descriptor to non-blocking mode - it is read directly, so no
+    // dup() of it is needed (which would double the file descriptors per stream)
+    int flags = fcntl(input_fd, F_GETFL, 0);
+    auto rtn = flags == -1 ? -1 : fcntl(input_fd, F_SETFL, flags | O_NONBLOCK); int line_nbr = __LINE__;
+    if (rtn == -1) {
+      LOG_ERROR("%d: %s() -> fcntl(): %s\n", line_nbr, __FUNCTION__, strerror(errno));
+    } else {
+      is_nonblocking = true;
     }
   }
 }
 
 read_buf_ctx &read_buf_ctx::operator=(read_buf_ctx &&rbc) noexcept {
-  *const_cast<int*>(&orig_fd) = rbc.orig_fd;
+  *const_cast<int*>(&input_fd) = rbc.input_fd;
   *const_cast<char**>(&read_buffer) = rbc.read_buffer;
   *const_cast<u_int*>(&read_buf_limit) = rbc.read_buf_limit;
-  dup_fd = rbc.dup_fd;
+  is_nonblocking = rbc.is_nonblocking;
+  is_fd_owned = rbc.is_fd_owned;
+  rbc.is_fd_owned = false;
   pos = rbc.pos;
   eof_flag = rbc.eof_flag;
-  sp_input_fd = std::move(rbc.sp_input_fd);
+  is_stderr_flag = rbc.is_stderr_flag;
+  line_open = rbc.line_open;
+  skip_line = rbc.skip_line;
+  sampling = rbc.sampling;
+  sample_threshold = rbc.sample_threshold;
+  sample_state = rbc.sample_state;
+  stats = rbc.stats;
+  rbc.stats = nullptr;
+  record_stream = rbc.record_stream;
+  line_fragment_limit = rbc.line_fragment_limit;
+  bytes_in = rbc.bytes_in;
+  lines_in = rbc.lines_in;
   sp_read_buf_rb = std::move(rbc.sp_read_buf_rb);
   return *this;
 }
 
 
+/**
+ * Enables random sampling of input lines - each line is independently kept
+ * with the given probability. Lines sampled out are discarded straight from
+ * the read buffer, so they are never copied into the caller's string buffer.
+ *
+ * @param rate fraction of lines to keep; 1.0 (or greater) disables sampling
+ * @param seed pseudo-random sequence seed (sampling is reproducible per seed)
+ */
+void read_buf_ctx::set_sample_rate(double const rate, uint32_t const seed) {
+  sampling = rate < 1.0;
+  sample_threshold = rate <= 0.0 ? 0 : static_cast<uint32_t>(rate * 4294967296.0);
+  sample_state = seed != 0 ? seed : 0x9E3779B9u; // xorshift state must be non-zero
+}
+
+bool read_buf_ctx::sample_line() {
+  // xorshift32 - cheap enough to evaluate per line
+  auto x = sample_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  sample_state = x;
+  return x < sample_threshold;
+}
+
 read_buf_ctx::~read_buf_ctx() {
-  auto const ptr = sp_input_fd ? sp_input_fd.get() : nullptr;
-  auto const ofd = ptr != nullptr ? ptr->orig_fd : -1;
-  auto const dfd = ptr != nullptr ? ptr->dup_fd  : -1;
+  if (stats != nullptr) {
+    stats->done = true;
+  }
+  if (is_fd_owned && input_fd >= 0) {
+    close(input_fd);
+  }
   auto const rb = sp_read_buf_rb ? sp_read_buf_rb.get() : nullptr;
-  fprintf(stderr, "DEBUG: << (%p)->%s(): orig_fd: %03d, dup_fd: %03d, read_buffer: %p\n",
-          this, __FUNCTION__, ofd, dfd, rb);
+  LOG_DEBUG("<< (%p)->%s(): input_fd: %03d%s, read_buffer: %p\n", this, __FUNCTION__, input_fd,
+            is_fd_owned ? " (closed)" : "", rb);
 }
 
 /**
- * Function that uses POSIX select() API to detect input availability on a
- * file descriptor. The file descriptor has been duped from the original
- * (as extracted from a FILE stream) and has been set to non-blocking mode.
- * So when data is available to be read, it will be read using read() API
- * in non-blocking manner until read() indicates there is no more data to
- * be read; then returns back to the select() call.
+ * Function that waits (via poll(), per signal_handling::wait_readable()) for
+ * input availability on a file descriptor. The file descriptor has been set to
+ * non-blocking mode. So when data is available to be read, it will be read
+ * using read() API in non-blocking manner until read() indicates there is no
+ * more data to be read.
  *
  * A line of text as ended by either LF or CRLF convention is appended
  * to the supplied std::string in/out reference parameter.
@@ -106,8 +127,9 @@ read_buf_ctx::~read_buf_ctx() {
  *
  * @param output_strbuf
  * @return EXIT_SUCCESS when no error condition encountered, EXIT_FAILURE if
- * was an error, EINTR if a signal terminated a call to select() or the call
- * to read(), or EOF if end of input condition encountered
+ * was an error, EINTR if shutdown was requested while waiting or reading,
+ * EAGAIN if input was drained before a line ending was seen (the line fragment
+ * read so far is in output_strbuf), or EOF if end of input condition encountered
  */
 int read_buf_ctx::read_line_on_ready(std::string &output_strbuf) {
   if (this->eof_flag) {
@@ -115,49 +137,21 @@ int read_buf_ctx::read_line_on_ready(std::string &output_strbuf) {
   }
 
   int rc = EXIT_SUCCESS;
-  fd_set rfd_set{0};
-  struct timeval tv{5, 0}; // Wait up to five seconds
 
-  FD_ZERO(&rfd_set);
-  FD_SET(this->orig_fd, &rfd_set); // select on the original file descriptor
-
-  int highest_fd = -1;
-  for(int i = 0; i < FD_SETSIZE; i++) {
-    if (FD_ISSET(i, &rfd_set) && i > highest_fd) {
-      highest_fd = i;
-    }
+  /* Watch input stream to see when it has input. */
+  auto const ret_val = signal_handling::wait_readable(this->input_fd); int line_nbr = __LINE__;
+  if (ret_val == EINTR) {
+    return ret_val; // shutdown requested so bail out immediately
   }
-
-  while(!signal_handling::interrupted()) {
-    /* Watch input stream to see when it has input. */
-    auto ret_val = select(highest_fd + 1, &rfd_set, nullptr, nullptr, &tv); int line_nbr = __LINE__;
-    /* Don't rely on the value of tv now! */
-    if (ret_val == -1) {
-      const auto ec = errno;
-      if (ec == EINTR) {
-        return ec; // signal for exiting condition detected so bail out immediately
-      }
-      fprintf(stderr, "ERROR: %d: %s() -> select(): %s\n", line_nbr, __FUNCTION__, strerror(ec));
-      return EXIT_FAILURE;
-    }
-
-    if (ret_val > 0) {
-      if (FD_ISSET(this->orig_fd, &rfd_set)) {
-        fputs("DEBUG: Data is available now:\n", stderr);
-        read_line_core(output_strbuf, rc);
-      }
-      break;
-    }
-
-    /* Wait up to five seconds. */
-    tv.tv_sec = 5;
-    tv.tv_usec = 0;
-
-    FD_ZERO(&rfd_set);
-    FD_SET(this->orig_fd, &rfd_set); // select on the original file descriptor
+  if (ret_val == -1) {
+    LOG_ERROR("%d: %s() -> poll(): %s\n", line_nbr, __FUNCTION__, strerror(errno));
+    return EXIT_FAILURE;
   }
 
-  return signal_handling::interrupted() ? EINTR : rc; // the dup file descriptor is closed by smart pointer
+  LOG_TRACE("Data is available now:\n");
+  read_line_core(output_strbuf, rc);
+
+  return signal_handling::interrupted() ? EINTR : rc;
 }
 
 int read_buf_ctx::read_line(std::string &output_strbuf) {
@@ -169,24 +163,48 @@ int read_buf_ctx::read_line(std::string &output_strbuf) {
 
   read_line_core(output_strbuf, rc);
 
-  return signal_handling::interrupted() ? EINTR : rc; // the dup file descriptor is closed by smart pointer
+  return signal_handling::interrupted() ? EINTR : rc;
 }
 
 int read_buf_ctx::handle_eof_slop(std::string &output_strbuf) {
-  bool eol = false;
+  if (consume_buffered_lines(output_strbuf)) {
+    return this->pos > 0 ? EXIT_SUCCESS : EOF;
+  }
   if (this->pos > 0) {
-      // insure any content in the read buffer gets appended to the string buffer
-      const char * const end = this->read_buffer + this->pos;
-      char * const pLF = this->read_buffer;
-      assert(pLF < end);
-      eol = find_next_eol(pLF, end, output_strbuf);
+    // insure any trailing line fragment in the read buffer gets appended to the string buffer
+    find_next_eol(this->read_buffer, this->read_buffer + this->pos, output_strbuf);
+  }
+  return EOF;
+}
+
+bool read_buf_ctx::has_buffered_line() const {
+  return this->pos > 0 && memchr(this->read_buffer, '\n', this->pos) != nullptr;
+}
+
+/**
+ * Consumes complete lines that are already sitting in the read buffer (left
+ * over from a prior read() call) until one is obtained that is not sampled out.
+ *
+ * @return true if a line was appended to output_strbuf
+ */
+bool read_buf_ctx::consume_buffered_lines(std::string &output_strbuf) {
+  while (this->pos > 0 && memchr(this->read_buffer, '\n', this->pos) != nullptr) {
+    if (find_next_eol(this->read_buffer, this->read_buffer + this->pos, output_strbuf)) {
+      return true;
     }
-  return eol && this->pos > 0 ? EXIT_SUCCESS : EOF;
+  }
+  return false;
 }
 
 bool read_buf_ctx::find_next_eol(char *pLF, const char * const end, std::string &output_strbuf) {
   bool eol = false;
 
+  if (!this->line_open) {
+    // start of a new line - decide up front whether the line is to be kept
+    this->line_open = true;
+    this->skip_line = this->sampling && !sample_line();
+  }
+
   pLF = strchr(pLF, '\n');
   if (pLF != nullptr) {
     *pLF = '\0'; // the LF is changed to a null to be a valid C string termination
@@ -199,10 +217,18 @@ bool read_buf_ctx::find_next_eol(char *pLF, const char * const end, std::string
       if (*pPrevCh == '\r') {
         *pPrevCh = '\0'; // now null terminate to valid C string at where CR is found
       }
-      output_strbuf += this->read_buffer; // append a text line fragment that has a detected eol condition
-    } else if (!output_strbuf.empty() && output_strbuf.back() == '\r') {
+      if (!this->skip_line) {
+        output_strbuf += this->read_buffer; // append a text line fragment that has a detected eol condition
+      }
+    } else if (!this->skip_line && !output_strbuf.empty() && output_strbuf.back() == '\r') {
       output_strbuf.pop_back(); // remove the CR at end of string buffer
     }
+    this->line_open = false;
+    this->lines_in++;
+    metrics::local().lines.add(1);
+    if (this->stats != nullptr) {
+      this->stats->lines.add(1);
+    }
 
     this->pos = 0;
 
@@ -216,41 +242,77 @@ bool read_buf_ctx::find_next_eol(char *pLF, const char * const end, std::string
 //      fprintf(stderr, "TRACE2: %p %03u '%s'\n", (void *) this->read_buffer, count, this->read_buffer);
     }
   } else if (end > this->read_buffer) {
-    output_strbuf += this->read_buffer; // append a text line fragment (no eol detected)
+    if (!this->skip_line) {
+      output_strbuf += this->read_buffer; // append a text line fragment (no eol detected)
+    }
     this->pos = 0;
   }
 
-  return eol;
+  return eol && !this->skip_line; // a line sampled out does not count as having reached an eol
 }
 
 void read_buf_ctx::read_line_core(std::string &output_strbuf, int &rc) {
+  // a prior read() may have left one or more complete lines in the read buffer,
+  // so consume from those before asking the file descriptor for more input
+  if (consume_buffered_lines(output_strbuf)) return;
+
   bool had_data; // flag which indicates whether to keep reading input
   bool eol = false;
   do {
     char * const rd_buf_base =  this->read_buffer + this->pos;
     const auto rd_buf_size = this->read_buf_limit - this->pos;
-    const auto n = read(this->dup_fd, rd_buf_base, rd_buf_size);
+    auto &counters = metrics::local();
+    auto const read_start_ns = metrics::now_ns();
+    const auto n = read(this->input_fd, rd_buf_base, rd_buf_size);
+    counters.read_latency.record(metrics::now_ns() - read_start_ns);
     had_data = n > 0;
+    counters.read_calls.add(1);
+    if (had_data) {
+      this->bytes_in += static_cast<uint64_t>(n);
+      counters.bytes_read.add(static_cast<uint64_t>(n));
+    }
+    if (this->stats != nullptr) {
+      this->stats->read_calls.add(1);
+      if (had_data) {
+        this->stats->bytes_read.add(static_cast<uint64_t>(n));
+        this->stats->last_read_ns.set(metrics::coarse_now_ns());
+      }
+    }
     if (had_data) {
+      if (this->record_stream >= 0) {
+        stream_record::chunk(this->record_stream, rd_buf_base, static_cast<size_t>(n));
+      }
       char *const end = &rd_buf_base[n];
       *end = '\0';  /* null terminate the read buffer contents to be a valid C string   */
       /* (the buffer is sized to allow for a terminating null character)  */
 //      fprintf(stderr, "TRACE1: %p %03lu '%s'\n", (void *) rd_buf_base, n, rd_buf_base);
       char * const pLF = this->read_buffer;
       assert(pLF < end);
-      eol = find_next_eol(pLF, end, output_strbuf);
+      eol = find_next_eol(pLF, end, output_strbuf) || consume_buffered_lines(output_strbuf);
+      if (!eol && this->line_fragment_limit > 0 && output_strbuf.size() >= this->line_fragment_limit) {
+        rc = E2BIG; // the line read so far is to be consumed before the rest of it is read
+        break;
+      }
     } else if (n == 0) { // indicates end-of-file condition was encountered by read() call
-      fprintf(stderr, "DEBUG: %d %s() -> eof reached\n", __LINE__, __FUNCTION__);
+      LOG_DEBUG("%d %s() -> eof reached\n", __LINE__, __FUNCTION__);
+      if (this->record_stream >= 0) {
+        stream_record::eof(this->record_stream);
+      }
       rd_buf_base[n] = '\0'; // insure is null terminated to a valid C string
       this->eof_flag = true;
-      if (this->pos > 0) {
-        // insure any content in the read buffer gets appended to the string buffer
-        const char * const end = rd_buf_base;
-        char * const pLF = this->read_buffer;
-        assert(pLF < end);
-        eol = find_next_eol(pLF, end, output_strbuf);
+      rc = handle_eof_slop(output_strbuf);
+    } else {
+      const auto ec = errno;
+      if (ec == EAGAIN || ec == EWOULDBLOCK) {
+        rc = EAGAIN; // no complete line available yet - any line fragment read so far is in output_strbuf
+        counters.eagain.add(1);
+        if (this->stats != nullptr) {
+          this->stats->eagain.add(1);
+        }
+      } else {
+        LOG_ERROR("%d: %s() -> read(): %s\n", __LINE__, __FUNCTION__, strerror(ec));
+        rc = EXIT_FAILURE;
       }
-      rc = eol && this->pos > 0 ? EXIT_SUCCESS : EOF;
     }
   } while(had_data && !eol);
 }
\ No newline at end of file
@@ -21,45 +21,69 @@ limitations under the License.
 #define READ_BUF_CTX_H
 
 #include <cstdio>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <functional>
+#include "metrics.h"
 
 using fd_t = class read_buf_ctx;
 
 class read_buf_ctx final {
 private:
-  const int orig_fd;
-  int dup_fd = -1;
+  const int input_fd;
+  bool is_nonblocking = false;  // input_fd was put in non-blocking mode (it is read as is - never dup()'d)
+  bool is_fd_owned = false;     // input_fd is closed along with this object
   char * const read_buffer;
   const u_int read_buf_limit;
   u_int pos = 0;
   bool eof_flag = false;
   bool is_stderr_flag = false;
+  bool line_open = false;       // a line has been started but its eol not yet seen
+  bool skip_line = false;       // the open line was sampled out and is being discarded
+  bool sampling = false;
+  uint32_t sample_threshold = 0;
+  uint32_t sample_state = 0;
+  metrics::stream_stats *stats = nullptr;
+  int record_stream = -1;       // stream number in an input arrival recording (-1 when not recorded)
+  size_t line_fragment_limit = 0; // 0 means lines are read whole however long they are
+  uint64_t bytes_in = 0;        // read from the input so far
+  uint64_t lines_in = 0;        // line endings consumed so far (sampled out lines included)
   friend void test();
   friend struct read_buf_ctx_pair;
   friend class read_multi_stream;
+  friend struct read_buf_ctx_bench;
 public:
   read_buf_ctx() = delete;
   read_buf_ctx(const read_buf_ctx &) = delete;
   read_buf_ctx& operator=(const read_buf_ctx &) = delete;
   explicit read_buf_ctx(int input_fd, u_int read_buf_size = 128);
-  read_buf_ctx(read_buf_ctx &&rbc) noexcept : orig_fd(-1), read_buffer(nullptr), read_buf_limit(0) {
+  read_buf_ctx(read_buf_ctx &&rbc) noexcept : input_fd(-1), read_buffer(nullptr), read_buf_limit(0) {
     *this = std::move(rbc);
   }
   read_buf_ctx& operator=(read_buf_ctx &&rbc) noexcept;
   ~read_buf_ctx();
-  bool is_valid_init() const { return orig_fd >= 0 && dup_fd != -1; }
+  bool is_valid_init() const { return input_fd >= 0 && is_nonblocking; }
+  // the input file descriptor is to be closed when this object is destructed
+  void take_fd_ownership() { is_fd_owned = true; }
   bool is_stderr_stream() const { return is_stderr_flag; }
+  void set_sample_rate(double rate, uint32_t seed);
+  void set_stats(metrics::stream_stats *stream_stats) { stats = stream_stats; }
+  void set_record_stream(int stream) { record_stream = stream; }
+  // once a line being read reaches this many bytes, read_line() returns E2BIG so the fragment can be consumed
+  void set_line_fragment_limit(size_t limit) { line_fragment_limit = limit; }
+  uint64_t get_bytes_read() const { return bytes_in; }
+  uint64_t get_lines_read() const { return lines_in; }
+  // a complete line is in the read buffer, so can be read without the input being ready
+  bool has_buffered_line() const;
   int read_line_on_ready(std::string &output_strbuf);
   int read_line(std::string &output_strbuf);
 private:
   int handle_eof_slop(std::string &output_strbuf);
   bool find_next_eol(char *pLF, const char *end, std::string &output_strbuf);
+  bool consume_buffered_lines(std::string &output_strbuf);
+  bool sample_line();
   void read_line_core(std::string &output_strbuf, int &rc);
-  friend void close_dup_fd(fd_t *p);
-  using fd_close_dup_t = std::function<void(fd_t *)>;
-  std::unique_ptr<fd_t, fd_close_dup_t> sp_input_fd;
   using rbc_free_buf_t = std::function<void(void*)>;
   std::unique_ptr<void, rbc_free_buf_t> sp_read_buf_rb;
 };
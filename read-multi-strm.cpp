@@ -21,9 +21,14 @@ limitations under the License.
 #include <unistd.h>
 #include <cstring>
 #include <poll.h>
+#include <sys/eventfd.h>
 #include <cassert>
+#include <algorithm>
 #include "read-multi-strm.h"
 #include "signal-handling.h"
+#include "logging.h"
+#include "metrics.h"
+#include "tracing.h"
 
 #define DBG_VERIFY 1
 
@@ -35,46 +40,79 @@ extern "C" void __assert (const char *__assertion, const char *__file, int __lin
 __THROW __attribute__ ((__noreturn__));
 
 read_multi_stream::read_multi_stream(u_int const read_buf_size) : read_buf_size(read_buf_size) {
-  fprintf(stderr, "DEBUG: read_buf_size: %u\n", read_buf_size);
+  LOG_DEBUG("read_buf_size: %u\n", read_buf_size);
+  open_wake_fd();
 }
 
-read_buf_ctx* read_multi_stream::lookup_mutable_read_buf_ctx(int fd) const {
-  auto search = fd_map.find(fd);
-  if (search != fd_map.end()) {
-    auto const &sp_entry = search->second;
-    if (sp_entry->get_stdout_fd() == fd) {
-      return &sp_entry->stdout_ctx;
-    }
-    if (sp_entry->get_stderr_fd() == fd) {
-      return &sp_entry->stderr_ctx;
-    }
+void read_multi_stream::open_wake_fd() {
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd == -1) {
+    LOG_ERROR("%d: %s() -> eventfd(): %s\n", __LINE__, __FUNCTION__, strerror(errno));
   }
-  return nullptr;
+}
+
+/**
+ * Wakes the thread polling in the reactor loop (or the next to poll), which
+ * then runs its cycle callback without dispatching any stream - e.g. to
+ * reconsider which streams are paused or filtered. Callable from any thread.
+ */
+void read_multi_stream::wake() {
+  if (wake_fd == -1) return;
+  uint64_t const one = 1;
+  while (write(wake_fd, &one, sizeof(one)) == -1 && errno == EINTR) {}
+}
+
+read_buf_ctx* read_multi_stream::lookup_mutable_read_buf_ctx(int fd) const {
+  auto const slot = streams.find(fd);
+  return slot != nullptr ? slot->rbc : nullptr;
+}
+
+/**
+ * Returns the other file descriptor of the stdout/stderr pair that the
+ * specified file descriptor belongs to, or -1 if it is not (or no longer)
+ * registered.
+ */
+int read_multi_stream::get_paired_fd(int fd) const {
+  auto const slot = streams.find(fd);
+  if (slot == nullptr) return -1;
+  return streams.find(slot->paired_fd) != nullptr ? slot->paired_fd : -1;
 }
 
 void read_multi_stream::verify_added_elem(const read_buf_ctx_pair &elem,
                                           int stdout_fd, int stderr_fd, u_int read_buffer_size)
 {
 #if DBG_VERIFY
-  assert(&fd_map.at(stdout_fd)->stdout_ctx == &elem.stdout_ctx);
-  assert(&fd_map.at(stderr_fd)->stderr_ctx == &elem.stderr_ctx);
-  assert(elem.stdout_ctx.orig_fd == stdout_fd);
+  assert(streams.find(stdout_fd)->rbc == &elem.stdout_ctx);
+  assert(streams.find(stderr_fd)->rbc == &elem.stderr_ctx);
+  assert(elem.stdout_ctx.input_fd == stdout_fd);
   assert(elem.stdout_ctx.read_buf_limit == (read_buffer_size - 1));
-  assert(elem.stderr_ctx.orig_fd == stderr_fd);
+  assert(elem.stderr_ctx.input_fd == stderr_fd);
   assert(elem.stderr_ctx.read_buf_limit == (read_buffer_size - 1));
-  fprintf(stderr,
-          "DEBUG: added vector element read_buf_ctx_pair: %p\n"
-          "DEBUG: stdout_fd: %d, stderr_fd: %d, read_buffer_size: %u\n",
-          &elem, elem.stdout_ctx.orig_fd, elem.stderr_ctx.orig_fd, read_buffer_size);
+  LOG_DEBUG("added stream table entries of read_buf_ctx_pair: %p\n", &elem);
+  LOG_DEBUG("stdout_fd: %d, stderr_fd: %d, read_buffer_size: %u\n",
+            elem.stdout_ctx.input_fd, elem.stderr_ctx.input_fd, read_buffer_size);
 #endif
 }
 
 void read_multi_stream::add_entry_to_map(int stdout_fd, int stderr_fd, u_int read_buffer_size) {
-  auto sp_shared_item = std::make_shared<read_buf_ctx_pair>(stdout_fd, stderr_fd, read_buffer_size);
-  fd_map.insert(std::make_pair(stdout_fd, sp_shared_item));
-  fd_map.insert(std::make_pair(stderr_fd, sp_shared_item));
-  auto &elem = *sp_shared_item.get();
+  auto sp_pair = std::make_unique<read_buf_ctx_pair>(stdout_fd, stderr_fd, read_buffer_size);
+  auto &elem = *sp_pair;
   elem.stderr_ctx.is_stderr_flag = true;
+  // the streams' file descriptors are closed once the pair is let go (after both of them are removed)
+  elem.stdout_ctx.take_fd_ownership();
+  elem.stderr_ctx.take_fd_ownership();
+  stream_handler_slot stdout_slot{};
+  stdout_slot.rbc = &elem.stdout_ctx;
+  stdout_slot.handler = &elem.stdout_handler;
+  stdout_slot.paired_fd = stderr_fd;
+  stdout_slot.sp_pair = std::move(sp_pair);
+  stream_handler_slot stderr_slot{};
+  stderr_slot.rbc = &elem.stderr_ctx;
+  stderr_slot.handler = &elem.stderr_handler;
+  stderr_slot.paired_fd = stdout_fd;
+  stderr_slot.is_stderr = true;
+  streams.insert(stdout_fd, std::move(stdout_slot));
+  streams.insert(stderr_fd, std::move(stderr_slot));
 #if DBG_VERIFY
   verify_added_elem(elem, stdout_fd, stderr_fd, read_buffer_size);
 #endif
@@ -84,12 +122,14 @@ void read_multi_stream::add_entry_to_map(int stdout_fd, int stderr_fd, u_int rea
 read_multi_stream::read_multi_stream(int const stdout_fd, int const stderr_fd, u_int const read_buf_size)
     : read_buf_size(read_buf_size)
 {
+  open_wake_fd();
   add_entry_to_map(stdout_fd, stderr_fd, read_buf_size);
 }
 
 read_multi_stream::read_multi_stream(std::tuple<int, int> fd_pair, u_int const read_buf_size)
     : read_buf_size(read_buf_size)
 {
+  open_wake_fd();
   int const stdout_fd = std::get<0>(fd_pair);
   int const stderr_fd = std::get<1>(fd_pair);
   add_entry_to_map(stdout_fd, stderr_fd, read_buf_size);
@@ -98,22 +138,23 @@ read_multi_stream::read_multi_stream(std::tuple<int, int> fd_pair, u_int const r
 read_multi_stream::read_multi_stream(std::initializer_list<std::tuple<int, int>> init, u_int const read_buf_size)
     : read_buf_size(read_buf_size)
 {
+  open_wake_fd();
   for(auto const &fd_pair : init) {
     int const stdout_fd = std::get<0>(fd_pair);
     int const stderr_fd = std::get<1>(fd_pair);
 
-    fprintf(stderr, "DEBUG: stdout_fd: %d, stderr_fd: %d\n", stdout_fd, stderr_fd);
+    LOG_DEBUG("stdout_fd: %d, stderr_fd: %d\n", stdout_fd, stderr_fd);
 
     add_entry_to_map(stdout_fd, stderr_fd, read_buf_size);
   }
-  fprintf(stderr, "DEBUG: read_buf_size: %u\n", read_buf_size);
+  LOG_DEBUG("read_buf_size: %u\n", read_buf_size);
 }
 
 read_multi_stream& read_multi_stream::operator +=(std::tuple<int, int> fd_pair) {
   int const stdout_fd = std::get<0>(fd_pair);
   int const stderr_fd = std::get<1>(fd_pair);
 
-  fprintf(stderr, "DEBUG: stdout_fd: %d, stderr_fd: %d\n", stdout_fd, stderr_fd);
+  LOG_DEBUG("stdout_fd: %d, stderr_fd: %d\n", stdout_fd, stderr_fd);
 
   add_entry_to_map(stdout_fd, stderr_fd, read_buf_size);
 
@@ -121,64 +162,312 @@ read_multi_stream& read_multi_stream::operator +=(std::tuple<int, int> fd_pair)
 }
 
 read_multi_stream::~read_multi_stream() {
-  fprintf(stderr, "DEBUG: << (%p)->%s()\n", this, __FUNCTION__);
+  LOG_DEBUG("<< (%p)->%s()\n", this, __FUNCTION__);
+  if (wake_fd != -1) {
+    close(wake_fd);
+  }
+}
+
+/**
+ * Removes the stream of the specified file descriptor. May be called by a
+ * stream handler while the reactor is dispatching a poll cycle - a stream
+ * removed that way will not have its handler invoked in that cycle. Once both
+ * streams of a pair are removed, their read contexts are let go of (closing
+ * their file descriptors) - at the end of the dispatch cycle, if within one.
+ */
+bool read_multi_stream::remove(int const fd) {
+  auto const slot = streams.find(fd);
+  if (slot == nullptr) return false;
+  auto sp_pair = std::move(slot->sp_pair);
+  auto const paired_slot = streams.find(slot->paired_fd);
+  if (sp_pair) {
+    if (paired_slot != nullptr && paired_slot->rbc == (slot->is_stderr ? &sp_pair->stdout_ctx : &sp_pair->stderr_ctx)) {
+      paired_slot->sp_pair = std::move(sp_pair); // the other stream of the pair is still registered
+    } else {
+      retire(std::move(sp_pair));
+    }
+  }
+  streams.erase(fd);
+  return true;
+}
+
+/**
+ * Lets go of a pair of read contexts - deferred while dispatching, as the
+ * handler then running may yet be reading through one of them.
+ */
+void read_multi_stream::retire(std::unique_ptr<read_buf_ctx_pair> sp_pair) {
+  if (is_dispatching) {
+    retired.push_back(std::move(sp_pair));
+  }
+}
+
+/**
+ * Registers the handler that the reactor loop - dispatch_ready() and
+ * run_until_idle() - invokes directly with the read context of the stream
+ * when it is ready, along with the user data given here (e.g. the caller's
+ * output context for the stream), so that no lookups are needed per ready
+ * file descriptor.
+ *
+ * @return false if the file descriptor is not registered
+ */
+bool read_multi_stream::set_handler(int const fd, stream_handler_t handler, void * const user_data) {
+  auto const slot = streams.find(fd);
+  if (slot == nullptr) return false;
+  *slot->handler = std::move(handler);
+  slot->user_data = user_data;
+  return true;
+}
+
+/**
+ * A paused stream stays registered but is left out of polling - and so out
+ * of dispatch - until resumed; its pipe fills meanwhile, which blocks the
+ * process writing to it.
+ */
+bool read_multi_stream::set_paused(int const fd, bool const is_paused) {
+  auto const slot = streams.find(fd);
+  if (slot == nullptr) return false;
+  slot->is_paused = is_paused;
+  return true;
+}
+
+/**
+ * A stream's share of each round's quantum (see set_quantum()); 1 by default.
+ */
+bool read_multi_stream::set_weight(int const fd, unsigned const weight) {
+  auto const slot = streams.find(fd);
+  if (slot == nullptr || weight == 0) return false;
+  slot->weight = weight;
+  return true;
 }
 
 int read_multi_stream::poll_for_io(std::vector<pollfd_result> &active_fds) {
+  return poll_for_io(active_fds, nullptr);
+}
+
+/**
+ * Polls only those file descriptors for which the filter predicate returns
+ * true (all of them when the filter is empty). File descriptors filtered out
+ * remain registered, they just don't participate in this poll cycle.
+ */
+int read_multi_stream::poll_for_io(std::vector<pollfd_result> &active_fds, const poll_filter_t &filter) {
   active_fds.clear();
-  const struct timespec timeout_ts{ 3, 0 };
-  sigset_t sigset;
-  sigemptyset(&sigset);
-  sigaddset(&sigset, SIGINT);
-  sigaddset(&sigset, SIGTERM);
-
-  // stack-allocate array of struct pollfd and zero initialize its memory space
-  const auto fds_count = fd_map.size();
+  auto const rc = poll_ready_streams(filter);
+  for(const auto &ready : ready_streams) {
+    active_fds.push_back({.fd = ready.fd, .revents = ready.revents});
+  }
+  ready_streams.clear();
+  return rc;
+}
+
+/**
+ * Polls once (per poll_for_io() filtering) and invokes the handler of each
+ * ready stream directly with its read context.
+ *
+ * @return 0 once the handlers have been invoked, EINTR if a signal interrupted
+ * polling, or -1 if there is nothing left to poll or polling failed
+ */
+int read_multi_stream::dispatch_ready(const poll_filter_t &filter) {
+  auto const rc = poll_ready_streams(filter);
+  if (rc == 0) {
+    order_ready_streams();
+    round++;
+    bool const is_drr = quantum.bytes > 0 || quantum.lines > 0;
+    is_dispatching = true;
+    for(const auto &ready : ready_streams) {
+      // removed by a handler invoked earlier in this cycle (its fd possibly since reused)?
+      if (!streams.is_current(ready.fd, ready.generation)) continue;
+      // the slot is only referred to up to invoking the handler, which may add or remove streams
+      auto &slot = *streams.find(ready.fd);
+      assert(*slot.handler); // every stream is expected to have been given a handler
+      if (!*slot.handler) {
+        LOG_WARN("ready file descriptor %d has no handler - skipping\n", ready.fd);
+        continue;
+      }
+      auto &rbc = *slot.rbc;
+      stream_quantum budget{};
+      if (is_drr) {
+        // the stream is credited its weighted quantum; it is not served while still in debt from overshooting
+        slot.deficit_bytes += static_cast<int64_t>(quantum.bytes * slot.weight);
+        slot.deficit_lines += static_cast<int64_t>(quantum.lines * slot.weight);
+        if ((quantum.bytes > 0 && slot.deficit_bytes <= 0) || (quantum.lines > 0 && slot.deficit_lines <= 0)) {
+          slot.is_backlogged = true;
+          continue;
+        }
+        budget.bytes = quantum.bytes > 0 ? static_cast<uint64_t>(slot.deficit_bytes) : 0;
+        budget.lines = quantum.lines > 0 ? static_cast<uint64_t>(slot.deficit_lines) : 0;
+      }
+      slot.bytes_mark = rbc.get_bytes_read();
+      slot.lines_mark = rbc.get_lines_read();
+      slot.last_round = round;
+      slot.is_served = true;
+      auto &handler = *slot.handler;
+      handler(rbc, {ready.fd, ready.revents, ready_ns, slot.user_data, budget});
+    }
+    is_dispatching = false;
+    retired.clear();
+  }
+  ready_streams.clear();
+  return rc;
+}
+
+/**
+ * Runs the reactor loop - dispatch_ready() repeatedly - until no streams
+ * remain, a signal interrupts it, or the cycle callback returns false.
+ *
+ * @return 0, EINTR if a signal interrupted polling, or -1 if polling failed
+ */
+int read_multi_stream::run_until_idle(const cycle_callback_t &on_cycle_end, const poll_filter_t &filter) {
+  int rc{0};
+  while (!streams.empty() && !signal_handling::interrupted()) {
+    rc = dispatch_ready(filter);
+    if (rc == -1) {
+      // nothing (left) to poll is idle - only a failed poll() is an error
+      return streams.empty() ? 0 : rc;
+    }
+    if (on_cycle_end && !on_cycle_end()) break;
+  }
+  return signal_handling::interrupted() ? EINTR : rc;
+}
+
+/**
+ * Orders the ready streams for service: stdout streams ahead of stderr
+ * streams and, within each, the least recently served first - rather than in
+ * the order of the stream table, which would favor the same streams every
+ * cycle.
+ */
+void read_multi_stream::order_ready_streams() {
+  auto const service_key = [this](const ready_stream &ready) {
+    auto const &slot = *streams.find(ready.fd);
+    return std::make_tuple(slot.is_stderr, slot.last_round);
+  };
+  std::stable_sort(ready_streams.begin(), ready_streams.end(),
+                   [&service_key](const ready_stream &lhs, const ready_stream &rhs) {
+    return service_key(lhs) < service_key(rhs);
+  });
+}
+
+/**
+ * Charges a stream served by the last dispatch with the input its handler
+ * consumed (which, for a handler that hands the reading off to another thread,
+ * is only known once that is done - hence when next polled). A stream that
+ * stopped short of its budget was drained, and an idle stream banks no credit.
+ *
+ * @return true if the stream stopped at its budget with a line still buffered,
+ * so is ready though its file descriptor may not be
+ */
+bool read_multi_stream::settle_served(stream_handler_slot &slot) const {
+  auto const &rbc = *slot.rbc;
+  if (slot.is_served) {
+    slot.is_served = false;
+    slot.deficit_bytes -= static_cast<int64_t>(rbc.get_bytes_read() - slot.bytes_mark);
+    slot.deficit_lines -= static_cast<int64_t>(rbc.get_lines_read() - slot.lines_mark);
+    bool const is_at_budget = (quantum.bytes > 0 && slot.deficit_bytes <= 0) ||
+                              (quantum.lines > 0 && slot.deficit_lines <= 0);
+    if (!is_at_budget) {
+      slot.deficit_bytes = 0;
+      slot.deficit_lines = 0;
+    }
+    slot.is_backlogged = is_at_budget;
+  }
+  return slot.is_backlogged && rbc.has_buffered_line();
+}
+
+/**
+ * Fills ready_streams with the streams (of those taking part per the filter)
+ * that poll() reports as ready - plus any stopped at their budget with a
+ * line still buffered, in which case poll() does not wait. Otherwise poll()
+ * waits without a timeout: the shutdown eventfd and the wake eventfd are in
+ * the poll set too, so a shutdown request or a wake() ends the wait at once.
+ *
+ * @return 0 (with ready_streams left empty when woken by wake()), EINTR on
+ * shutdown, or -1 if there is nothing to poll or polling failed
+ */
+int read_multi_stream::poll_ready_streams(const poll_filter_t &filter) {
+  ready_streams.clear();
+  if (signal_handling::interrupted()) return EINTR;
+
+  // the poll set is kept in member vectors, reused from cycle to cycle - sized
+  // per the streams (which may be many thousands) it is not stack allocated
+  const auto fds_count = streams.size();
   if (fds_count == 0) return -1; // no file descriptors remaining to poll on
-  const auto pollfd_array_size = sizeof(struct pollfd) * fds_count;
-  auto const pollfd_array = (struct pollfd*) alloca(pollfd_array_size);
-  memset(pollfd_array, 0, pollfd_array_size);
-
-  // set fds to be polled as entries in pollfd_array
-  // (requesting event notice of when ready to read)
-  auto it = fd_map.begin();
-  unsigned int i = 0, j = 0;
-  for(; i < fds_count; i++) {
-    if (it == fd_map.end()) break; // when reach iteration end of fd_map
-    auto &rfd = pollfd_array[i];
-    rfd.fd = it->first;
+  pollfd_array.resize(fds_count + 2);
+  poll_backlog.resize(fds_count);
+  unsigned int backlog_count = 0;
+
+  // set fds to be polled as entries in pollfd_array (requesting event notice of
+  // when ready to read) - a linear walk of the stream table's dense entries
+  unsigned int i = 0, paused = 0;
+  for(size_t k = 0; k < fds_count; k++) {
+    auto &slot = streams.at(k);
+    if (slot.is_paused) {
+      paused++;
+      continue;
+    }
+    auto const fd = streams.fd_at(k);
+    if (filter && !filter(fd)) continue; // not taking part in this poll cycle
+    poll_backlog[i] = settle_served(slot);
+    backlog_count += poll_backlog[i] ? 1 : 0;
+    auto &rfd = pollfd_array[i++];
+    rfd.fd = fd;
     rfd.events = POLLIN;
-    j++;
-    it++; // advance fd_map iterator to next element of fd_map
+    rfd.revents = 0;
   }
-  if (i != j && i != fds_count) {
-    __assert("number of struct pollfd entries assigned to not equal to fd_map entries count", __FILE__, __LINE__);
+  if (!filter && i + paused != fds_count) {
+    __assert("number of struct pollfd entries assigned to not equal to stream table entries count", __FILE__, __LINE__);
   }
-
-  while(!signal_handling::interrupted()) {
+  if (i == 0) return -1; // every file descriptor was filtered out (or paused)
+  const auto poll_count = i;
+  // the control file descriptors follow the streams (a negative fd is ignored by poll())
+  auto &shutdown_pfd = pollfd_array[poll_count];
+  shutdown_pfd.fd = signal_handling::shutdown_fd();
+  shutdown_pfd.events = POLLIN;
+  shutdown_pfd.revents = 0;
+  auto &wake_pfd = pollfd_array[poll_count + 1];
+  wake_pfd.fd = wake_fd;
+  wake_pfd.events = POLLIN;
+  wake_pfd.revents = 0;
+
+  tracing::span poll_span{"poll_for_io", "poll"};
+  poll_span.arg("fds", poll_count);
+
+  for(;;) {
     /* Watch input streams to see when have input. */
     int line_nbr = __LINE__ + 1;
-    auto ret_val = ppoll(pollfd_array, fds_count, &timeout_ts, &sigset);
+    auto ret_val = poll(pollfd_array.data(), poll_count + 2, backlog_count > 0 ? 0 : -1);
+    auto &counters = metrics::local();
+    counters.poll_calls.add(1);
     if (ret_val == -1) {
       const auto ec = errno;
-      if (ec == EINTR) {
-        return ec; // signal interruption detected so bail out immediately
-      }
-      fprintf(stderr, "ERROR: %d: %s() -> ppoll(): %s\n", line_nbr, __FUNCTION__, strerror(ec));
+      if (ec == EINTR) continue; // the handled signals are blocked - this is some other (ignored) signal
+      LOG_ERROR("%d: %s() -> poll(): %s\n", line_nbr, __FUNCTION__, strerror(ec));
       return -1;
     }
+    if (shutdown_pfd.revents != 0 || signal_handling::interrupted()) {
+      return EINTR; // shutdown requested so bail out immediately
+    }
+    if (wake_pfd.revents != 0) {
+      uint64_t count;
+      while (read(wake_fd, &count, sizeof(count)) == -1 && errno == EINTR) {}
+      counters.poll_wakeups.add(1);
+      poll_span.arg("woken", 1);
+      return 0;
+    }
 
-    if (ret_val > 0) {
-      bool any_ready = false;
-      for(i = 0; i < fds_count; i++) {
+    if (ret_val > 0 || backlog_count > 0) {
+      ready_ns = metrics::now_ns();
+      for(i = 0; i < poll_count; i++) {
         const auto &rfd = pollfd_array[i];
-        if (rfd.revents != 0) {
-          active_fds.push_back({.fd = rfd.fd, .revents = rfd.revents});
-          any_ready = true;
+        if (rfd.revents != 0 || poll_backlog[i]) {
+          ready_streams.push_back({rfd.fd, static_cast<short>(rfd.revents | (poll_backlog[i] ? POLLIN : 0)),
+                                   streams.generation(rfd.fd)});
         }
       }
-      if (any_ready) {
-        fputs("DEBUG: Data is available now:\n", stderr);
+      if (!ready_streams.empty()) {
+        counters.poll_wakeups.add(1);
+        counters.ready_fds.add(ready_streams.size());
+        counters.max_ready_fds.set_max(ready_streams.size());
+        LOG_TRACE("Data is available now:\n");
+        poll_span.arg("ready", static_cast<int64_t>(ready_streams.size()));
         break;
       }
     }
@@ -188,7 +477,7 @@ int read_multi_stream::poll_for_io(std::vector<pollfd_result> &active_fds) {
 }
 
 void test() {
-  fprintf(stderr, "DEBUG: >> %s()\n", __FUNCTION__);
+  LOG_DEBUG(">> %s()\n", __FUNCTION__);
   auto fd_1 = dup(STDIN_FILENO);
   auto fd_2 = dup(STDIN_FILENO);
   auto fd_3 = dup(STDIN_FILENO);
@@ -201,24 +490,16 @@ void test() {
   read_multi_stream rms({std::make_tuple(fd_1, fd_2), std::make_tuple(fd_3, fd_4), std::make_tuple(fd_5, fd_6)}, 512);
   rms += std::make_tuple(fd_7, fd_8);
 
-  std::unordered_map<int, const read_buf_ctx*> seen{};
   int count = 0;
-  for(auto const &kv : rms.fd_map) {
+  for(auto const &[fd, slot] : rms.streams) {
     count++;
-    auto const &rbc_stdout = kv.second->stdout_ctx;
-    auto const &rbc_stderr = kv.second->stderr_ctx;
-    auto search1 = seen.find(rbc_stdout.orig_fd);
-    if (search1 != seen.end()) continue;
-    seen.insert(std::make_pair(rbc_stdout.orig_fd, &rbc_stdout));
-    auto search2 = seen.find(rbc_stderr.orig_fd);
-    if (search2 == seen.end()) {
-      seen.insert(std::make_pair(rbc_stderr.orig_fd, &rbc_stderr));
-    }
-    fprintf(stderr,
-            "DEBUG: this: %p, stdout_fd: %03d, dup: %03d, read_buffer: %p\n"
-            "       this: %p, stderr_fd: %03d, dup: %03d, read_buffer: %p\n",
-            &rbc_stdout, rbc_stdout.orig_fd, rbc_stdout.dup_fd, (void *) rbc_stdout.read_buffer,
-            &rbc_stderr, rbc_stderr.orig_fd, rbc_stderr.dup_fd, (void *) rbc_stderr.read_buffer);
+    if (slot.is_stderr) continue; // logged along with its stdout stream
+    auto const &rbc_stdout = *slot.rbc;
+    auto const &rbc_stderr = *rms.streams.find(slot.paired_fd)->rbc;
+    LOG_DEBUG("this: %p, stdout_fd: %03d, read_buffer: %p\n"
+              "       this: %p, stderr_fd: %03d, read_buffer: %p\n",
+              &rbc_stdout, rbc_stdout.input_fd, (void *) rbc_stdout.read_buffer,
+              &rbc_stderr, rbc_stderr.input_fd, (void *) rbc_stderr.read_buffer);
   }
-  fprintf(stderr, "DEBUG: << %s(), count: %d\n", __FUNCTION__, count);
+  LOG_DEBUG("<< %s(), count: %d\n", __FUNCTION__, count);
 }
\ No newline at end of file
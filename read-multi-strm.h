@@ -21,35 +21,85 @@ limitations under the License.
 #define READ_MULTI_STRM_H
 
 #include <sys/types.h>
+#include <poll.h>
+#include <cstdint>
+#include <memory>
 #include <tuple>
 #include <vector>
-#include <unordered_map>
+#include <functional>
 #include <cassert>
 #include "read-buf-ctx.h"
+#include "fd-table.h"
 
 u_int const default_read_buf_size = 128;
 
+/* Input that a stream is served per round of dispatch - in bytes and in lines (0 is unbounded) */
+struct stream_quantum {
+  uint64_t bytes{0};
+  uint64_t lines{0};
+};
+
+uint64_t const default_sched_quantum_bytes = 256 * 1024;
+
+/* Describes a ready stream to its handler when dispatched by the reactor loop */
+struct stream_event {
+  int fd;             /* File descriptor that is ready. */
+  short int revents;  /* Types of events that actually occurred. */
+  uint64_t ready_ns;  /* When poll() returned, per metrics::now_ns(). */
+  void *user_data;    /* As given when the handler was registered. */
+  stream_quantum budget; /* Input the handler should stop reading at, once consumed. */
+};
+
+/* Invoked by the reactor loop with the read context of a ready stream */
+using stream_handler_t = std::function<void(read_buf_ctx &rbc, const stream_event &event)>;
+
+/* Invoked after every poll cycle's handlers have run; returning false ends run_until_idle() */
+using cycle_callback_t = std::function<bool()>;
+
+/*
+ * The stdout and stderr read contexts of an input, and their handlers - heap
+ * allocated, so that their addresses are stable (a handler may remove streams,
+ * its own included, while it runs).
+ */
 struct read_buf_ctx_pair {
   read_buf_ctx stdout_ctx;
   read_buf_ctx stderr_ctx;
+  stream_handler_t stdout_handler{};
+  stream_handler_t stderr_handler{};
   // deletes default constructor and copy constructor
   read_buf_ctx_pair() = delete;
   read_buf_ctx_pair(const read_buf_ctx_pair&) = delete;
-  // supports one constructor taking arguments and a default move constructor
-  read_buf_ctx_pair(read_buf_ctx_pair &&) noexcept = default;
-  // this constructor is used for emplace construction into vector
   read_buf_ctx_pair(int stdout_fd, int stderr_fd, u_int read_buf_size)
       : stdout_ctx(stdout_fd, read_buf_size), stderr_ctx(stderr_fd, read_buf_size) {}
-  // supports move-only assignment semantics
   read_buf_ctx_pair& operator=(const read_buf_ctx_pair &) = delete;
-  read_buf_ctx_pair& operator=(read_buf_ctx_pair && rbcp) noexcept {
-    this->stdout_ctx = std::move(rbcp.stdout_ctx);
-    this->stderr_ctx = std::move(rbcp.stderr_ctx);
-    return *this;
-  }
   ~read_buf_ctx_pair() = default;
-  int get_stdout_fd() { return stdout_ctx.orig_fd; }
-  int get_stderr_fd() { return stderr_ctx.orig_fd; }
+  int get_stdout_fd() const { return stdout_ctx.input_fd; }
+  int get_stderr_fd() const { return stderr_ctx.input_fd; }
+};
+
+/*
+ * The hot per stream state of the reactor: the entries of its flat fd-indexed
+ * stream table. A polled fd leads straight to its handler and read context -
+ * no hash lookup, and no reference counting on the ready path.
+ */
+struct stream_handler_slot {
+  read_buf_ctx *rbc{nullptr};
+  stream_handler_t *handler{nullptr};
+  void *user_data{nullptr};
+  int paired_fd{-1};      // the other stream of the stdout/stderr pair
+  bool is_stderr{false};
+  bool is_paused{false};  // left out of the poll set until resumed
+  bool is_served{false};      // dispatched, and its consumption not yet settled
+  bool is_backlogged{false};  // stopped at its budget, so may have a line buffered that poll can't report
+  // deficit round robin state - see read_multi_stream::set_quantum()
+  unsigned weight{1};
+  int64_t deficit_bytes{0};
+  int64_t deficit_lines{0};
+  uint64_t bytes_mark{0};     // the stream's input consumed, as of its last dispatch
+  uint64_t lines_mark{0};
+  uint64_t last_round{0};     // the dispatch round that it was last served in
+  // owns the pair of read contexts - held by whichever of the pair's streams is still registered
+  std::unique_ptr<read_buf_ctx_pair> sp_pair{};
 };
 
 /* Data structure describing a polling request result  */
@@ -58,8 +108,26 @@ struct pollfd_result {
   short int revents;  /* Types of events that actually occurred. */
 };
 
+/* Predicate deciding whether a file descriptor takes part in a given poll cycle */
+using poll_filter_t = std::function<bool(int fd)>;
+
 class read_multi_stream final {
-  std::unordered_map<int, std::shared_ptr<read_buf_ctx_pair>> fd_map;
+  // a ready stream of the current poll cycle - the generation tells whether a handler has removed it since
+  struct ready_stream {
+    int fd;
+    short int revents;
+    uint32_t generation;
+  };
+  fd_table<stream_handler_slot> streams{};
+  std::vector<std::unique_ptr<read_buf_ctx_pair>> retired{}; // removed during dispatch - let go of once it is done
+  bool is_dispatching{false};
+  std::vector<ready_stream> ready_streams{};
+  std::vector<struct pollfd> pollfd_array{};   // the poll set of a cycle, plus the shutdown and wake eventfds
+  std::vector<char> poll_backlog{};
+  uint64_t ready_ns{0};
+  stream_quantum quantum{};
+  uint64_t round{0};
+  int wake_fd{-1};    // eventfd in the poll set, signaled by wake()
   u_int const read_buf_size{0};
   friend class read_buf_ctx;
   friend void test();
@@ -73,19 +141,42 @@ public:
   read_multi_stream& operator +=(std::tuple<int, int> fd_pair);
   read_multi_stream(read_multi_stream &&rms) noexcept : read_buf_size{0} { *this = std::move(rms); }
   read_multi_stream& operator=(read_multi_stream &&rms) noexcept {
-    fd_map = std::move(rms.fd_map);
+    streams = std::move(rms.streams);
+    retired = std::move(rms.retired);
+    ready_streams = std::move(rms.ready_streams);
+    pollfd_array = std::move(rms.pollfd_array);
+    poll_backlog = std::move(rms.poll_backlog);
+    quantum = rms.quantum;
+    round = rms.round;
+    std::swap(wake_fd, rms.wake_fd);
     *const_cast<u_int*>(&read_buf_size) = rms.read_buf_size;
     return *this;
   }
   ~read_multi_stream();
   int poll_for_io(std::vector<pollfd_result> &active_fds);
-  size_t size() const { return fd_map.size(); }
+  int poll_for_io(std::vector<pollfd_result> &active_fds, const poll_filter_t &filter);
+  bool set_handler(int fd, stream_handler_t handler, void *user_data = nullptr);
+  int dispatch_ready(const poll_filter_t &filter = nullptr);
+  int run_until_idle(const cycle_callback_t &on_cycle_end = nullptr, const poll_filter_t &filter = nullptr);
+  size_t size() const { return streams.size(); }
   read_buf_ctx* get_mutable_read_buf_ctx(int fd) { return lookup_mutable_read_buf_ctx(fd); }
   const read_buf_ctx* get_read_buf_ctx(int fd) const { return lookup_mutable_read_buf_ctx(fd); }
-  bool remove(int fd) { return fd_map.erase(fd) > 0; }
+  bool remove(int fd);
+  void set_quantum(stream_quantum q) { quantum = q; }
+  bool set_weight(int fd, unsigned weight);
+  bool pause(int fd) { return set_paused(fd, true); }
+  bool resume(int fd) { return set_paused(fd, false); }
+  int get_paired_fd(int fd) const;
+  void wake();
 private:
+  void open_wake_fd();
   read_buf_ctx* lookup_mutable_read_buf_ctx(int fd) const;
+  int poll_ready_streams(const poll_filter_t &filter);
+  bool settle_served(stream_handler_slot &slot) const;
+  void order_ready_streams();
+  bool set_paused(int fd, bool is_paused);
   void verify_added_elem(const read_buf_ctx_pair &elem, int stdout_fd, int stderr_fd, u_int read_buffer_size);
+  void retire(std::unique_ptr<read_buf_ctx_pair> sp_pair);
   void add_entry_to_map(int stdout_fd, int stderr_fd, u_int read_buffer_size);
 };
 
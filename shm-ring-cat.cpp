@@ -0,0 +1,90 @@
+/* shm-ring-cat.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*
+ * Example consumer of a shared memory ring sink (rd-multi-strm -sink shm:<name>):
+ * reads the batches of lines in place through shm_ring::reader and writes them
+ * to stdout - or, with -count, only counts them - until the writer closes the
+ * ring. The ring's shared memory object is unlinked at the end unless -keep.
+ * It waits (up to 10 seconds) for the writer to create the ring.
+ *
+ * usage: shm-ring-cat [-count] [-keep] <name>
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <chrono>
+#include "shm-ring.h"
+
+int main(int argc, char **argv) {
+  bool is_count_only = false;
+  bool is_keep = false;
+  std::string name{};
+  for(int i = 1; i < argc; i++) {
+    std::string_view const arg{argv[i]};
+    if (arg == "-count") {
+      is_count_only = true;
+    } else if (arg == "-keep") {
+      is_keep = true;
+    } else {
+      name = arg;
+    }
+  }
+  if (name.empty()) {
+    fprintf(stderr, "usage: shm-ring-cat [-count] [-keep] <name>\n");
+    return EXIT_FAILURE;
+  }
+  if (!name.starts_with('/')) {
+    name.insert(0, 1, '/');
+  }
+
+  shm_ring::reader ring{};
+  int ec = ENOENT;
+  for(int tries = 0; tries < 1000 && (ec = ring.open(name.c_str())) != 0; tries++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  if (ec != 0) {
+    fprintf(stderr, "shm-ring-cat: opening \"%s\": %s\n", name.c_str(), strerror(ec));
+    return EXIT_FAILURE;
+  }
+
+  uint64_t batches = 0, bytes = 0;
+  for(;;) {
+    auto const batch = ring.next();
+    if (batch.empty()) {
+      if (ring.is_done()) break;
+      continue;
+    }
+    batches++;
+    bytes += batch.size();
+    if (!is_count_only && fwrite(batch.data(), 1, batch.size(), stdout) != batch.size()) {
+      perror("shm-ring-cat: writing stdout");
+      return EXIT_FAILURE;
+    }
+  }
+  fflush(stdout);
+  fprintf(stderr, "shm-ring-cat: %lu batches, %lu bytes\n", batches, bytes);
+  if (!is_keep) {
+    shm_unlink(name.c_str());
+  }
+  return EXIT_SUCCESS;
+}
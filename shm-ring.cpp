@@ -0,0 +1,148 @@
+/* shm-ring.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <algorithm>
+#include "logging.h"
+#include "signal-handling.h"
+#include "shm-ring.h"
+
+namespace shm_ring {
+
+  static constexpr size_t min_capacity = 64 * 1024;
+  static constexpr long space_wait_ms = 100; // re-checks now and then, should a wake-up be missed
+
+  writer::~writer() {
+    if (hdr != nullptr) {
+      munmap(hdr, map_size);
+    }
+  }
+
+  int writer::create(std::string_view const shm_name, size_t const capacity) {
+    // a POSIX shared memory object is named with a single leading slash
+    name.clear();
+    name.reserve(shm_name.size() + 1);
+    if (!shm_name.starts_with('/')) {
+      name += '/';
+    }
+    name += shm_name;
+    size_t cap = min_capacity;
+    while (cap < capacity) {
+      cap <<= 1;
+    }
+    auto const fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+      auto const ec = errno;
+      LOG_ERROR("%d: %s() -> shm_open(\"%s\"): %s\n", __LINE__, __FUNCTION__, name.c_str(), strerror(ec));
+      return ec;
+    }
+    map_size = header_size + cap;
+    if (ftruncate(fd, static_cast<off_t>(map_size)) == -1) {
+      auto const ec = errno;
+      LOG_ERROR("%d: %s() -> ftruncate(\"%s\"): %s\n", __LINE__, __FUNCTION__, name.c_str(), strerror(ec));
+      ::close(fd);
+      return ec;
+    }
+    auto const base = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    auto const ec = errno;
+    ::close(fd);
+    if (base == MAP_FAILED) {
+      LOG_ERROR("%d: %s() -> mmap(\"%s\"): %s\n", __LINE__, __FUNCTION__, name.c_str(), strerror(ec));
+      return ec;
+    }
+    // the object is zero filled - which is the initial state of the positions, sequences and flags
+    hdr = static_cast<header*>(base);
+    data = static_cast<char*>(base) + header_size;
+    hdr->version = ring_version;
+    hdr->data_offset = header_size;
+    hdr->capacity = cap;
+    std::atomic_thread_fence(std::memory_order_release);
+    hdr->magic = ring_magic; // last - a reader checks it
+    LOG_DEBUG("created shared memory ring \"%s\" of %lu bytes\n", name.c_str(), cap);
+    return 0;
+  }
+
+  // waits for the reader to release room for size bytes - given up (EINTR) once the program is interrupted,
+  // as a reader that has gone away (or never came) would have it wait for good
+  int writer::wait_for_space(uint64_t const size) {
+    auto const cap = hdr->capacity;
+    for(;;) {
+      auto const seq = hdr->space_seq.load(std::memory_order_seq_cst);
+      if (cap - (pos - hdr->read_pos.load(std::memory_order_seq_cst)) >= size) return 0;
+      if (signal_handling::interrupted()) return EINTR;
+      hdr->is_writer_waiting.store(1, std::memory_order_seq_cst);
+      if (cap - (pos - hdr->read_pos.load(std::memory_order_seq_cst)) < size) {
+        futex_wait(hdr->space_seq, seq, space_wait_ms);
+      }
+      hdr->is_writer_waiting.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void writer::publish() {
+    hdr->write_pos.store(pos, std::memory_order_seq_cst);
+    hdr->data_seq.fetch_add(1, std::memory_order_seq_cst);
+    if (hdr->is_reader_waiting.load(std::memory_order_seq_cst) != 0) {
+      futex_wake(hdr->data_seq);
+    }
+  }
+
+  int writer::write_record(const char *const payload, uint32_t const len) {
+    auto const size = record_size(len);
+    auto const mask = hdr->capacity - 1;
+    auto const tail = hdr->capacity - (pos & mask);
+    if (tail < size) {
+      // the pad is published on its own, so the reader releases its space while the record waits for room
+      if (auto const ec = wait_for_space(tail); ec != 0) return ec;
+      memcpy(data + (pos & mask), &pad_length, sizeof(pad_length));
+      pos += tail;
+      publish();
+    }
+    if (auto const ec = wait_for_space(size); ec != 0) return ec;
+    auto const record = data + (pos & mask);
+    memcpy(record, &len, sizeof(len));
+    memcpy(record + record_header_size, payload, len);
+    pos += size;
+    publish();
+    return 0;
+  }
+
+  int writer::write(std::string_view lines) {
+    // no more than half the ring per record, so a record always fits once the reader has caught up - and a
+    // length that fits the 32 bit record header without being taken for pad_length
+    auto const max_payload = std::min<uint64_t>(hdr->capacity / 2 - record_header_size, pad_length - 1);
+    while (!lines.empty()) {
+      auto len = std::min<size_t>(lines.size(), max_payload);
+      if (len < lines.size()) {
+        auto const eol = lines.rfind('\n', len - 1);
+        if (eol != std::string_view::npos) {
+          len = eol + 1; // else a line longer than a record is split
+        }
+      }
+      if (auto const ec = write_record(lines.data(), static_cast<uint32_t>(len)); ec != 0) return ec;
+      lines.remove_prefix(len);
+    }
+    return 0;
+  }
+
+  void writer::close() {
+    if (hdr == nullptr) return;
+    hdr->is_closed.store(1, std::memory_order_seq_cst);
+    hdr->data_seq.fetch_add(1, std::memory_order_seq_cst);
+    futex_wake(hdr->data_seq);
+  }
+}
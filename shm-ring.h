@@ -0,0 +1,225 @@
+/* shm-ring.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <climits>
+#include <cerrno>
+#include <ctime>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <string>
+#include <string_view>
+
+/*
+ * A single producer, single consumer ring buffer of line batches in a POSIX
+ * shared memory object (shm_open()), through which the merged output sink (see
+ * output-sink.h) hands the decompressed lines to a consumer process on the
+ * same host: the consumer reads each batch in place, in the shared mapping -
+ * no copy through a pipe or file, and no system call while there is data.
+ *
+ * The mapping is a header page followed by the data area (a power of 2 in
+ * size). The data area holds records, each an 8 byte record header - the
+ * payload length, and 4 bytes reserved - then the payload (complete lines),
+ * padded to a multiple of 8 bytes. A record is never split by the end of the
+ * data area: a record header of length pad_length there marks the rest of the
+ * area as unused, and the next record starts at offset 0.
+ *
+ * write_pos and read_pos grow monotonically (a position in the data area is
+ * taken modulo its size). Each side waits on a futex word of the shared header
+ * - data_seq for the reader, space_seq for the writer - which the other side
+ * bumps, waking it only when its is_*_waiting flag is set. So a reader that
+ * keeps up makes no system calls, and neither does the writer while the ring
+ * has room.
+ *
+ * The writer is the program itself; the reader below is all a C++ consumer
+ * needs (it is header only); a consumer in another language needs only the
+ * layout of shm_ring::header and the protocol above.
+ */
+namespace shm_ring {
+  constexpr uint64_t ring_magic = 0x474e4952534d5244ULL; // "DRMSRING"
+  constexpr uint32_t ring_version = 1;
+  constexpr uint32_t pad_length = UINT32_MAX;
+  constexpr size_t header_size = 4096;
+  constexpr size_t record_header_size = 8;
+
+  struct header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t data_offset;                            // of the data area, from the start of the mapping
+    uint64_t capacity;                               // of the data area - a power of 2
+    alignas(64) std::atomic<uint64_t> write_pos;     // past the last record published
+    alignas(64) std::atomic<uint64_t> read_pos;      // past the last record released by the reader
+    alignas(64) std::atomic<uint32_t> data_seq;      // bumped by each publication, and by close
+    std::atomic<uint32_t> is_reader_waiting;
+    std::atomic<uint32_t> is_closed;                 // the writer is done - what remains is the last of it
+    alignas(64) std::atomic<uint32_t> space_seq;     // bumped by each release
+    std::atomic<uint32_t> is_writer_waiting;
+  };
+  static_assert(sizeof(header) <= header_size);
+  static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free);
+
+  constexpr uint64_t record_size(uint64_t const payload_len) {
+    return (record_header_size + payload_len + 7) & ~uint64_t{7};
+  }
+
+  // the futexes are shared between processes, so not FUTEX_PRIVATE_FLAG
+  inline void futex_wait(std::atomic<uint32_t> &word, uint32_t const expected, long const timeout_ms) {
+    timespec ts{timeout_ms / 1000, (timeout_ms % 1000) * 1000000};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, timeout_ms >= 0 ? &ts : nullptr,
+            nullptr, 0);
+  }
+
+  inline void futex_wake(std::atomic<uint32_t> &word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+  }
+
+  // the producer side: creates the shared memory object and publishes batches of lines to it
+  class writer final {
+    std::string name{};
+    header *hdr{nullptr};
+    char *data{nullptr};
+    size_t map_size{0};
+    uint64_t pos{0};
+    int wait_for_space(uint64_t size);
+    void publish();
+    int write_record(const char *payload, uint32_t len);
+  public:
+    writer() = default;
+    writer(const writer &) = delete;
+    writer& operator=(const writer &) = delete;
+    ~writer();
+
+    // creates (or recreates) the named shared memory object; capacity is rounded up to a power of 2
+    int create(std::string_view shm_name, size_t capacity);
+    // writes complete lines as one or more records - waiting, when the ring is full, for the reader to release some;
+    // returns 0, or EINTR should the program be interrupted while waiting
+    int write(std::string_view lines);
+    // marks the ring closed, so the reader ends once it has drained it; the object is left for the reader to unlink
+    void close();
+    const std::string& get_name() const { return name; }
+  };
+
+  // the consumer side
+  class reader final {
+    header *hdr{nullptr};
+    const char *data{nullptr};
+    size_t map_size{0};
+    uint64_t pos{0};       // past the record last handed out
+    bool is_held{false};   // a record has been handed out, and is released by the next call
+    void release() {
+      hdr->read_pos.store(pos, std::memory_order_seq_cst);
+      hdr->space_seq.fetch_add(1, std::memory_order_seq_cst);
+      if (hdr->is_writer_waiting.load(std::memory_order_seq_cst) != 0) {
+        futex_wake(hdr->space_seq);
+      }
+      is_held = false;
+    }
+  public:
+    reader() = default;
+    reader(const reader &) = delete;
+    reader& operator=(const reader &) = delete;
+    ~reader() {
+      if (hdr != nullptr) {
+        if (is_held) {
+          release();
+        }
+        munmap(hdr, map_size);
+      }
+    }
+
+    // opens the named shared memory object that a writer created; returns 0, or an errno value
+    int open(const char *const shm_name) {
+      auto const fd = shm_open(shm_name, O_RDWR | O_CLOEXEC, 0);
+      if (fd == -1) return errno;
+      struct stat st{};
+      if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < header_size) {
+        ::close(fd);
+        return EINVAL;
+      }
+      map_size = static_cast<size_t>(st.st_size);
+      auto const base = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (base == MAP_FAILED) return errno;
+      hdr = static_cast<header*>(base);
+      if (hdr->magic != ring_magic || hdr->version != ring_version ||
+          hdr->data_offset + hdr->capacity != map_size) {
+        munmap(base, map_size);
+        hdr = nullptr;
+        return EINVAL;
+      }
+      data = static_cast<const char*>(base) + hdr->data_offset;
+      pos = hdr->read_pos.load(std::memory_order_acquire);
+      return 0;
+    }
+
+    /*
+     * Releases the batch handed out before, and waits - up to timeout_ms, or
+     * for good when negative - for the next: complete lines, viewed in place in
+     * the shared mapping. Empty on timeout, or once the writer has closed the
+     * ring and it is drained (see is_done()).
+     */
+    std::string_view next(long const timeout_ms = -1) {
+      if (is_held) {
+        release();
+      }
+      auto const mask = hdr->capacity - 1;
+      for(;;) {
+        auto const seq = hdr->data_seq.load(std::memory_order_seq_cst);
+        auto const end = hdr->write_pos.load(std::memory_order_acquire);
+        if (pos != end) {
+          uint32_t len;
+          memcpy(&len, data + (pos & mask), sizeof(len));
+          if (len == pad_length) {
+            pos += hdr->capacity - (pos & mask);
+            release(); // the writer may be waiting on just this space, to write the record that follows
+            continue;
+          }
+          std::string_view const batch{data + (pos & mask) + record_header_size, len};
+          pos += record_size(len);
+          is_held = true;
+          return batch;
+        }
+        if (hdr->is_closed.load(std::memory_order_acquire) != 0) return {};
+        hdr->is_reader_waiting.store(1, std::memory_order_seq_cst);
+        if (hdr->write_pos.load(std::memory_order_seq_cst) == end && hdr->is_closed.load() == 0) {
+          futex_wait(hdr->data_seq, seq, timeout_ms);
+        }
+        hdr->is_reader_waiting.store(0, std::memory_order_relaxed);
+        if (timeout_ms >= 0 && hdr->write_pos.load(std::memory_order_acquire) == end) return {};
+      }
+    }
+
+    // the writer has closed the ring and every record has been read
+    bool is_done() const {
+      return hdr->is_closed.load(std::memory_order_acquire) != 0 &&
+             pos == hdr->write_pos.load(std::memory_order_acquire);
+    }
+  };
+}
+
+#endif //SHM_RING_H
@@ -18,49 +18,134 @@ limitations under the License.
 
 */
 #include <csignal>
-#include <cassert>
+#include <cstring>
+#include <cerrno>
 #include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
 #include "signal-handling.h"
+#include "logging.h"
 
 namespace signal_handling {
 
-  volatile sig_atomic_t quit_flag{0};
+  std::atomic_int quit_flag{0};
 
-  static void signal_callback_handler(int /*sig*/) { // can be called asynchronously
+  static int shutdown_event_fd{-1};
+  static sigset_t handled_signals;
+  static std::mutex stats_guard;
+  static stats_request_handler_t stats_request_handler{};
+
+  int shutdown_fd() { return shutdown_event_fd; }
+
+  /**
+   * Signals shutdown: sets the quit flag and makes the shutdown eventfd
+   * readable - for good (it is never read), so every poll set that includes
+   * it wakes up now and stays woken.
+   */
+  void request_shutdown() {
     quit_flag = 1;
-//    fprintf(stderr, "DEBUG: << %s(sig: %d)\n", __FUNCTION__, sig);
+    if (shutdown_event_fd != -1) {
+      uint64_t const one = 1;
+      while (write(shutdown_event_fd, &one, sizeof(one)) == -1 && errno == EINTR) {}
+    }
   }
 
-  void set_signals_handler() {
-    static std::mutex guard;
-    std::unique_lock<std::mutex> lk(guard);
-    quit_flag = 0;
-    signal(SIGINT, signal_callback_handler);
-    signal(SIGTERM, signal_callback_handler);
-    signal(SIGTSTP, signal_callback_handler);
+  void set_stats_request_handler(stats_request_handler_t handler) {
+    std::lock_guard<std::mutex> lk(stats_guard);
+    stats_request_handler = std::move(handler);
   }
 
-  static int ctrl_z_handler_sig = SIGINT;
-  static ctrl_z_handler_t ctrl_z_handler{[](int /*sig*/) { signal_callback_handler(SIGINT); }};
+  // receives the process's signals - they are blocked in every other thread
+  static void signal_thread_main(int const signal_fd) {
+    for(;;) {
+      signalfd_siginfo info{};
+      auto const n = read(signal_fd, &info, sizeof(info));
+      if (n == -1 && errno == EINTR) continue;
+      if (n != static_cast<ssize_t>(sizeof(info))) {
+        LOG_ERROR("%d: %s() -> read(signalfd): %s\n", __LINE__, __FUNCTION__, strerror(errno));
+        return;
+      }
+      auto const sig = static_cast<int>(info.ssi_signo);
+      if (sig == SIGUSR1) {
+        std::lock_guard<std::mutex> lk(stats_guard);
+        if (stats_request_handler) {
+          stats_request_handler();
+        }
+        continue;
+      }
+      LOG_DEBUG("received signal %d (%s) - shutting down\n", sig, strsignal(sig));
+      request_shutdown();
+    }
+  }
 
-  static void signal_callback_ctrl_z_handler(int sig) { // can be called asynchronously
-    assert(sig == SIGTSTP);
-    auto const sav_cb = signal(ctrl_z_handler_sig, SIG_IGN);
-    ctrl_z_handler.operator()(ctrl_z_handler_sig);
-    signal(ctrl_z_handler_sig, sav_cb);
-//    fprintf(stderr, "DEBUG: << %s(sig: %d)\n", __FUNCTION__, sig);
+  /**
+   * Blocks the handled signals (SIGINT, SIGTERM, SIGTSTP and SIGUSR1) and
+   * starts a thread that receives them via a signalfd. Must be called before
+   * any other thread is started, as the threads inherit the signal mask.
+   */
+  void set_signals_handler() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+      quit_flag = 0;
+      sigemptyset(&handled_signals);
+      sigaddset(&handled_signals, SIGINT);
+      sigaddset(&handled_signals, SIGTERM);
+      sigaddset(&handled_signals, SIGTSTP);
+      sigaddset(&handled_signals, SIGUSR1);
+      auto rc = pthread_sigmask(SIG_BLOCK, &handled_signals, nullptr);
+      if (rc != 0) {
+        LOG_ERROR("%d: %s() -> pthread_sigmask(): %s\n", __LINE__, __FUNCTION__, strerror(rc));
+        return;
+      }
+      shutdown_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+      if (shutdown_event_fd == -1) {
+        LOG_ERROR("%d: %s() -> eventfd(): %s\n", __LINE__, __FUNCTION__, strerror(errno));
+      }
+      auto const signal_fd = signalfd(-1, &handled_signals, SFD_CLOEXEC);
+      if (signal_fd == -1) {
+        LOG_ERROR("%d: %s() -> signalfd(): %s\n", __LINE__, __FUNCTION__, strerror(errno));
+        return;
+      }
+      std::thread{signal_thread_main, signal_fd}.detach();
+    });
   }
 
-  void register_ctrl_z_handler(ctrl_z_handler_t cb) {
-    register_ctrl_z_handler(SIGINT, std::move(cb));
+  /**
+   * To be called in a forked child process before it execs (or runs) its
+   * program: unblocks the signals blocked by set_signals_handler(), so that
+   * e.g. SIGTERM terminates it as usual.
+   */
+  void reset_child_signals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGTSTP);
+    sigaddset(&signals, SIGUSR1);
+    sigprocmask(SIG_UNBLOCK, &signals, nullptr);
   }
 
-  void register_ctrl_z_handler(int sig, ctrl_z_handler_t cb) {
-    static std::mutex guard;
-    std::unique_lock<std::mutex> lk(guard);
-    ctrl_z_handler_sig = sig;
-    ctrl_z_handler = std::move(cb);
-    signal(SIGTSTP, signal_callback_ctrl_z_handler);
+  /**
+   * Waits until the file descriptor is ready to read, or shutdown is
+   * requested.
+   *
+   * @return 0 when ready, EINTR on shutdown, or -1 if poll() failed
+   */
+  int wait_readable(int const fd) {
+    struct pollfd pfds[2] = {{fd, POLLIN, 0}, {shutdown_event_fd, POLLIN, 0}};
+    auto const nfds = shutdown_event_fd != -1 ? 2 : 1;
+    while (!interrupted()) {
+      auto const rc = poll(pfds, static_cast<nfds_t>(nfds), -1);
+      if (rc == -1) {
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      if (pfds[0].revents != 0) return 0;
+    }
+    return EINTR;
   }
 
 }
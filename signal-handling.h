@@ -23,14 +23,28 @@ limitations under the License.
 #include <cstdlib>
 #include <csignal>
 #include <functional>
-
+#include <atomic>
+
+/*
+ * The signals that stop the program (SIGINT, SIGTERM and SIGTSTP) and that
+ * request a metrics report (SIGUSR1) are blocked in every thread and received
+ * by a dedicated thread via a signalfd. Shutdown sets the quit flag and makes
+ * the shutdown eventfd readable, which the poll sets include - so a blocked
+ * poll wakes at once, rather than polling having to time out periodically to
+ * check the flag.
+ */
 namespace signal_handling {
   void set_signals_handler();
-  using ctrl_z_handler_t = std::function<void(int)>;
-  void register_ctrl_z_handler(ctrl_z_handler_t /*handler*/);
-  void register_ctrl_z_handler(int /*sig*/, ctrl_z_handler_t /*handler*/);
-  extern volatile sig_atomic_t quit_flag;
+  void reset_child_signals();
+  extern std::atomic_int quit_flag;
   inline bool interrupted() { return quit_flag != 0; }
+  void request_shutdown();
+  // an eventfd that becomes readable (and stays so) once shutdown is requested; -1 if unavailable
+  int shutdown_fd();
+  int wait_readable(int fd);
+  // invoked on the signal thread per each SIGUSR1 received - a request to report a snapshot of the program's metrics
+  using stats_request_handler_t = std::function<void()>;
+  void set_stats_request_handler(stats_request_handler_t handler);
 }
 
 #endif //SIGNAL_HANDLING_H
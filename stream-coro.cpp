@@ -0,0 +1,289 @@
+/* stream-coro.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <cassert>
+#include <cxxabi.h>
+#include "stream-coro.h"
+#include "signal-handling.h"
+#include "util.h"
+#include "logging.h"
+#include "metrics.h"
+#include "tracing.h"
+
+void stream_task::promise_type::final_awaiter::await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+  auto const strm = h.promise().strm;
+  strm->scheduler.on_completed(strm);
+}
+
+void stream_task::promise_type::unhandled_exception() {
+  const auto ex_nm = get_unmangled_name(abi::__cxa_current_exception_type()->name());
+  LOG_ERROR("stream coroutine of fd %d terminated by unhandled exception of type %s\n",
+            strm != nullptr ? strm->fd : -1, ex_nm.c_str());
+  rc = EXIT_FAILURE;
+}
+
+/**
+ * Reads the next line into the string buffer, carrying any line fragment
+ * over from a prior EAGAIN. Once at end of input (or failed), keeps
+ * returning that status.
+ *
+ * @return EXIT_SUCCESS, E2BIG, EAGAIN, EINTR, or the final status EOF or EXIT_FAILURE
+ */
+int line_stream::read_next() {
+  if (is_piece_pending) {
+    is_piece_pending = false;
+    current = piece_buf;
+    return E2BIG;
+  }
+  if (is_line_complete) {
+    str_buf.clear();
+    is_line_complete = false;
+  }
+  if (is_eof) return final_rc;
+  auto const rc = rbc.read_line(str_buf);
+  switch (rc) {
+    case EXIT_SUCCESS:
+      is_line_complete = true;
+      is_line_spilled = false;
+      current = str_buf;
+      return rc;
+    case E2BIG: {
+      // the piece is moved aside, holding back a trailing CR (dropped should the LF of a CRLF come next)
+      bool const is_cr_held = str_buf.back() == '\r';
+      if (is_cr_held) {
+        str_buf.pop_back();
+      }
+      piece_buf.swap(str_buf);
+      str_buf.clear();
+      if (is_cr_held) {
+        str_buf.push_back('\r');
+      }
+      is_line_spilled = true;
+      current = piece_buf;
+      return rc;
+    }
+    case EOF:
+    case EXIT_FAILURE:
+      is_eof = true;
+      final_rc = rc;
+      if (!str_buf.empty() || is_line_spilled) {
+        is_line_complete = true; // last line of input was not newline terminated
+        is_line_spilled = false;
+        current = str_buf;
+        return EXIT_SUCCESS;
+      }
+      return rc;
+    default:
+      return rc; // EAGAIN or EINTR
+  }
+}
+
+int line_stream::fill_batch(size_t const max_lines) {
+  batch.clear();
+  size_t n = 0;
+  int rc = EXIT_SUCCESS;
+  while (n < max_lines && (rc = read_next()) == EXIT_SUCCESS) {
+    if (batch_bufs.size() <= n) {
+      batch_bufs.emplace_back();
+    }
+    batch_bufs[n++].swap(str_buf); // the swapped in string is cleared by the next read_next()
+  }
+  if (rc == E2BIG) {
+    if (n == 0) {
+      batch.emplace_back(piece_buf); // a piece of an overlong line is a batch of its own
+      return E2BIG;
+    }
+    is_piece_pending = true; // returned by the next await, after the complete lines before it
+  }
+  for(size_t i = 0; i < n; i++) {
+    batch.emplace_back(batch_bufs[i]);
+  }
+  return n > 0 ? EXIT_SUCCESS : rc; // EOF etc is returned by the await after the last lines
+}
+
+int line_stream::complete_pending_op() {
+  switch (pending_op) {
+    case await_op::LINE:
+      return op_rc = read_next();
+    case await_op::BATCH:
+      return op_rc = fill_batch(pending_max_lines);
+    default:
+      return EXIT_SUCCESS;
+  }
+}
+
+void line_stream::suspend(std::coroutine_handle<> h, await_op const op, size_t const max_lines) {
+  waiter = h;
+  pending_op = op;
+  pending_max_lines = max_lines;
+  is_armed = true;
+  scheduler.on_suspended(); // must be the last touch of this stream - the reactor may now poll it again
+}
+
+coro_scheduler::coro_scheduler(read_multi_stream &rms, unsigned thread_count) : rms{rms} {
+  if (thread_count == 0) {
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  on_ready = [this](read_buf_ctx &, const stream_event &event) {
+    auto const strm = static_cast<line_stream*>(event.user_data);
+    strm->is_armed = false;
+    post(strm, event.ready_ns);
+  };
+  pool.reserve(thread_count);
+  for(unsigned i = 0; i < thread_count; i++) {
+    pool.emplace_back(&coro_scheduler::pool_thread_main, this, i);
+  }
+  LOG_DEBUG("coroutine scheduler pool threads: %u\n", thread_count);
+}
+
+coro_scheduler::~coro_scheduler() {
+  {
+    std::lock_guard<std::mutex> lk{mtx};
+    is_shutdown = true;
+  }
+  work_cv.notify_all();
+  for(auto &thrd : pool) {
+    thrd.join();
+  }
+  for(auto const &[fd, sp_strm] : streams) {
+    rms.remove(fd);
+  }
+}
+
+/**
+ * Starts a coroutine to process the stream of the specified file descriptor
+ * (which must be registered with the read_multi_stream). The coroutine first
+ * runs once the stream is ready.
+ *
+ * @return false if the file descriptor is not registered
+ */
+bool coro_scheduler::spawn(int const fd, const stream_coroutine_t &coroutine, void * const user_data) {
+  auto const prbc = rms.get_mutable_read_buf_ctx(fd);
+  if (prbc == nullptr) return false;
+  auto sp_strm = std::make_unique<line_stream>(*this, *prbc, fd, user_data);
+  auto &strm = *sp_strm;
+  strm.coro = coroutine(strm).release();
+  strm.coro.promise().strm = &strm;
+  strm.waiter = strm.coro;
+  rms.set_handler(fd, on_ready, &strm);
+  streams[fd] = std::move(sp_strm);
+  return true;
+}
+
+/**
+ * Drops a stream without running its coroutine to completion. Only to be
+ * called from the reactor thread, from within the callbacks given to run().
+ */
+void coro_scheduler::stop_stream(int const fd) {
+  rms.remove(fd);
+  streams.erase(fd); // destroys the suspended coroutine
+}
+
+void coro_scheduler::post(line_stream * const strm, uint64_t const ready_ns) {
+  {
+    std::lock_guard<std::mutex> lk{mtx};
+    running++;
+    run_queue.emplace_back(strm, ready_ns);
+  }
+  work_cv.notify_one();
+}
+
+void coro_scheduler::on_suspended() {
+  std::lock_guard<std::mutex> lk{mtx};
+  if (--running == 0) {
+    idle_cv.notify_one();
+  }
+}
+
+void coro_scheduler::on_completed(line_stream * const strm) {
+  std::lock_guard<std::mutex> lk{mtx};
+  completed.emplace_back(strm->fd, strm->coro.promise().rc);
+  if (--running == 0) {
+    idle_cv.notify_one();
+  }
+}
+
+void coro_scheduler::pool_thread_main(unsigned const thread_nbr) {
+  tracing::set_thread_name("coroutine pool " + std::to_string(thread_nbr));
+  for(;;) {
+    std::pair<line_stream*, uint64_t> item;
+    {
+      std::unique_lock<std::mutex> lk{mtx};
+      work_cv.wait(lk, [this] { return is_shutdown || !run_queue.empty(); });
+      if (run_queue.empty()) return; // shut down
+      item = run_queue.front();
+      run_queue.pop_front();
+    }
+    auto const [strm, ready_ns] = item;
+    auto &counters = metrics::local();
+    counters.poll_to_task.record(metrics::now_ns() - ready_ns);
+    metrics::scoped_timer task_timer{counters.task_duration};
+    tracing::span span{"coroutine resume", "task"};
+    span.arg("fd", strm->fd);
+    // the awaited input is had here, so a spuriously ready stream is simply re-armed rather than resumed
+    if (strm->complete_pending_op() == EAGAIN) {
+      strm->is_armed = true;
+      on_suspended();
+      continue;
+    }
+    strm->pending_op = line_stream::await_op::NONE;
+    strm->waiter.resume(); // runs until the coroutine's next suspending await, or its completion
+  }
+}
+
+/**
+ * Runs the reactor loop until every coroutine has completed, a signal
+ * interrupts it, or a callback returns false. The on_done callback is given
+ * each completed coroutine's status before its stream is removed from the
+ * read_multi_stream.
+ *
+ * @return 0, EINTR if a signal interrupted polling, or -1 if polling failed
+ */
+int coro_scheduler::run(const stream_done_callback_t &on_done, const cycle_callback_t &on_cycle_end) {
+  std::vector<std::pair<int, int>> done{};
+  const poll_filter_t filter = [this](int fd) -> bool {
+    auto const search = streams.find(fd);
+    return search != streams.end() && search->second->is_armed;
+  };
+  const cycle_callback_t end_cycle = [&]() -> bool {
+    {
+      std::unique_lock<std::mutex> lk{mtx};
+      idle_cv.wait(lk, [this] { return running == 0; });
+      done.swap(completed);
+    }
+    bool keep_going = true;
+    for(auto const &[fd, rc] : done) {
+      if (streams.find(fd) == streams.end()) continue; // stopped by a callback earlier in this cycle
+      if (on_done && !on_done(fd, rc)) {
+        keep_going = false;
+      }
+      stop_stream(fd);
+    }
+    done.clear();
+    if (on_cycle_end && !on_cycle_end()) {
+      keep_going = false;
+    }
+    return keep_going && !streams.empty();
+  };
+  auto rc = rms.run_until_idle(end_cycle, filter);
+  if (rc == -1 && streams.empty()) {
+    rc = 0; // every stream left unpolled has been stopped
+  }
+  return rc;
+}
@@ -0,0 +1,209 @@
+/* stream-coro.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef STREAM_CORO_H
+#define STREAM_CORO_H
+
+#include <coroutine>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "read-multi-strm.h"
+
+/*
+ * A C++20 coroutine interface to the streams of a read_multi_stream. Per
+ * stream processing is written as a coroutine that awaits lines of input:
+ *
+ *   stream_task count_records(line_stream &strm) {
+ *     for(;;) {
+ *       auto const [rc, line] = co_await strm.next_line();
+ *       if (rc != EXIT_SUCCESS) co_return rc == EOF ? EXIT_SUCCESS : rc;
+ *       ...
+ *     }
+ *   }
+ *
+ * An await completes without suspending while the stream's input is already
+ * buffered or readable. Otherwise the coroutine suspends, and the scheduler
+ * resumes it on one of its pool threads once the reactor loop of the
+ * read_multi_stream finds its file descriptor ready.
+ */
+
+class coro_scheduler;
+
+/*
+ * Status of an await per read_buf_ctx::read_line(): EXIT_SUCCESS, EOF, EINTR
+ * or EXIT_FAILURE - or E2BIG for a leading piece of a line longer than the
+ * stream's line fragment limit (the line's last piece comes as EXIT_SUCCESS).
+ */
+struct line_result {
+  int rc;
+  std::string_view line;  // valid until the next await on the stream
+};
+
+struct batch_result {
+  int rc;                                        // EXIT_SUCCESS (or E2BIG, for a single piece) when lines is not empty
+  const std::vector<std::string_view> &lines;    // valid until the next await on the stream
+};
+
+/*
+ * Coroutine type of a stream's processing. The coroutine does not start until
+ * its stream is first ready, and co_returns its status (EXIT_SUCCESS etc).
+ */
+class stream_task final {
+public:
+  struct promise_type {
+    int rc{EXIT_SUCCESS};
+    class line_stream *strm{nullptr};
+    stream_task get_return_object() { return stream_task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    struct final_awaiter {
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<promise_type> h) noexcept;
+      void await_resume() noexcept {}
+    };
+    final_awaiter final_suspend() noexcept { return {}; }
+    void return_value(int status) { rc = status; }
+    void unhandled_exception();
+  };
+  using handle_t = std::coroutine_handle<promise_type>;
+  stream_task(stream_task &&other) noexcept : handle{other.handle} { other.handle = nullptr; }
+  stream_task(const stream_task &) = delete;
+  stream_task& operator=(const stream_task &) = delete;
+  stream_task& operator=(stream_task &&) = delete;
+  ~stream_task() { if (handle) handle.destroy(); }
+  handle_t release() { auto const h = handle; handle = nullptr; return h; }
+private:
+  explicit stream_task(handle_t h) : handle{h} {}
+  handle_t handle;
+};
+
+/*
+ * The awaitable side of a stream. Only the stream's own coroutine awaits on
+ * it, and never more than one await at a time. The line (or lines) an await
+ * yields are valid until the next await on the stream.
+ */
+class line_stream final {
+  enum class await_op : char { NONE = 0, LINE, BATCH };
+  coro_scheduler &scheduler;
+  read_buf_ctx &rbc;
+  const int fd;
+  void *const user_data;
+  stream_task::handle_t coro{};
+  std::coroutine_handle<> waiter{};   // what to resume once the awaited input is had
+  await_op pending_op{await_op::NONE};
+  size_t pending_max_lines{0};
+  int op_rc{EXIT_SUCCESS};
+  bool is_armed{true};      // awaiting readiness - polled by the reactor (initially, to start the coroutine)
+  bool is_line_complete{false};
+  bool is_line_spilled{false};  // leading pieces of the current line have been returned
+  bool is_piece_pending{false}; // a piece is held in piece_buf, to be returned by the next await
+  bool is_eof{false};
+  int final_rc{EOF};
+  std::string_view current{};
+  std::string str_buf{};
+  std::string piece_buf{};
+  std::vector<std::string> batch_bufs{};
+  std::vector<std::string_view> batch{};
+  friend class coro_scheduler;
+  friend struct stream_task::promise_type;
+  int read_next();
+  int fill_batch(size_t max_lines);
+  int complete_pending_op();
+  void suspend(std::coroutine_handle<> h, await_op op, size_t max_lines);
+public:
+  line_stream(coro_scheduler &scheduler, read_buf_ctx &rbc, int fd, void *user_data)
+      : scheduler{scheduler}, rbc{rbc}, fd{fd}, user_data{user_data} {}
+  line_stream(const line_stream &) = delete;
+  line_stream& operator=(const line_stream &) = delete;
+  ~line_stream() { if (coro) coro.destroy(); }
+  int get_fd() const { return fd; }
+  bool is_stderr_stream() const { return rbc.is_stderr_stream(); }
+  void* get_user_data() const { return user_data; }
+
+  struct line_awaiter {
+    line_stream &strm;
+    bool await_ready() { return (strm.op_rc = strm.read_next()) != EAGAIN; }
+    void await_suspend(std::coroutine_handle<> h) { strm.suspend(h, await_op::LINE, 0); }
+    line_result await_resume() {
+      return {strm.op_rc, strm.op_rc == EXIT_SUCCESS || strm.op_rc == E2BIG ? strm.current : std::string_view{}};
+    }
+  };
+  struct batch_awaiter {
+    line_stream &strm;
+    size_t max_lines;
+    bool await_ready() { return (strm.op_rc = strm.fill_batch(max_lines)) != EAGAIN; }
+    void await_suspend(std::coroutine_handle<> h) { strm.suspend(h, await_op::BATCH, max_lines); }
+    batch_result await_resume() { return {strm.op_rc, strm.batch}; }
+  };
+  // the next line of input; at end of input an unterminated last line is still returned before EOF
+  line_awaiter next_line() { return line_awaiter{*this}; }
+  // up to max_lines of the lines that can be had without waiting (at least one, unless at EOF or failed)
+  batch_awaiter next_batch(size_t max_lines = 256) { return batch_awaiter{*this, max_lines}; }
+};
+
+using stream_coroutine_t = std::function<stream_task(line_stream &strm)>;
+
+/* Invoked on the reactor thread when a stream's coroutine completes; returning false ends run() */
+using stream_done_callback_t = std::function<bool(int fd, int rc)>;
+
+/*
+ * Runs the coroutines of the streams of a read_multi_stream. The thread
+ * calling run() is the reactor: it polls the streams whose coroutines are
+ * awaiting input and hands the ready ones to a pool of threads to resume.
+ * Like the futures of the std::async dispatch, a poll cycle completes once
+ * every coroutine it resumed has suspended again (or completed), so no stream
+ * is ever polled while its coroutine runs.
+ */
+class coro_scheduler final {
+  read_multi_stream &rms;
+  std::unordered_map<int, std::unique_ptr<line_stream>> streams{};
+  std::vector<std::thread> pool{};
+  std::mutex mtx{};
+  std::condition_variable work_cv{};
+  std::condition_variable idle_cv{};
+  std::deque<std::pair<line_stream*, uint64_t>> run_queue{};
+  std::vector<std::pair<int, int>> completed{};   // fd and status of the coroutines completed this cycle
+  stream_handler_t on_ready{};
+  size_t running{0};
+  bool is_shutdown{false};
+  friend class line_stream;
+  friend struct stream_task::promise_type;
+  void pool_thread_main(unsigned thread_nbr);
+  void post(line_stream *strm, uint64_t ready_ns);
+  void on_suspended();
+  void on_completed(line_stream *strm);
+public:
+  coro_scheduler(read_multi_stream &rms, unsigned thread_count);
+  coro_scheduler(const coro_scheduler &) = delete;
+  coro_scheduler& operator=(const coro_scheduler &) = delete;
+  ~coro_scheduler();
+  bool spawn(int fd, const stream_coroutine_t &coroutine, void *user_data = nullptr);
+  void stop_stream(int fd);
+  int run(const stream_done_callback_t &on_done = nullptr, const cycle_callback_t &on_cycle_end = nullptr);
+};
+
+#endif //STREAM_CORO_H
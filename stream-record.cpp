@@ -0,0 +1,253 @@
+/* stream-record.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <unistd.h>
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <mutex>
+#include <algorithm>
+#include "signal-handling.h"
+#include "logging.h"
+#include "metrics.h"
+#include "util.h"
+#include "uncompress-stream.h"
+#include "stream-record.h"
+
+namespace stream_record {
+
+  static constexpr char magic[] = "RMSTRC1\n";
+  static constexpr size_t magic_len = sizeof(magic) - 1;
+
+  static std::mutex record_guard;
+  static FILE *record_file = nullptr;
+  static std::string record_file_path;
+  static bool record_data = false;
+  static int input_count = 0;
+  static uint64_t last_ns = 0;
+
+  static void put_varint(uint64_t v) {
+    unsigned char buf[10];
+    size_t n = 0;
+    do {
+      buf[n] = static_cast<unsigned char>(v & 0x7f);
+      v >>= 7;
+      if (v != 0) buf[n] |= 0x80;
+      n++;
+    } while (v != 0);
+    fwrite(buf, 1, n, record_file);
+  }
+
+  bool start(std::string_view file_path, bool const with_data) {
+    std::lock_guard<std::mutex> lk(record_guard);
+    record_file_path = file_path;
+    record_file = fopen(record_file_path.c_str(), "wb");
+    if (record_file == nullptr) {
+      LOG_ERROR("%d: %s() -> fopen(\"%s\"): %s\n", __LINE__, __FUNCTION__, record_file_path.c_str(), strerror(errno));
+      return false;
+    }
+    record_data = with_data;
+    fwrite(magic, 1, magic_len, record_file);
+    fputc(with_data ? 1 : 0, record_file);
+    last_ns = metrics::now_ns();
+    return true;
+  }
+
+  bool finish() {
+    std::lock_guard<std::mutex> lk(record_guard);
+    if (record_file == nullptr) return true;
+    auto const rc = fclose(record_file);
+    record_file = nullptr;
+    if (rc != 0) {
+      LOG_ERROR("%d: %s() -> writing \"%s\": %s\n", __LINE__, __FUNCTION__, record_file_path.c_str(), strerror(errno));
+      return false;
+    }
+    LOG_INFO("recorded the input arrivals of %d inputs to \"%s\"\n", input_count, record_file_path.c_str());
+    return true;
+  }
+
+  int register_input(std::string_view name) {
+    std::lock_guard<std::mutex> lk(record_guard);
+    if (record_file == nullptr) return -1;
+    fputc('I', record_file);
+    put_varint(name.size());
+    fwrite(name.data(), 1, name.size(), record_file);
+    return input_count++;
+  }
+
+  // the time since the prior record (taken under the lock, so records are in time order)
+  static uint64_t next_delta() {
+    auto const now = metrics::now_ns();
+    auto const delta = now > last_ns ? now - last_ns : 0;
+    last_ns = now;
+    return delta;
+  }
+
+  void chunk(int const stream, const char *const data, size_t const size) {
+    auto const eols = static_cast<uint64_t>(std::count(data, data + size, '\n'));
+    std::lock_guard<std::mutex> lk(record_guard);
+    if (record_file == nullptr) return;
+    fputc('C', record_file);
+    put_varint(static_cast<uint64_t>(stream));
+    put_varint(next_delta());
+    put_varint(size);
+    put_varint(eols);
+    if (record_data) {
+      fwrite(data, 1, size, record_file);
+    }
+  }
+
+  void eof(int const stream) {
+    std::lock_guard<std::mutex> lk(record_guard);
+    if (record_file == nullptr) return;
+    fputc('E', record_file);
+    put_varint(static_cast<uint64_t>(stream));
+    put_varint(next_delta());
+  }
+
+  bool is_replay_input(std::string_view input) {
+    return input.substr(0, replay_input_prefix.size()) == replay_input_prefix;
+  }
+
+  std::shared_ptr<replay_trace> load_replay(std::string_view file_path) {
+    const std::string path{file_path};
+    auto const fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) {
+      LOG_ERROR("%d: %s() -> fopen(\"%s\"): %s\n", __LINE__, __FUNCTION__, path.c_str(), strerror(errno));
+      return nullptr;
+    }
+    std::string buf{};
+    char block[64 * 1024];
+    size_t n;
+    while ((n = fread(block, 1, sizeof(block), fp)) > 0) buf.append(block, n);
+    fclose(fp);
+
+    size_t pos = 0;
+    bool ok = true;
+    auto const get_varint = [&buf, &pos, &ok]() -> uint64_t {
+      uint64_t v = 0;
+      for(unsigned shift = 0; shift < 64; shift += 7) {
+        if (pos >= buf.size()) break;
+        auto const b = static_cast<unsigned char>(buf[pos++]);
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) return v;
+      }
+      ok = false;
+      return 0;
+    };
+
+    if (buf.size() < magic_len + 1 || buf.compare(0, magic_len, magic) != 0) {
+      LOG_ERROR("\"%s\" is not a stream arrival trace\n", path.c_str());
+      return nullptr;
+    }
+    auto sp_trace = std::make_shared<replay_trace>();
+    auto &trace = *sp_trace;
+    trace.has_data = buf[magic_len] != 0;
+    pos = magic_len + 1;
+    uint64_t ts = 0;
+    while (ok && pos < buf.size()) {
+      auto const type = buf[pos++];
+      if (type == 'I') {
+        auto const len = get_varint();
+        if (!ok || pos + len > buf.size()) break;
+        trace.inputs.push_back(replay_input{buf.substr(pos, len), {}, 0});
+        pos += len;
+        continue;
+      }
+      if (type != 'C' && type != 'E') {
+        ok = false;
+        break;
+      }
+      auto const stream = get_varint();
+      ts += get_varint();
+      replay_event ev{ts, 0, 0, (stream & 1) != 0, type == 'E', 0};
+      if (type == 'C') {
+        ev.size = static_cast<uint32_t>(get_varint());
+        ev.eols = static_cast<uint32_t>(get_varint());
+        if (trace.has_data) {
+          if (pos + ev.size > buf.size()) {
+            ok = false;
+            break;
+          }
+          ev.data_offset = trace.data.size();
+          trace.data.append(buf, pos, ev.size);
+          pos += ev.size;
+        }
+      }
+      if (!ok || stream / 2 >= trace.inputs.size()) {
+        ok = false;
+        break;
+      }
+      auto &input = trace.inputs[stream / 2];
+      input.max_chunk = std::max<size_t>(input.max_chunk, ev.size);
+      input.events.push_back(ev);
+    }
+    if (!ok) {
+      LOG_ERROR("stream arrival trace \"%s\" is malformed or truncated at byte offset %lu\n", path.c_str(), pos);
+      return nullptr;
+    }
+    LOG_INFO("loaded stream arrival trace \"%s\" of %lu inputs\n", path.c_str(), trace.inputs.size());
+    return sp_trace;
+  }
+
+  /*
+   * The body of a replay child process: writes each recorded chunk at its
+   * recorded time, from the trace data or else from filler in buf (sized by
+   * the parent ahead of the fork, see get_replay_stream()).
+   */
+  static void replay(const replay_trace &trace, const replay_input &input, char *const buf) {
+    bool stdout_open = true, stderr_open = true;
+    for(auto const &ev : input.events) {
+      if (signal_handling::interrupted()) break;
+      auto const at_ns = trace.start_ns + ev.ts_ns;
+      struct timespec deadline{static_cast<time_t>(at_ns / 1000000000UL), static_cast<long>(at_ns % 1000000000UL)};
+      sleep_until(deadline);
+      auto const fd = ev.is_stderr ? STDERR_FILENO : STDOUT_FILENO;
+      auto &is_open = ev.is_stderr ? stderr_open : stdout_open;
+      if (!is_open) continue;
+      if (ev.is_eof) {
+        close(fd);
+        is_open = false;
+        continue;
+      }
+      const char *data = trace.data.data() + ev.data_offset;
+      if (!trace.has_data) {
+        // filler text with the recorded number of line endings spread evenly through the chunk
+        for(uint32_t i = 0; i < ev.size; i++) buf[i] = static_cast<char>('a' + i % 26);
+        for(uint32_t i = 0; i < ev.eols; i++) {
+          buf[(static_cast<uint64_t>(i) + 1) * ev.size / ev.eols - 1] = '\n';
+        }
+        data = buf;
+      }
+      if (!write_fully(fd, data, ev.size)) _exit(1); // the reader went away
+    }
+    _exit(0);
+  }
+
+  std::tuple<int, int> get_replay_stream(const std::shared_ptr<replay_trace> &trace, size_t const input_idx) {
+    if (trace->start_ns == 0) {
+      // leaves time for the replay child processes of all of the inputs to be spawned
+      trace->start_ns = metrics::now_ns() + 100 * 1000000UL;
+    }
+    auto const &input = trace->inputs.at(input_idx);
+    std::vector<char> buf(input.max_chunk + 1); // allocated ahead of the fork, as the child must not call malloc()
+    return get_child_process_stream(input.name, [&trace, &input, &buf] { replay(*trace, input, buf.data()); });
+  }
+}
@@ -0,0 +1,85 @@
+/* stream-record.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef STREAM_RECORD_H
+#define STREAM_RECORD_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+/*
+ * Recording of the arrival of input - the size and time of every chunk
+ * returned by read() on each stream - into a compact binary trace, and the
+ * replay of such a trace: one child process per recorded input writes its
+ * stdout and stderr chunks to the pipes at the recorded times, so the same
+ * interleaving of arrivals across streams is fed back through read_multi_stream.
+ *
+ * Trace format: the magic "RMSTRC1\n" and a flags byte (1 = chunk data is
+ * included), then records each starting with a type byte, with numbers as
+ * unsigned LEB128 varints:
+ *
+ *   'I' input:  name length, name bytes                 (inputs are numbered in order)
+ *   'C' chunk:  stream, ns since the prior record, size, line ending count [, data bytes]
+ *   'E' eof:    stream, ns since the prior record
+ *
+ * where stream is input number * 2, plus 1 for the stderr stream. Without the
+ * chunk data, replay writes filler text with the recorded number of line
+ * endings spread evenly through each chunk.
+ */
+namespace stream_record {
+  bool start(std::string_view file_path, bool with_data);
+  bool finish();
+  int register_input(std::string_view name); // returns the input number, or -1 when not recording
+  void chunk(int stream, const char *data, size_t size);
+  void eof(int stream);
+
+  struct replay_event {
+    uint64_t ts_ns;        // time since the start of the recording
+    uint32_t size;
+    uint32_t eols;
+    bool is_stderr;
+    bool is_eof;
+    size_t data_offset;    // into replay_trace::data, when the trace has chunk data
+  };
+
+  struct replay_input {
+    std::string name;
+    std::vector<replay_event> events;
+    size_t max_chunk{0};
+  };
+
+  struct replay_trace {
+    bool has_data{false};
+    std::string data{};
+    std::vector<replay_input> inputs{};
+    uint64_t start_ns{0};   // when replay began - common to all of the replay child processes
+  };
+
+  constexpr std::string_view replay_input_prefix = "replay:";
+
+  bool is_replay_input(std::string_view input);
+  std::shared_ptr<replay_trace> load_replay(std::string_view file_path);
+  std::tuple<int, int> get_replay_stream(const std::shared_ptr<replay_trace> &trace, size_t input_idx);
+}
+
+#endif //STREAM_RECORD_H
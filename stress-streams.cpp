@@ -0,0 +1,186 @@
+/* stress-streams.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*
+ * Stress test of the read_multi_stream reactor holding a great many streams
+ * open at once: creates a pipe per stream (in stdout/stderr pairs, as the
+ * program proper has per input), registers all of their read ends, and then
+ * has a writer thread feed the streams in waves - each wave written only once
+ * the reactor has consumed the wave before it, so every poll cycle is over the
+ * whole (mostly idle) set of streams. A stream's write end is closed once its
+ * lines are written, so the streams come to end-of-file wave by wave.
+ *
+ * The soft limit of open files is raised to the hard limit; should that not
+ * allow for the requested stream count, the count is reduced to fit.
+ *
+ * usage: stress-streams [-streams <n>] [-lines <n>] [-waves <n>] [-bufsize <n>]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "signal-handling.h"
+#include "logging.h"
+#include "metrics.h"
+#include "util.h"
+#include "read-multi-strm.h"
+
+static double secs_since(uint64_t const start_ns) {
+  return static_cast<double>(metrics::now_ns() - start_ns) / 1e9;
+}
+
+int main(int argc, char **argv) {
+  size_t stream_count = 100000;
+  size_t lines_per_stream = 4;
+  size_t waves = 10;
+  u_int buf_size = 256;
+  for(int i = 1; i < argc; i++) {
+    std::string_view arg{argv[i]};
+    if (i + 1 < argc && arg == "-streams") {
+      stream_count = std::max(2UL, strtoul(argv[++i], nullptr, 10));
+    } else if (i + 1 < argc && arg == "-lines") {
+      lines_per_stream = std::max(1UL, strtoul(argv[++i], nullptr, 10));
+    } else if (i + 1 < argc && arg == "-waves") {
+      waves = std::max(1UL, strtoul(argv[++i], nullptr, 10));
+    } else if (i + 1 < argc && arg == "-bufsize") {
+      buf_size = static_cast<u_int>(std::clamp(strtoul(argv[++i], nullptr, 10), 8UL, 65535UL));
+    } else {
+      fprintf(stderr, "usage: %s [-streams <n>] [-lines <n>] [-waves <n>] [-bufsize <n>]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  signal_handling::set_signals_handler();
+  logging::start();
+  atexit(logging::shutdown);
+
+  // each stream holds a pipe read end and (until written out) its write end open
+  auto const fd_limit = raise_open_files_limit();
+  size_t const reserved_fds = 64;
+  if (fd_limit < reserved_fds + 4) {
+    LOG_ERROR("open files limit of %lu is too low\n", fd_limit);
+    return EXIT_FAILURE;
+  }
+  auto const max_streams = ((fd_limit - reserved_fds) / 2) & ~size_t{1};
+  if (stream_count > max_streams) {
+    LOG_WARN("open files limit of %lu allows for %lu streams, not %lu - raise the hard limit (ulimit -Hn) for more\n",
+             fd_limit, max_streams, stream_count);
+    stream_count = max_streams;
+  }
+  stream_count &= ~size_t{1}; // streams come in stdout/stderr pairs
+  waves = std::min(waves, stream_count);
+
+  read_multi_stream rms{buf_size};
+  std::atomic_size_t lines_read{0};
+  size_t eof_count = 0, failures = 0, cycles = 0;
+  std::string str_buf{};
+  const stream_handler_t on_ready = [&](read_buf_ctx &rbc, const stream_event &event) {
+    for(;;) {
+      auto const rc = rbc.read_line(str_buf);
+      if (rc == EXIT_SUCCESS) {
+        lines_read.fetch_add(1, std::memory_order_relaxed);
+        str_buf.clear();
+        continue;
+      }
+      if (rc == EAGAIN) return; // the rest of the stream's lines are yet to be written
+      if (rc == EOF) {
+        eof_count++;
+      } else {
+        failures++;
+      }
+      rms.remove(event.fd); // its pipe read end is closed once both streams of the pair are removed
+      return;
+    }
+  };
+  std::vector<int> write_fds(stream_count, -1);
+  auto const register_start_ns = metrics::now_ns();
+  for(size_t i = 0; i < stream_count; i += 2) {
+    int stdout_pipes[2]{-1, -1}, stderr_pipes[2]{-1, -1};
+    if (pipe2(stdout_pipes, O_CLOEXEC) == -1 || pipe2(stderr_pipes, O_CLOEXEC) == -1) {
+      LOG_ERROR("%d: %s() -> pipe2() of stream %lu: %s\n", __LINE__, __FUNCTION__, i, strerror(errno));
+      return EXIT_FAILURE;
+    }
+    rms += std::make_tuple(stdout_pipes[0], stderr_pipes[0]);
+    rms.set_handler(stdout_pipes[0], on_ready);
+    rms.set_handler(stderr_pipes[0], on_ready);
+    write_fds[i] = stdout_pipes[1];
+    write_fds[i + 1] = stderr_pipes[1];
+  }
+  auto const register_secs = secs_since(register_start_ns);
+  printf("%lu streams registered (%lu file descriptors open) in %.3f s\n", stream_count, 2 * stream_count,
+         register_secs);
+  fflush(stdout);
+
+  // writes each wave of streams out, then waits for the reactor to have consumed it
+  std::atomic_bool is_writer_failed{false};
+  std::thread writer{[&] {
+    std::string lines{};
+    for(size_t n = 0; n < lines_per_stream; n++) {
+      lines += "stress test line " + std::to_string(n) + " of a stream\n";
+    }
+    auto const wave_size = (stream_count + waves - 1) / waves;
+    for(size_t first = 0; first < stream_count && !signal_handling::interrupted(); first += wave_size) {
+      auto const last = std::min(first + wave_size, stream_count);
+      for(size_t i = first; i < last; i++) {
+        if (!write_fully(write_fds[i], lines.data(), lines.size())) {
+          is_writer_failed = true;
+        }
+        close(write_fds[i]);
+      }
+      auto const expected = last * lines_per_stream;
+      while (lines_read.load(std::memory_order_relaxed) < expected && !is_writer_failed &&
+             !signal_handling::interrupted()) {
+        usleep(100);
+      }
+    }
+  }};
+
+  auto const run_start_ns = metrics::now_ns();
+  const cycle_callback_t on_cycle_end = [&cycles] {
+    cycles++;
+    return true;
+  };
+  auto const rc = rms.run_until_idle(on_cycle_end);
+  auto const run_secs = secs_since(run_start_ns);
+  writer.join();
+
+  struct rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  auto const expected_lines = stream_count * lines_per_stream;
+  printf("%lu lines of %lu streams read in %.3f s over %lu poll cycles (%.2f Mlines/s), %lu at end-of-file, "
+         "peak RSS %ld KiB\n", lines_read.load(), stream_count, run_secs, cycles,
+         static_cast<double>(lines_read.load()) / run_secs / 1e6, eof_count, usage.ru_maxrss);
+
+  if (rc != 0 || failures > 0 || is_writer_failed || lines_read.load() != expected_lines || eof_count != stream_count) {
+    LOG_ERROR("stress test failed: reactor status %d, %lu stream failures, %lu of %lu lines read, %lu of %lu streams "
+              "at end-of-file\n", rc, failures, lines_read.load(), expected_lines, eof_count, stream_count);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
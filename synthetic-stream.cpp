@@ -0,0 +1,181 @@
+/* synthetic-stream.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <unistd.h>
+#include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <algorithm>
+#include "signal-handling.h"
+#include "logging.h"
+#include "util.h"
+#include "uncompress-stream.h"
+#include "synthetic-stream.h"
+
+bool is_synthetic_input(std::string_view input) {
+  return input.substr(0, synthetic_input_prefix.size()) == synthetic_input_prefix;
+}
+
+static bool parse_number(std::string_view key, const std::string &value, double &nbr) {
+  char *end = nullptr;
+  nbr = strtod(value.c_str(), &end);
+  if (value.empty() || *end != '\0' || nbr < 0) {
+    LOG_ERROR("synthetic stream spec key '%.*s' expects a non-negative number: '%s'\n",
+              static_cast<int>(key.size()), key.data(), value.c_str());
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Parses a synthetic input spec of the form "synthetic:key=value,...".
+ * Keys: name, lines, line-min, line-max, rate, burst, stall-every, stall-ms,
+ * stderr-every, seed.
+ *
+ * @param index position of the input on the command line - names an unnamed stream
+ */
+bool parse_synthetic_spec(std::string_view input, int const index, synthetic_stream_spec &spec) {
+  spec = synthetic_stream_spec{};
+  spec.name = "synthetic-" + std::to_string(index);
+  spec.seed = static_cast<uint32_t>(index + 1);
+  auto params = input.substr(synthetic_input_prefix.size());
+  while (!params.empty()) {
+    auto const comma = params.find(',');
+    auto const param = params.substr(0, comma);
+    params = comma == std::string_view::npos ? std::string_view{} : params.substr(comma + 1);
+    if (param.empty()) continue;
+    auto const eq = param.find('=');
+    if (eq == std::string_view::npos) {
+      LOG_ERROR("synthetic stream spec expects key=value: '%.*s'\n", static_cast<int>(param.size()), param.data());
+      return false;
+    }
+    auto const key = param.substr(0, eq);
+    const std::string value{param.substr(eq + 1)};
+    if (key == "name") {
+      spec.name = value;
+      continue;
+    }
+    double nbr;
+    if (!parse_number(key, value, nbr)) return false;
+    if (key == "lines") spec.lines = static_cast<uint64_t>(nbr);
+    else if (key == "line-min") spec.line_min = static_cast<uint32_t>(nbr);
+    else if (key == "line-max") spec.line_max = static_cast<uint32_t>(nbr);
+    else if (key == "rate") spec.rate = nbr;
+    else if (key == "burst") spec.burst = std::max(1u, static_cast<uint32_t>(nbr));
+    else if (key == "stall-every") spec.stall_every = static_cast<uint64_t>(nbr);
+    else if (key == "stall-ms") spec.stall_ms = static_cast<uint32_t>(nbr);
+    else if (key == "stderr-every") spec.stderr_every = static_cast<uint64_t>(nbr);
+    else if (key == "seed") spec.seed = static_cast<uint32_t>(nbr);
+    else {
+      LOG_ERROR("unknown synthetic stream spec key '%.*s'\n", static_cast<int>(key.size()), key.data());
+      return false;
+    }
+  }
+  if (spec.line_max < spec.line_min) spec.line_max = spec.line_min;
+  if (spec.line_max > 1024 * 1024) {
+    LOG_ERROR("synthetic stream line length is limited to 1 MiB: %u\n", spec.line_max);
+    return false;
+  }
+  return true;
+}
+
+static void advance(struct timespec &ts, uint64_t const ns) {
+  auto const total = static_cast<uint64_t>(ts.tv_nsec) + ns;
+  ts.tv_sec += static_cast<time_t>(total / 1000000000UL);
+  ts.tv_nsec = static_cast<long>(total % 1000000000UL);
+}
+
+/*
+ * The body of the forked child. It was forked from a multi-threaded process,
+ * so it sticks to system calls and the buffer allocated before the fork.
+ */
+static void generate(const synthetic_stream_spec &spec, char *const buf, size_t const buf_size) {
+  uint32_t x = spec.seed != 0 ? spec.seed : 0x9E3779B9u;
+  auto const next_rand = [&x] {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+  };
+  // lines of a burst are accumulated and written together; unpaced streams fill the buffer per write
+  auto const burst = spec.rate > 0 ? spec.burst : UINT32_MAX;
+  auto const burst_ns = spec.rate > 0 ? static_cast<uint64_t>(1e9 * spec.burst / spec.rate) : 0;
+  struct timespec next_burst{0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &next_burst);
+
+  size_t used = 0;
+  uint32_t in_burst = 0;
+  for(uint64_t seq = 1; seq <= spec.lines && !signal_handling::interrupted(); seq++) {
+    // a line is its sequence number followed by printable filler to make up its length
+    auto const len = spec.line_min + (spec.line_max > spec.line_min ? next_rand() % (spec.line_max - spec.line_min + 1)
+                                                                    : 0);
+    char *p = buf + used;
+    char digits[24];
+    int nd = 0;
+    for(auto v = seq; v > 0 && nd < 20; v /= 10) digits[nd++] = static_cast<char>('0' + v % 10);
+    uint32_t i = 0;
+    while (nd > 0 && i < len) p[i++] = digits[--nd];
+    if (i < len) p[i++] = ' ';
+    while (i < len) p[i++] = static_cast<char>('!' + next_rand() % 94);
+    p[i++] = '\n';
+    used += i;
+
+    auto const flush = ++in_burst >= burst || used + spec.line_max + 1 > buf_size || seq == spec.lines ||
+                       (spec.stall_every > 0 && seq % spec.stall_every == 0) ||
+                       (spec.stderr_every > 0 && seq % spec.stderr_every == 0);
+    if (flush) {
+      if (!write_fully(STDOUT_FILENO, buf, used)) _exit(1); // the reader went away
+      used = 0;
+    }
+    if (spec.stderr_every > 0 && seq % spec.stderr_every == 0) {
+      char msg[64];
+      auto const n = snprintf(msg, sizeof(msg), "WARN: synthetic stderr line after stdout line %lu\n", seq);
+      write_fully(STDERR_FILENO, msg, static_cast<size_t>(n));
+    }
+    if (spec.stall_every > 0 && seq % spec.stall_every == 0 && spec.stall_ms > 0) {
+      struct timespec stall_ts{static_cast<time_t>(spec.stall_ms / 1000),
+                               static_cast<long>(spec.stall_ms % 1000) * 1000000L};
+      while (nanosleep(&stall_ts, &stall_ts) == -1 && errno == EINTR && !signal_handling::interrupted()) {}
+      clock_gettime(CLOCK_MONOTONIC, &next_burst); // pacing resumes from the end of the stall
+      in_burst = 0;
+    }
+    if (in_burst >= burst) {
+      in_burst = 0;
+      if (burst_ns > 0) {
+        advance(next_burst, burst_ns);
+        sleep_until(next_burst);
+      }
+    }
+  }
+  _exit(0);
+}
+
+/**
+ * Forks a synthetic load generator child process.
+ *
+ * @return the pipe read ends of the child's stdout and stderr, or {-1, -1} on failure
+ */
+std::tuple<int, int> get_synthetic_stream(const synthetic_stream_spec &spec) {
+  // allocated ahead of the fork, as the child must not call malloc()
+  auto const buf_size = std::max<size_t>(64 * 1024, 2 * (static_cast<size_t>(spec.line_max) + 1));
+  std::vector<char> buf(buf_size);
+  return get_child_process_stream(spec.name, [&spec, &buf] { generate(spec, buf.data(), buf.size()); });
+}
@@ -0,0 +1,58 @@
+/* synthetic-stream.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef SYNTHETIC_STREAM_H
+#define SYNTHETIC_STREAM_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <tuple>
+
+/*
+ * A load generator that stands in for a gzip child process: a forked child
+ * writes synthetic text lines to its stdout pipe (and, optionally, lines to
+ * its stderr pipe) per the pacing described by the spec. It lets the poll and
+ * dispatch layer be exercised on its own, with mixes of hot producers, slow
+ * producers and producers that stall.
+ *
+ * A spec is given on the command line in place of an input file as:
+ *
+ *   synthetic:<key>=<value>,<key>=<value>,...
+ */
+struct synthetic_stream_spec {
+  std::string name{};           // name of the output file (the stderr output file appends ".err")
+  uint64_t lines = 100000;      // number of stdout lines to write
+  uint32_t line_min = 80;       // line length range (not counting the line ending)
+  uint32_t line_max = 80;
+  double rate = 0;              // lines per second; 0 writes as fast as the pipe is drained
+  uint32_t burst = 1;           // lines written together per paced burst
+  uint64_t stall_every = 0;     // stall after every so many lines (0 never stalls)
+  uint32_t stall_ms = 0;        // duration of a stall
+  uint64_t stderr_every = 0;    // write a line to stderr after every so many stdout lines (0 never)
+  uint32_t seed = 1;
+};
+
+constexpr std::string_view synthetic_input_prefix = "synthetic:";
+
+bool is_synthetic_input(std::string_view input);
+bool parse_synthetic_spec(std::string_view input, int index, synthetic_stream_spec &spec);
+std::tuple<int, int> get_synthetic_stream(const synthetic_stream_spec &spec);
+
+#endif //SYNTHETIC_STREAM_H
@@ -0,0 +1,245 @@
+/* tracing.cpp
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include "logging.h"
+#include "metrics.h"
+#include "tracing.h"
+
+namespace tracing {
+
+  std::atomic_bool active{false};
+
+  struct event {
+    const char *name;
+    const char *cat;
+    char ph;           // Chrome trace event phase: 'X' complete, 'i' instant, 'b'/'e' async begin/end
+    uint64_t ts_ns;
+    uint64_t dur_ns;
+    uint64_t id;
+    int tid;
+    unsigned nargs;
+    arg_t args[4];
+    const char *text_key;
+    std::string text;
+  };
+
+  /*
+   * An event buffer, held by one recording thread at a time. The buffers
+   * form a list that is only ever pushed onto (lock-free), and are never
+   * freed: a thread that exits lets go of its buffer, events and all, and the
+   * next thread to start recording takes it over - so a short lived thread
+   * (a std::async task per ready stream) takes no global lock, and reuses the
+   * storage that the threads before it grew, rather than allocating its own.
+   */
+  struct thread_buffer {
+    std::mutex guard;
+    std::vector<event> events{};
+    std::atomic_bool is_held{true};
+    thread_buffer *next{nullptr};
+  };
+
+  static std::atomic<thread_buffer*> buffers{nullptr};
+
+  // the buffer of the calling thread - taken on its first event
+  struct thread_slot {
+    thread_buffer *buf{nullptr};
+    int tid{0};
+    ~thread_slot() {
+      if (buf != nullptr) {
+        buf->is_held.store(false, std::memory_order_release);
+      }
+    }
+  };
+
+  static thread_local thread_slot tls_slot;
+
+  static thread_buffer& take_buffer() {
+    for(auto p = buffers.load(std::memory_order_acquire); p != nullptr; p = p->next) {
+      bool expected = false;
+      if (!p->is_held.load(std::memory_order_relaxed) && p->is_held.compare_exchange_strong(expected, true)) return *p;
+    }
+    auto const p = new thread_buffer{};
+    p->next = buffers.load(std::memory_order_relaxed);
+    while (!buffers.compare_exchange_weak(p->next, p, std::memory_order_release, std::memory_order_relaxed)) {}
+    return *p;
+  }
+
+  static int thread_tid() {
+    if (tls_slot.tid == 0) {
+      tls_slot.tid = static_cast<int>(syscall(SYS_gettid));
+    }
+    return tls_slot.tid;
+  }
+
+  static std::mutex registry_guard;
+  static std::vector<std::pair<int, std::string>> thread_names;
+  static FILE *trace_file = nullptr;
+  static std::string trace_file_path;
+  static uint64_t base_ns = 0;
+
+  static void record(char const ph, const char *const name, const char *const cat, uint64_t const ts_ns,
+                     uint64_t const dur_ns, uint64_t const id, const arg_t *const args, unsigned const nargs,
+                     const char *const text_key, std::string_view text)
+  {
+    if (tls_slot.buf == nullptr) {
+      tls_slot.buf = &take_buffer();
+    }
+    auto &buf = *tls_slot.buf;
+    event ev{name, cat, ph, ts_ns, dur_ns, id, thread_tid(), std::min(nargs, 4u), {}, text_key, std::string{text}};
+    std::copy(args, args + ev.nargs, ev.args);
+    std::lock_guard<std::mutex> lk(buf.guard);
+    buf.events.push_back(std::move(ev));
+  }
+
+  bool start(std::string_view file_path) {
+    std::lock_guard<std::mutex> lk(registry_guard);
+    if (trace_file != nullptr) return true;
+    trace_file_path = file_path;
+    trace_file = fopen(trace_file_path.c_str(), "w");
+    if (trace_file == nullptr) {
+      LOG_ERROR("%d: %s() -> fopen(\"%s\"): %s\n", __LINE__, __FUNCTION__, trace_file_path.c_str(), strerror(errno));
+      return false;
+    }
+    base_ns = metrics::now_ns();
+    active.store(true, std::memory_order_release);
+    return true;
+  }
+
+  void set_thread_name(std::string_view name) {
+    if (!enabled()) return;
+    const int tid = thread_tid();
+    std::lock_guard<std::mutex> lk(registry_guard);
+    thread_names.emplace_back(tid, std::string{name});
+  }
+
+  void instant(const char *const name, const char *const cat, std::initializer_list<arg_t> args) {
+    if (!enabled()) return;
+    record('i', name, cat, metrics::now_ns(), 0, 0, args.begin(), static_cast<unsigned>(args.size()), nullptr, {});
+  }
+
+  void async_begin(const char *const name, const char *const cat, uint64_t const id,
+                   std::initializer_list<arg_t> args, const char *const text_key, std::string_view text)
+  {
+    if (!enabled()) return;
+    record('b', name, cat, metrics::now_ns(), 0, id, args.begin(), static_cast<unsigned>(args.size()),
+           text_key, text);
+  }
+
+  void async_end(const char *const name, const char *const cat, uint64_t const id,
+                 std::initializer_list<arg_t> args)
+  {
+    if (!enabled()) return;
+    record('e', name, cat, metrics::now_ns(), 0, id, args.begin(), static_cast<unsigned>(args.size()), nullptr, {});
+  }
+
+  span::span(const char *const name, const char *const cat)
+      : name{name}, cat{cat}, start_ns{enabled() ? metrics::now_ns() : 0} {}
+
+  span::~span() {
+    if (!is_active() || !enabled()) return;
+    record('X', name, cat, start_ns, metrics::now_ns() - start_ns, 0, args, nargs, text_key, text);
+  }
+
+  static void write_json_string(FILE *const out, std::string_view str) {
+    fputc('"', out);
+    for(const char ch : str) {
+      if (ch == '"' || ch == '\\') {
+        fputc('\\', out);
+        fputc(ch, out);
+      } else if (static_cast<unsigned char>(ch) < 0x20) {
+        fprintf(out, "\\u%04x", ch);
+      } else {
+        fputc(ch, out);
+      }
+    }
+    fputc('"', out);
+  }
+
+  static void write_event(FILE *const out, const event &ev, int const pid) {
+    fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f",
+            ev.name, ev.cat, ev.ph, pid, ev.tid, static_cast<double>(ev.ts_ns - base_ns) / 1e3);
+    switch(ev.ph) {
+      case 'X':
+        fprintf(out, ",\"dur\":%.3f", static_cast<double>(ev.dur_ns) / 1e3);
+        break;
+      case 'i':
+        fputs(",\"s\":\"t\"", out);
+        break;
+      case 'b':
+      case 'e':
+        fprintf(out, ",\"id\":\"0x%lx\"", ev.id);
+        break;
+      default:
+        break;
+    }
+    if (ev.nargs > 0 || ev.text_key != nullptr) {
+      fputs(",\"args\":{", out);
+      for(unsigned i = 0; i < ev.nargs; i++) {
+        fprintf(out, "%s\"%s\":%ld", i > 0 ? "," : "", ev.args[i].key, ev.args[i].value);
+      }
+      if (ev.text_key != nullptr) {
+        fprintf(out, "%s\"%s\":", ev.nargs > 0 ? "," : "", ev.text_key);
+        write_json_string(out, ev.text);
+      }
+      fputc('}', out);
+    }
+    fputc('}', out);
+  }
+
+  bool finish() {
+    if (!active.exchange(false)) return true;
+    std::lock_guard<std::mutex> lk(registry_guard);
+    auto const out = trace_file;
+    trace_file = nullptr;
+    auto const pid = getpid();
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                 "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"rd-multi-strm\"}}",
+            pid);
+    for(auto const &[tid, name] : thread_names) {
+      fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid, tid);
+      write_json_string(out, name);
+      fputs("}}", out);
+    }
+    size_t count = 0;
+    for(auto pbuf = buffers.load(std::memory_order_acquire); pbuf != nullptr; pbuf = pbuf->next) {
+      std::lock_guard<std::mutex> lk2(pbuf->guard);
+      for(auto const &ev : pbuf->events) {
+        write_event(out, ev, pid);
+        count++;
+      }
+      pbuf->events.clear();
+    }
+    fputs("\n]}\n", out);
+    if (fclose(out) != 0) {
+      LOG_ERROR("%d: %s() -> writing \"%s\": %s\n", __LINE__, __FUNCTION__, trace_file_path.c_str(), strerror(errno));
+      return false;
+    }
+    LOG_INFO("wrote %lu trace events to \"%s\"\n", count, trace_file_path.c_str());
+    return true;
+  }
+
+}
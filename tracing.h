@@ -0,0 +1,89 @@
+/* tracing.h
+
+Copyright 2026 Roger D. Voss
+
+Created on 10/18/2026.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <cstdint>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <initializer_list>
+
+/*
+ * Optional event tracing of the program's activity, written out as Chrome
+ * Trace Event JSON (viewable in chrome://tracing or ui.perfetto.dev).
+ *
+ * Events are appended to a buffer held by the recording thread (the lock
+ * guarding it is only ever contended while the trace is being written out),
+ * and the buffers are gathered up into the trace file by tracing::finish().
+ * A buffer, grown as needed, outlives its thread and is taken over by the
+ * next thread to record an event.
+ * When tracing has not been started, recording an event costs a relaxed
+ * load of a flag.
+ */
+namespace tracing {
+  extern std::atomic_bool active;
+  inline bool enabled() { return active.load(std::memory_order_relaxed); }
+
+  struct arg_t {
+    const char *key;
+    int64_t value;
+  };
+
+  bool start(std::string_view file_path);
+  bool finish();
+
+  void set_thread_name(std::string_view name);
+
+  void instant(const char *name, const char *cat, std::initializer_list<arg_t> args = {});
+  // an async span may begin and end on different threads; it is matched up by its id
+  void async_begin(const char *name, const char *cat, uint64_t id, std::initializer_list<arg_t> args = {},
+                   const char *text_key = nullptr, std::string_view text = {});
+  void async_end(const char *name, const char *cat, uint64_t id, std::initializer_list<arg_t> args = {});
+
+  // a complete event recorded for the lifetime of this object (if tracing was enabled when it was constructed)
+  class span {
+    static constexpr unsigned max_args = 4;
+    const char *const name;
+    const char *const cat;
+    const uint64_t start_ns;
+    arg_t args[max_args]{};
+    unsigned nargs{0};
+    const char *text_key{nullptr};
+    std::string text{};
+  public:
+    span(const char *name, const char *cat);
+    span(const span &) = delete;
+    span& operator=(const span &) = delete;
+    ~span();
+    bool is_active() const { return start_ns != 0; }
+    void arg(const char *key, int64_t value) {
+      if (is_active() && nargs < max_args) args[nargs++] = arg_t{key, value};
+    }
+    void set_text(const char *key, std::string_view value) {
+      if (is_active()) {
+        text_key = key;
+        text = value;
+      }
+    }
+  };
+}
+
+#endif //TRACING_H
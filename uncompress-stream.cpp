@@ -23,18 +23,37 @@ limitations under the License.
 #include <cstring>
 #include <cerrno>
 #include <memory>
+#include <string>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include "util.h"
+#include "logging.h"
+#include "tracing.h"
 #include "child-process-tracking.h"
+#include "signal-handling.h"
 #include "uncompress-stream.h"
 
-std::tuple<int, int> get_uncompressed_stream(std::string_view filepath) {
+/**
+ * Forks a child process with its stdout and stderr redirected to pipes, then
+ * runs child_main in the child (which is expected to either exec a program
+ * or call _exit()). The parent tracks the child so that its write pipe ends
+ * are closed when it terminates.
+ *
+ * @param description what the child process is - for diagnostics and tracing
+ * @param child_main runs in the forked child after the redirection of stdout/stderr
+ * @return the pipe read ends of the child's stdout and stderr, or {-1, -1} on failure
+ */
+std::tuple<int, int> get_child_process_stream(std::string_view description, const child_main_t &child_main) {
   enum PIPES : short { READ = 0, WRITE = 1 };
 
+  tracing::span spawn_span{"spawn child", "child"};
+
   int stdout_pipes[2] { -1, -1 };
-  auto rc = pipe(stdout_pipes); int line_nbr = __LINE__;
+  // close-on-exec, as otherwise each later spawned child would inherit the ends of
+  // this pipe - holding a write end open would keep the stream from seeing end-of-file
+  auto rc = pipe2(stdout_pipes, O_CLOEXEC); int line_nbr = __LINE__;
   if (rc == -1) {
-    fprintf(stderr, "ERROR: %d: %s() -> pipe(): %s\n", line_nbr, __FUNCTION__, strerror(errno));
+    LOG_ERROR("%d: %s() -> pipe2(): %s\n", line_nbr, __FUNCTION__, strerror(errno));
     return std::tuple<int, int>{-1, -1};
   }
 
@@ -52,9 +71,9 @@ std::tuple<int, int> get_uncompressed_stream(std::string_view filepath) {
   std::unique_ptr<int[],decltype(cleanup_pipes)> sp_stdout_pipes(stdout_pipes, cleanup_pipes);
 
   int stderr_pipes[2] { -1, -1 };
-  rc = pipe(stderr_pipes); line_nbr = __LINE__;
+  rc = pipe2(stderr_pipes, O_CLOEXEC); line_nbr = __LINE__;
   if (rc == -1) {
-    fprintf(stderr, "ERROR: %d: %s() -> pipe(): %s\n", line_nbr, __FUNCTION__, strerror(errno));
+    LOG_ERROR("%d: %s() -> pipe2(): %s\n", line_nbr, __FUNCTION__, strerror(errno));
     return std::tuple<int, int>{-1, -1};
   }
 
@@ -64,23 +83,9 @@ std::tuple<int, int> get_uncompressed_stream(std::string_view filepath) {
   auto const fd_stdout = stdout_pipes[PIPES::READ];
   auto const fd_stderr = stderr_pipes[PIPES::READ];
 
-  auto const stdout_flags = fcntl(fd_stdout, F_GETFL, 0);
-  rc = fcntl(fd_stdout, F_SETFD, stdout_flags | FD_CLOEXEC); line_nbr = __LINE__;
-  if (rc == -1) {
-    fprintf(stderr, "ERROR: %d: %s() -> fcntl(fd: %d): %s\n", line_nbr, __FUNCTION__, fd_stdout, strerror(errno));
-    return std::tuple<int, int>{-1, -1};
-  }
-
-  auto const stderr_flags = fcntl(fd_stderr, F_GETFL, 0);
-  rc = fcntl(fd_stderr, F_SETFD, stderr_flags | FD_CLOEXEC); line_nbr = __LINE__;
-  if (rc == -1) {
-    fprintf(stderr, "ERROR: %d: %s() -> fcntl(fd: %d): %s\n", line_nbr, __FUNCTION__, fd_stderr, strerror(errno));
-    return std::tuple<int, int>{-1, -1};
-  }
-
   auto const pid = fork(); line_nbr = __LINE__;
   if (pid == -1) {
-    fprintf(stderr, "ERROR: %d: %s() -> fork(): %s\n", line_nbr, __FUNCTION__, strerror(errno));
+    LOG_ERROR("%d: %s() -> fork(): %s\n", line_nbr, __FUNCTION__, strerror(errno));
     return std::tuple<int, int>{-1, -1};
   }
   if (pid == 0) {
@@ -96,28 +101,25 @@ std::tuple<int, int> get_uncompressed_stream(std::string_view filepath) {
     dbg_dump_file_desc_flags(stderr_fd);
     close(stdout_fd);
     close(stderr_fd);
+    signal_handling::reset_child_signals(); // the parent's signal mask (blocking them) is inherited
 
-    // invoke the gzip program
-    static const char gzip[] = "gzip";
-    fprintf(stderr, "DEBUG: child process pid(%d) -> writing fd: %d; exec of: '%s -dc %s'\n",
-            getpid(), stdout_fd, gzip, filepath.data());
-    execlp(gzip, gzip, "-dc", filepath.data(), static_cast<char*>(nullptr)); line_nbr = __LINE__;
-
-    // only executes following statements if the execlp() call fatally failed
-    fprintf(stderr, "ERROR: %d: %s() -> execlp(): %s\n", line_nbr, __FUNCTION__, strerror(errno));
-    _exit(1);
+    child_main();
+    _exit(1); // child_main is not expected to return
   }
 
   // only the parent process, after the fork() call, arrives at these statements
 
-  // restore original flag settings
-  fcntl(fd_stdout, F_SETFD, stdout_flags);
-  fcntl(fd_stderr, F_SETFD, stderr_flags);
+  // the write ends are the child's alone - the streams see end-of-file as soon as it exits
+  close(stdout_pipes[PIPES::WRITE]);
+  close(stderr_pipes[PIPES::WRITE]);
+  start_tracking_child_process(pid /*child pid */, fd_stdout);
 
-  start_tracking_child_process(pid /*child pid */, stdout_pipes[PIPES::WRITE], stderr_pipes[PIPES::WRITE]);
+  spawn_span.arg("pid", pid);
+  spawn_span.set_text("input", description);
+  tracing::async_begin("child process", "child", static_cast<uint64_t>(pid), {{"pid", pid}}, "input", description);
 
-  fprintf(stderr, "DEBUG: parent process pid(%d) -> reading stdout fd from: %d and stderr fd from: %d : \"%s\"\n",
-          getpid(), fd_stdout, fd_stderr, filepath.data());
+  LOG_DEBUG("parent process pid(%d) -> reading stdout fd from: %d and stderr fd from: %d : \"%s\"\n",
+            getpid(), fd_stdout, fd_stderr, description.data());
 
   stdout_pipes[PIPES::READ] = stdout_pipes[PIPES::WRITE] = -1;
   sp_stdout_pipes.release();
@@ -125,4 +127,39 @@ std::tuple<int, int> get_uncompressed_stream(std::string_view filepath) {
   sp_stderr_pipes.release();
 
   return std::tuple<int, int>{fd_stdout, fd_stderr};
-}
\ No newline at end of file
+}
+
+std::tuple<int, int> get_uncompressed_stream(std::string_view filepath) {
+  return get_child_process_stream(filepath, [filepath] {
+    // invoke the gzip program
+    static const char gzip[] = "gzip";
+    fprintf(stderr, "DEBUG: child process pid(%d) -> exec of: '%s -dc %s'\n", getpid(), gzip, filepath.data());
+    execlp(gzip, gzip, "-dc", filepath.data(), static_cast<char*>(nullptr)); int line_nbr = __LINE__;
+
+    // only executes following statements if the execlp() call fatally failed
+    fprintf(stderr, "ERROR: %d: %s() -> execlp(): %s\n", line_nbr, "get_uncompressed_stream", strerror(errno));
+    _exit(1);
+  });
+}
+
+/**
+ * Estimates the decompressed size of a gzip file from the ISIZE field of its
+ * trailer - the size of the last member's input modulo 2^32 - which is the
+ * size of the whole output for the usual single member file under 4 GiB.
+ *
+ * @return the estimate, or 0 where ISIZE can not be the whole of it (it being
+ * less than the compressed size means a larger or multi-member file)
+ */
+uint64_t get_uncompressed_size_hint(std::string_view filepath) {
+  std::string const path{filepath};
+  auto const fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return 0;
+  struct stat st{};
+  unsigned char isize[4];
+  bool const is_read = fstat(fd, &st) == 0 && st.st_size >= 18 && // the smallest gzip file is 18 bytes
+                       pread(fd, isize, sizeof(isize), st.st_size - 4) == sizeof(isize);
+  close(fd);
+  if (!is_read) return 0;
+  uint64_t const size = isize[0] | (isize[1] << 8) | (isize[2] << 16) | (static_cast<uint64_t>(isize[3]) << 24);
+  return size >= static_cast<uint64_t>(st.st_size) ? size : 0;
+}
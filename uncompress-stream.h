@@ -21,8 +21,15 @@ limitations under the License.
 #ifndef UNCOMPRESS_STREAM_H
 #define UNCOMPRESS_STREAM_H
 
+#include <cstdint>
+#include <tuple>
 #include <string_view>
+#include <functional>
 
+using child_main_t = std::function<void()>;
+
+std::tuple<int, int> get_child_process_stream(std::string_view description, const child_main_t &child_main);
 std::tuple<int, int> get_uncompressed_stream(std::string_view filepath);
+uint64_t get_uncompressed_size_hint(std::string_view filepath);
 
 #endif //UNCOMPRESS_STREAM_H
@@ -22,7 +22,13 @@ limitations under the License.
 #include <cassert>
 #include <cstring>
 #include <memory>
+#include <cstdint>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cerrno>
 #include "util.h"
+#include "signal-handling.h"
+#include "logging.h"
 
 std::string get_unmangled_name(std::string_view mangled_name) {
   auto const free_nm = [](char *p) { std::free(p); };
@@ -36,7 +42,7 @@ int get_file_desc(FILE *stream, const int line_nbr) {
   assert(stream != nullptr);
   const int fd = fileno(stream);
   if (fd == -1) {
-    fprintf(stderr, "ERROR: %d: %s() -> fileno(): %s\n", line_nbr, __FUNCTION__, strerror(errno));
+    LOG_ERROR("%d: %s() -> fileno(): %s\n", line_nbr, __FUNCTION__, strerror(errno));
     return -1;
   }
   return fd;
@@ -54,8 +60,8 @@ bool has_ending(std::string_view full_str, std::string_view ending, int &offset,
     rslt = (0 == full_str.compare(static_cast<unsigned long>(offset), ending.length(), ending));
   }
   if (!rslt) {
-    fprintf(stderr, "ERROR: %d: %s() -> \"%s\" is not a %s compressed file\n",
-            line_nbr, __FUNCTION__, full_str.data(), ending.data());
+    LOG_ERROR("%d: %s() -> \"%s\" is not a %s compressed file\n",
+              line_nbr, __FUNCTION__, full_str.data(), ending.data());
   }
   return rslt;
 }
@@ -120,3 +126,40 @@ void dbg_dump_file_desc_flags(int const fd) {
   );
 #endif
 }
+
+size_t raise_open_files_limit() {
+  struct rlimit rl{0, 0};
+  if (getrlimit(RLIMIT_NOFILE, &rl) == -1) {
+    LOG_WARN("%d: %s() -> getrlimit(): %s\n", __LINE__, __FUNCTION__, strerror(errno));
+    return 0;
+  }
+  if (rl.rlim_cur != rl.rlim_max) {
+    auto const soft = rl.rlim_cur;
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) == -1) {
+      LOG_WARN("%d: %s() -> setrlimit(): %s\n", __LINE__, __FUNCTION__, strerror(errno));
+      rl.rlim_cur = soft;
+    } else {
+      LOG_DEBUG("open files limit raised from %lu to %lu\n", soft, rl.rlim_cur);
+    }
+  }
+  return rl.rlim_cur == RLIM_INFINITY ? SIZE_MAX : static_cast<size_t>(rl.rlim_cur);
+}
+
+bool write_fully(int const fd, const char *data, size_t len) {
+  while (len > 0) {
+    auto const n = write(fd, data, len);
+    if (n == -1) {
+      if (errno == EINTR && !signal_handling::interrupted()) continue;
+      return false;
+    }
+    data += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+void sleep_until(const struct timespec &deadline) {
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR &&
+         !signal_handling::interrupted()) {}
+}
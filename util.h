@@ -22,6 +22,7 @@ limitations under the License.
 #define UTIL_H
 
 #include <cstdio>
+#include <ctime>
 #include <string_view>
 
 std::string get_unmangled_name(std::string_view mangled_name);
@@ -30,5 +31,17 @@ bool valid_file(std::string_view filepath);
 bool has_ending(std::string_view full_str, std::string_view ending, int &offset, int line_nbr);
 bool dbg_echo_input_source(int fd, int line_nbr);
 void dbg_dump_file_desc_flags(int fd);
+// raises the soft RLIMIT_NOFILE to the hard limit; returns the resulting soft limit
+size_t raise_open_files_limit();
+
+/*
+ * For the body of a child process forked from this multi-threaded process
+ * (a synthetic or replayed input stream), which may only make system calls:
+ * a write() of all of the data, retried on a short or interrupted write unless
+ * the process is interrupted (false once the reader has gone away), and a
+ * sleep until a CLOCK_MONOTONIC deadline, cut short if the process is interrupted.
+ */
+bool write_fully(int fd, const char *data, size_t len);
+void sleep_until(const struct timespec &deadline);
 
 #endif //UTIL_H